@@ -42,6 +42,9 @@ volumeZScale = 0.08
 
 volume = myvolume.myOsgVolume.createAndInitialize( q, dataDir + "*", volumeAF, volumeXScale, volumeYScale, volumeZScale)
 volume.setSampleDensity(volumeSD)
+# the step starts at volumeSD and is adjusted from there to keep 30 frames a second
+volume.setSampleDensityRange(0.002, 0.02)
+volume.setTargetFrameRate(30)
 volume.setTransparency(volumeTP)
 volume.setAlphaFunc(volumeAF)
 volume.setPosition(0,1.7,-4.5)
@@ -145,6 +148,13 @@ def getTransfer():
 def drawTransfer():
 	global tfobj
 	tfobj.reDrawLine()
+def drawHistogram():
+	global tfobj
+	tfobj.drawHistogram()
+def suggestTransfer():
+	global tfobj
+	tfobj.suggest()
+	tfobj.drawHistogram()
 def resetTransfer():
 	global tfobj
 	global tfvalue
@@ -225,6 +235,8 @@ t = transferMenu.addSlider(max, "changeTransfer()")
 tfvalue.append(t.getSlider())
 transferMenu.addButton("update", "drawTransfer()")
 transferMenu.addButton("reset", "resetTransfer()")
+transferMenu.addButton("histogram", "drawHistogram()")
+transferMenu.addButton("suggest", "suggestTransfer()")
 ################################
 
 
@@ -361,11 +373,10 @@ def onEvent():
 				anchorPos = None
 			if(freeFly):
 				wandPos = e.getPosition()
-				#wandOrientation = e.getOrientation()
-				x = wandPos.x - anchorPos.x
-				y = wandPos.y - anchorPos.y
-				z = wandPos.z - anchorPos.z
-				volume.changeScaleClipping( scale * float(-x), scale * float(-y), scale * float(-z) )
+				wandOrientation = e.getOrientation()
+				# the clip plane goes through the wand, keeping what lies ahead of it
+				wandForward = wandOrientation * Vector3(0, 0, -1)
+				volume.setClipPlaneInWorld(0, wandPos.x, wandPos.y, wandPos.z, wandForward.x, wandForward.y, wandForward.z)
 				#box.translate( float(x)*scale, float(y)*scale, float(z)*scale, Space.World)
 				#box.setOrientation( box.getOrientation() * scene.getOrientation().conjugated() * anchorOrientation.conjugated() * wandOrientation * scene.getOrientation() )
 				anchorPos = wandPos
@@ -1,745 +1,1486 @@
-/* OpenSceneGraph example, osgvolume.
-*
-*  Permission is hereby granted, free of charge, to any person obtaining a copy
-*  of this software and associated documentation files (the "Software"), to deal
-*  in the Software without restriction, including without limitation the rights
-*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
-*  copies of the Software, and to permit persons to whom the Software is
-*  furnished to do so, subject to the following conditions:
-*
-*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
-*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
-*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
-*  THE SOFTWARE.
-*/
-#include "osgvolume.h"
-
-#include <osg/Node>
-#include <osg/Geometry>
-#include <osg/Notify>
-#include <osg/Texture3D>
-#include <osg/Texture1D>
-#include <osg/ImageSequence>
-#include <osg/TexGen>
-#include <osg/Geode>
-#include <osg/Billboard>
-#include <osg/PositionAttitudeTransform>
-#include <osg/ClipNode>
-#include <osg/ClipPlane>
-#include <osg/AlphaFunc>
-#include <osg/TexGenNode>
-#include <osg/TexEnv>
-#include <osg/TexEnvCombine>
-#include <osg/Material>
-#include <osg/PrimitiveSet>
-#include <osg/Endian>
-#include <osg/BlendFunc>
-#include <osg/BlendEquation>
-#include <osg/TransferFunction>
-#include <osg/MatrixTransform>
-
-#include <osgDB/Registry>
-#include <osgDB/ReadFile>
-#include <osgDB/WriteFile>
-#include <osgDB/FileUtils>
-#include <osgDB/FileNameUtils>
-
-#include <osgGA/EventVisitor>
-#include <osgGA/TrackballManipulator>
-#include <osgGA/FlightManipulator>
-#include <osgGA/KeySwitchMatrixManipulator>
-
-#include <osgUtil/CullVisitor>
-
-#include <osgViewer/Viewer>
-#include <osgViewer/ViewerEventHandlers>
-
-#include <osgManipulator/TabBoxDragger>
-#include <osgManipulator/TabPlaneTrackballDragger>
-#include <osgManipulator/TrackballDragger>
-
-#include <osg/io_utils>
-
-#include <algorithm>
-#include <iostream>
-
-#include <osg/ImageUtils>
-#include <osgVolume/Volume>
-#include <osgVolume/VolumeTile>
-#include <osgVolume/RayTracedTechnique>
-#include <osgVolume/FixedFunctionTechnique>
-
-#define OMEGA_NO_GL_HEADERS
-#include <omega.h>
-#include <omegaToolkit.h>
-#include <omegaOsg/omegaOsg.h>
-
-
-
-
-osg::Image* createTexture3D(osg::ImageList& imageList,
-            unsigned int numComponentsDesired,
-            int s_maximumTextureSize,
-            int t_maximumTextureSize,
-            int r_maximumTextureSize,
-            bool resizeToPowerOfTwo)
-{
-
-    if (numComponentsDesired==0)
-    {
-        return osg::createImage3DWithAlpha(imageList,
-                                        s_maximumTextureSize,
-                                        t_maximumTextureSize,
-                                        r_maximumTextureSize,
-                                        resizeToPowerOfTwo);
-    }
-    else
-    {
-        GLenum desiredPixelFormat = 0;
-        switch(numComponentsDesired)
-        {
-            case(1) : desiredPixelFormat = GL_LUMINANCE; break;
-            case(2) : desiredPixelFormat = GL_LUMINANCE_ALPHA; break;
-            case(3) : desiredPixelFormat = GL_RGB; break;
-            case(4) : desiredPixelFormat = GL_RGBA; break;
-        }
-
-        return osg::createImage3D(imageList,
-                                        desiredPixelFormat,
-                                        s_maximumTextureSize,
-                                        t_maximumTextureSize,
-                                        r_maximumTextureSize,
-                                        resizeToPowerOfTwo);
-    }
-}
-
-struct ScaleOperator
-{
-    ScaleOperator():_scale(1.0f) {}
-    ScaleOperator(float scale):_scale(scale) {}
-    ScaleOperator(const ScaleOperator& so):_scale(so._scale) {}
-
-    ScaleOperator& operator = (const ScaleOperator& so) { _scale = so._scale; return *this; }
-
-    float _scale;
-
-    inline void luminance(float& l) const { l*= _scale; }
-    inline void alpha(float& a) const { a*= _scale; }
-    inline void luminance_alpha(float& l,float& a) const { l*= _scale; a*= _scale;  }
-    inline void rgb(float& r,float& g,float& b) const { r*= _scale; g*=_scale; b*=_scale; }
-    inline void rgba(float& r,float& g,float& b,float& a) const { r*= _scale; g*=_scale; b*=_scale; a*=_scale; }
-};
-
-void clampToNearestValidPowerOfTwo(int& sizeX, int& sizeY, int& sizeZ, int s_maximumTextureSize, int t_maximumTextureSize, int r_maximumTextureSize)
-{
-    // compute nearest powers of two for each axis.
-    int s_nearestPowerOfTwo = 1;
-    while(s_nearestPowerOfTwo<sizeX && s_nearestPowerOfTwo<s_maximumTextureSize) s_nearestPowerOfTwo*=2;
-
-    int t_nearestPowerOfTwo = 1;
-    while(t_nearestPowerOfTwo<sizeY && t_nearestPowerOfTwo<t_maximumTextureSize) t_nearestPowerOfTwo*=2;
-
-    int r_nearestPowerOfTwo = 1;
-    while(r_nearestPowerOfTwo<sizeZ && r_nearestPowerOfTwo<r_maximumTextureSize) r_nearestPowerOfTwo*=2;
-
-    sizeX = s_nearestPowerOfTwo;
-    sizeY = t_nearestPowerOfTwo;
-    sizeZ = r_nearestPowerOfTwo;
-}
-
-class TestSupportOperation: public osg::GraphicsOperation
-{
-public:
-
-    TestSupportOperation():
-        osg::GraphicsOperation("TestSupportOperation",false),
-        supported(true),
-        errorMessage(),
-        maximumTextureSize(256) {}
-
-    virtual void operator () (osg::GraphicsContext* gc)
-    {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
-
-        glGetIntegerv( GL_MAX_3D_TEXTURE_SIZE, &maximumTextureSize );
-
-        osg::notify(osg::NOTICE)<<"Max texture size="<<maximumTextureSize<<std::endl;
-    }
-
-    OpenThreads::Mutex  mutex;
-    bool                supported;
-    std::string         errorMessage;
-    GLint               maximumTextureSize;
-};
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-// Python wrapper code.
-#ifdef OMEGA_USE_PYTHON
-#include "omega/PythonInterpreterWrapper.h"
-BOOST_PYTHON_MODULE(myvolume)
-{
-	// SceneLoader
-	PYAPI_REF_BASE_CLASS(myOsgVolume)
-		PYAPI_STATIC_REF_GETTER(myOsgVolume, createAndInitialize)
-		PYAPI_METHOD(myOsgVolume, setPosition)
-		PYAPI_METHOD(myOsgVolume, setRotation)
-		PYAPI_METHOD(myOsgVolume, translate)
-		PYAPI_METHOD(myOsgVolume, rotate)
-		
-		PYAPI_METHOD(myOsgVolume, activateEffect)
-
-		PYAPI_METHOD(myOsgVolume, setCustomizedProperty)
-		PYAPI_METHOD(myOsgVolume, setClipping)
-		PYAPI_METHOD(myOsgVolume, addTransferPoint)
-		PYAPI_METHOD(myOsgVolume, clearTransferFunction)
-		PYAPI_METHOD(myOsgVolume, setAlphaFunc)
-		PYAPI_METHOD(myOsgVolume, setScale)
-		PYAPI_METHOD(myOsgVolume, setSampleDensity)
-		PYAPI_METHOD(myOsgVolume, setTransparency)
-		PYAPI_METHOD(myOsgVolume, setDirty)
-		;
-		//PYAPI_METHOD(HelloModule, )
-		
-}
-#endif
-
-void myOsgVolume::setPosition( float x, float y, float z)
-{
-	this->modelForm->setPosition(osg::Vec3f(x, y, z));
-}
-
-void myOsgVolume::setRotation( float fx, float fy, float fz, float degree)
-{
-	this->modelForm->setAttitude(osg::Quat(degree, osg::Vec3f(fx, fy, fz)));
-}
-
-void myOsgVolume::translate( float x, float y, float z)
-{
-	osg::Vec3d pos = this->modelForm->getPosition();
-	pos+=osg::Vec3d(x, y, z);
-	this->modelForm->setPosition(pos);
-}
-
-void myOsgVolume::rotate( float fx, float fy, float fz, float degree)
-{
-	osg::Quat quat = this->modelForm->getAttitude();
-	quat*=osg::Quat(degree,osg::Vec3f(fx, fy, fz));
-	this->modelForm->setAttitude(quat);
-}
-
-myOsgVolume* myOsgVolume::createAndInitialize(std::string filename, float alpha, float fx, float fy, float fz)
-{
-	myOsgVolume* instance = new myOsgVolume(filename, alpha, fx, fy, fz);
-	ModuleServices::addModule(instance);
-	instance->doInitialize(Engine::instance());
-	return instance;
-}
-
-void myOsgVolume::update(const UpdateContext& context)
-{
-}
-
-void myOsgVolume::setArguments()
-{
-	//std::cout << "*********************" << std::endl;
-	//imageFile = "C:\\AJ\\CS526\\data\\bmp\\"*;
-	//std::cout << imageFile << std::endl;
-	//_xScale = 1.0;
-	//_yScale = 1.0;
-	//_zScale = 1.0;
-	//_alpha = 0.02;
-	//modelForm = new osg::PositionAttitudeTransform();
-	//modelForm->setPosition(osg::Vec3(0,0,0));
-}
-
-void myOsgVolume::setAlphaFunc(float alpha)
-{
-	_alpha = alpha;
-	if(_ap)
-	{
-		_ap->setValue(alpha);
-		setDirty();
-	}
-}
-
-void myOsgVolume::setScale( float x, float y, float z)
-{
-	_xScale = x;
-	_yScale = y;
-	_zScale = z;
-}
-
-void myOsgVolume::setSampleDensity(float sd)
-{
-	_sampleDensity = sd;
-	if(_sd)
-	{
-		_sd->setValue(sd);
-		setDirty();
-	}
-}
-
-void myOsgVolume::setTransparency(float tp)
-{
-	_transparency = tp;
-	if(_tp)
-	{
-		_tp->setValue(tp);
-		setDirty();
-	}
-}
-
-void myOsgVolume::clearTransferFunction()
-{
-	_tf->clear();
-}
-
-void myOsgVolume::addTransferPoint(float intensity, float r, float g, float b, float alpha)
-{
-	_tf->setColor(intensity, osg::Vec4(r, g, b, alpha));
-}
-
-void myOsgVolume::setDirty()
-{
-	_volumeTile->setDirty(true);
-}
-
-
-void myOsgVolume::setCustomizedProperty()
-{
-}
-
-void myOsgVolume::setClipping()
-{
-	_volumeTile->setLocator(new osgVolume::Locator(osg::Matrix::translate(0.5, 0, 0)*osg::Matrix::rotate(osg::Quat(0.2, osg::Vec3f(0,1,0)))*osg::Matrix::scale(0.5,0.5,0.5)* (*_matrix)));
-	setDirty();
-}
-
-void myOsgVolume::activateEffect(int index)
-{
-	//std::cout << index << " " << _volumeTile->getDirty() << std::endl;
-	switch(index)
-    {
-		case(0):	_effectProperty->setActiveProperty(0); break;
-        case(1):	_effectProperty->setActiveProperty(1); break;
-        case(2):	_effectProperty->setActiveProperty(2); break;
-        case(3):	_effectProperty->setActiveProperty(3); break;
-		default:	std::cout<< "out of range" << std::endl; break;
-    }
-	//std::cout << "And: " << _volumeTile->getDirty() << std::endl;
-	//_imageLayer->dirty();
-	setDirty();
-
-}
-
-
-void myOsgVolume::initialize()
-{
-	//this->setArguments();
-	int argcT= 1;
-	char buffer[10] = "osgvolume";
-	char* q = buffer;
-	char* argvT[10];
-	*argvT = buffer;
-	std::cout << "************ test********* " << argvT[0] << std::endl;
-	osg::ArgumentParser arguments(&argcT, argvT);
-
-	osg::ref_ptr<osg::TransferFunction1D> transferFunction;
-	if(true)
-    {
-        transferFunction = new osg::TransferFunction1D;
-        transferFunction->setColor(0.0, osg::Vec4(1.0,1.0,1.0,0.0));
-        transferFunction->setColor(1.0, osg::Vec4(1.0,1.0,1.0,1.0));
-    }
-	_tf = transferFunction;
-
-	float xMultiplier = this->_xScale;
-	float yMultiplier = this->_yScale;
-	float zMultiplier = this->_zScale;
-	float alphaFunc = this->_alpha;
-    
-	ShadingModel shadingModel = MaximumIntensityProjection;
-
-    float xSize=0.0f, ySize=0.0f, zSize=0.0f;
-    
-    osg::ref_ptr<TestSupportOperation> testSupportOperation = new TestSupportOperation;
-
-
-    int maximumTextureSize = testSupportOperation->maximumTextureSize;
-    int s_maximumTextureSize = maximumTextureSize;
-    int t_maximumTextureSize = maximumTextureSize;
-    int r_maximumTextureSize = maximumTextureSize;
-    while(arguments.read("--maxTextureSize",maximumTextureSize))
-    {
-        s_maximumTextureSize = maximumTextureSize;
-        t_maximumTextureSize = maximumTextureSize;
-        r_maximumTextureSize = maximumTextureSize;
-    }
-    while(arguments.read("--s_maxTextureSize",s_maximumTextureSize)) {}
-    while(arguments.read("--t_maxTextureSize",t_maximumTextureSize)) {}
-    while(arguments.read("--r_maxTextureSize",r_maximumTextureSize)) {}
-
-    // set up colour space operation.
-    osg::ColorSpaceOperation colourSpaceOperation = osg::NO_COLOR_SPACE_OPERATION;
-    osg::Vec4 colourModulate(0.25f,0.25f,0.25f,0.25f);
-    while(arguments.read("--modulate-alpha-by-luminance")) { colourSpaceOperation = osg::MODULATE_ALPHA_BY_LUMINANCE; }
-    while(arguments.read("--modulate-alpha-by-colour", colourModulate.x(),colourModulate.y(),colourModulate.z(),colourModulate.w() )) { colourSpaceOperation = osg::MODULATE_ALPHA_BY_COLOR; }
-    while(arguments.read("--replace-alpha-with-luminance")) { colourSpaceOperation = osg::REPLACE_ALPHA_WITH_LUMINANCE; }
-    while(arguments.read("--replace-rgb-with-luminance")) { colourSpaceOperation = osg::REPLACE_RGB_WITH_LUMINANCE; }
-
-
-    enum RescaleOperation
-    {
-        NO_RESCALE,
-        RESCALE_TO_ZERO_TO_ONE_RANGE,
-        SHIFT_MIN_TO_ZERO
-    };
-
-    RescaleOperation rescaleOperation = RESCALE_TO_ZERO_TO_ONE_RANGE;
-
-    bool resizeToPowerOfTwo = false;
-
-    unsigned int numComponentsDesired = 0;
-    while(arguments.read("--num-components", numComponentsDesired)) {}
-
-    bool useManipulator = false;
-    
-    bool useShader = true;
-    
-    bool gpuTransferFunction = true;
-    
-    double sampleDensityWhenMoving = 0.0;
-    
-    double sequenceLength = 10.0;
-    
-    typedef std::list< osg::ref_ptr<osg::Image> > Images;
-    Images images;
-
-	osg::ImageList imageList;
-	if (imageFile.length() > 0)
-    {
-		std::string arg = imageFile;
-        if (arg.find('*') != std::string::npos)
-        {
-            osgDB::DirectoryContents contents = osgDB::expandWildcardsInFilename(arg);
-            for (unsigned int i = 0; i < contents.size(); ++i)
-            {
-                osg::Image *image = osgDB::readImageFile( contents[i] );
-
-                if(image)
-                {
-                    OSG_NOTICE<<"Read osg::Image FileName::"<<image->getFileName()<<", pixelFormat=0x"<<std::hex<<image->getPixelFormat()<<std::dec<<", s="<<image->s()<<", t="<<image->t()<<", r="<<image->r()<<std::endl;
-                    imageList.push_back(image);
-                }
-            }
-        }
-        else
-        {
-            // not an option so assume string is a filename.
-            osg::Image *image = osgDB::readImageFile( arg );
-
-            if(image)
-            {
-                OSG_NOTICE<<"Read osg::Image FileName::"<<image->getFileName()<<", pixelFormat=0x"<<std::hex<<image->getPixelFormat()<<std::dec<<", s="<<image->s()<<", t="<<image->t()<<", r="<<image->r()<<std::endl;
-                imageList.push_back(image);
-            }
-        }
-    }
-	
-    // pack the textures into a single texture.
-    osg::Image* image = createTexture3D(imageList, numComponentsDesired, s_maximumTextureSize, t_maximumTextureSize, r_maximumTextureSize, resizeToPowerOfTwo);
-    if (image)
-    {
-        images.push_back(image);
-    }
-    else
-    {
-        OSG_NOTICE<<"Unable to create 3D image from source files."<<std::endl;
-    }
-
-
-    if (images.empty())
-    {
-        std::cout<<"No model loaded, please specify a volumetric image file on the command line."<<std::endl;
-        return;
-    }
-
-
-    Images::iterator sizeItr = images.begin();
-    int image_s = (*sizeItr)->s();
-    int image_t = (*sizeItr)->t();
-    int image_r = (*sizeItr)->r();
-    ++sizeItr;
-
-	std::cout << ">>>>>>>>>>>>>>>>>image size>>>>>>>>>>>>>>>>>>>>>>" << std::endl;
-	std::cout << image_s << " " << image_t << " " << image_r << std::endl;
-
-    for(;sizeItr != images.end(); ++sizeItr)
-    {
-        if ((*sizeItr)->s() != image_s ||
-            (*sizeItr)->t() != image_t ||
-            (*sizeItr)->r() != image_r)
-        {
-            std::cout<<"Images in sequence are not of the same dimensions."<<std::endl;
-            return;
-        }
-    }
-
-
-    osg::ref_ptr<osgVolume::ImageDetails> details = dynamic_cast<osgVolume::ImageDetails*>(images.front()->getUserData());
-    osg::ref_ptr<osg::RefMatrix> matrix = details ? details->getMatrix() : dynamic_cast<osg::RefMatrix*>(images.front()->getUserData());
-
-    if (!matrix)
-    {
-        if (xSize==0.0) xSize = static_cast<float>(image_s);
-        if (ySize==0.0) ySize = static_cast<float>(image_t);
-        if (zSize==0.0) zSize = static_cast<float>(image_r);
-
-        matrix = new osg::RefMatrix(xSize, 0.0,   0.0,   0.0,
-                                    0.0,   ySize, 0.0,   0.0,
-                                    0.0,   0.0,   zSize, 0.0,
-                                    0.0,   0.0,   0.0,   1.0);
-    }
-	
-    if (xMultiplier!=1.0 || yMultiplier!=1.0 || zMultiplier!=1.0)
-    {
-        matrix->postMultScale(osg::Vec3d(fabs(xMultiplier), fabs(yMultiplier), fabs(zMultiplier)));
-    }
-
-	// AJ set the matrix to class variable
-	_matrix = matrix;
-	
-    osg::Vec4 minValue(FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX);
-    osg::Vec4 maxValue(-FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX);
-    bool computeMinMax = false;
-    for(Images::iterator itr = images.begin();
-        itr != images.end();
-        ++itr)
-    {
-        osg::Vec4 localMinValue, localMaxValue;
-        if (osg::computeMinMax(itr->get(), localMinValue, localMaxValue))
-        {
-            if (localMinValue.r()<minValue.r()) minValue.r() = localMinValue.r();
-            if (localMinValue.g()<minValue.g()) minValue.g() = localMinValue.g();
-            if (localMinValue.b()<minValue.b()) minValue.b() = localMinValue.b();
-            if (localMinValue.a()<minValue.a()) minValue.a() = localMinValue.a();
-
-            if (localMaxValue.r()>maxValue.r()) maxValue.r() = localMaxValue.r();
-            if (localMaxValue.g()>maxValue.g()) maxValue.g() = localMaxValue.g();
-            if (localMaxValue.b()>maxValue.b()) maxValue.b() = localMaxValue.b();
-            if (localMaxValue.a()>maxValue.a()) maxValue.a() = localMaxValue.a();
-
-            osg::notify(osg::NOTICE)<<"  ("<<localMinValue<<") ("<<localMaxValue<<") "<<(*itr)->getFileName()<<std::endl;
-
-            computeMinMax = true;
-        }
-    }
-
-    if (computeMinMax)
-    {
-        osg::notify(osg::NOTICE)<<"Min value "<<minValue<<std::endl;
-        osg::notify(osg::NOTICE)<<"Max value "<<maxValue<<std::endl;
-
-        float minComponent = minValue[0];
-        minComponent = osg::minimum(minComponent,minValue[1]);
-        minComponent = osg::minimum(minComponent,minValue[2]);
-        minComponent = osg::minimum(minComponent,minValue[3]);
-
-        float maxComponent = maxValue[0];
-        maxComponent = osg::maximum(maxComponent,maxValue[1]);
-        maxComponent = osg::maximum(maxComponent,maxValue[2]);
-        maxComponent = osg::maximum(maxComponent,maxValue[3]);
-
-    }
-
-
-    if (colourSpaceOperation!=osg::NO_COLOR_SPACE_OPERATION)
-    {
-        for(Images::iterator itr = images.begin();
-            itr != images.end();
-            ++itr)
-        {
-            (*itr) = osg::colorSpaceConversion(colourSpaceOperation, itr->get(), colourModulate);
-        }
-    }
-
-    osg::ref_ptr<osg::Image> image_3d = 0;
-
-    if (images.size()==1)
-    {
-        osg::notify(osg::NOTICE)<<"Single image "<<images.size()<<" volumes."<<std::endl;
-        image_3d = images.front();
-    }
-    else
-    {
-        osg::notify(osg::NOTICE)<<"Creating sequence of "<<images.size()<<" volumes."<<std::endl;
-
-        osg::ref_ptr<osg::ImageSequence> imageSequence = new osg::ImageSequence;
-        imageSequence->setLength(sequenceLength);
-        image_3d = imageSequence.get();
-        for(Images::iterator itr = images.begin();
-            itr != images.end();
-            ++itr)
-        {
-            imageSequence->addImage(itr->get());
-        }
-        imageSequence->play();
-    }
-
-    osg::ref_ptr<osgVolume::Volume> volume = new osgVolume::Volume;
-    osg::ref_ptr<osgVolume::VolumeTile> tile = new osgVolume::VolumeTile;
-	_volumeTile = tile;
-    volume->addChild(tile.get());
-
-    osg::ref_ptr<osgVolume::ImageLayer> layer = new osgVolume::ImageLayer(image_3d.get());
-	_imageLayer = layer;
-
-    if (details)
-    {
-        layer->setTexelOffset(details->getTexelOffset());
-        layer->setTexelScale(details->getTexelScale());
-    }
-
-    switch(rescaleOperation)
-    {
-        case(NO_RESCALE):
-            break;
-
-        case(RESCALE_TO_ZERO_TO_ONE_RANGE):
-        {
-            layer->rescaleToZeroToOneRange();
-            break;
-        }
-        case(SHIFT_MIN_TO_ZERO):
-        {
-            layer->translateMinToZero();
-            break;
-        }
-    };
-
-    if (xMultiplier<0.0 || yMultiplier<0.0 || zMultiplier<0.0)
-    {
-        layer->setLocator(new osgVolume::Locator(
-            osg::Matrix::translate(xMultiplier<0.0 ? -1.0 : 0.0, yMultiplier<0.0 ? -1.0 : 0.0, zMultiplier<0.0 ? -1.0 : 0.0) *
-            osg::Matrix::scale(xMultiplier<0.0 ? -1.0 : 1.0, yMultiplier<0.0 ? -1.0 : 1.0, zMultiplier<0.0 ? -1.0 : 1.0) *
-            (*matrix)
-            ));;
-    }
-    else
-    {
-        //layer->setLocator(new osgVolume::Locator(*matrix));
-		layer->setLocator(new osgVolume::Locator(*matrix));
-    }
-	tile->setLocator(new osgVolume::Locator(*matrix));
-    
-	tile->setLayer(layer.get());
-
-    tile->setEventCallback(new osgVolume::PropertyAdjustmentCallback());
-
-    if (useShader)
-    {
-		_effectProperty = new osgVolume::SwitchProperty;
-		osgVolume::SwitchProperty* sp = _effectProperty;
-        sp->setActiveProperty(0);
-
-        _ap = new osgVolume::AlphaFuncProperty(alphaFunc);
-        _sd = new osgVolume::SampleDensityProperty(0.005);
-        _tp = new osgVolume::TransparencyProperty(1.0);
-		_is = new osgVolume::IsoSurfaceProperty(alphaFunc);
-        _tfp = transferFunction.valid() ? new osgVolume::TransferFunctionProperty(transferFunction.get()) : 0;
-		{
-            // Standard
-            osgVolume::CompositeProperty* cp = new osgVolume::CompositeProperty;
-            cp->addProperty(_ap);
-            cp->addProperty(_sd);
-            cp->addProperty(_tp);
-            if (_tfp) cp->addProperty(_tfp);
-
-            sp->addProperty(cp);
-        }
-
-        {
-            // Light
-            osgVolume::CompositeProperty* cp = new osgVolume::CompositeProperty;
-            cp->addProperty(_ap);
-            cp->addProperty(_sd);
-            cp->addProperty(_tp);
-            cp->addProperty(new osgVolume::LightingProperty);
-            if (_tfp) cp->addProperty(_tfp);
-
-            sp->addProperty(cp);
-        }
-
-        {
-            // Isosurface
-            osgVolume::CompositeProperty* cp = new osgVolume::CompositeProperty;
-            cp->addProperty(_sd);
-            cp->addProperty(_tp);
-            cp->addProperty(_is);
-            if (_tfp) cp->addProperty(_tfp);
-
-            sp->addProperty(cp);
-        }
-
-        {
-            // MaximumIntensityProjection
-            osgVolume::CompositeProperty* cp = new osgVolume::CompositeProperty;
-            cp->addProperty(_ap);
-            cp->addProperty(_sd);
-            cp->addProperty(_tp);
-            cp->addProperty(new osgVolume::MaximumIntensityProjectionProperty);
-            if (_tfp) cp->addProperty(_tfp);
-
-            sp->addProperty(cp);
-        }
-
-        switch(shadingModel)
-        {
-            case(Standard):                     sp->setActiveProperty(0); break;
-            case(Light):                        sp->setActiveProperty(1); break;
-            case(Isosurface):                   sp->setActiveProperty(2); break;
-            case(MaximumIntensityProjection):   sp->setActiveProperty(3); break;
-        }
-		
-        layer->addProperty(sp);
-		
-        tile->setVolumeTechnique(new osgVolume::RayTracedTechnique);
-    }
-    else
-    {
-        layer->addProperty(new osgVolume::AlphaFuncProperty(alphaFunc));
-        tile->setVolumeTechnique(new osgVolume::FixedFunctionTechnique);
-    }
-	
-	if (volume.valid())
-    {
-		osg::ref_ptr<osg::Group> group = new osg::Group;
-	    osg::ref_ptr<osg::Node> loadedModel;
-		osg::PositionAttitudeTransform* shift = new osg::PositionAttitudeTransform;
-		shift->setPosition(osg::Vec3f( -0.5*_xScale*image_s , -0.5*_yScale*image_t, -0.5*_zScale*image_r ));
-
-		myClipNode = new osg::ClipNode;
-		osg::ClipPlane * clipPlane = new osg::ClipPlane;
-
-		osg::Plane * plane = new osg::Plane(osg::Vec3d(0,1,0), osg::Vec3d(0,0,0));
-		clipPlane->setClipPlane(*plane);
-
-		myClipNode->addClipPlane(clipPlane);
-		loadedModel = myClipNode;
-		myClipNode->addChild(group);
-		group->addChild(shift);
-		shift->addChild(volume.get());
-		modelForm = new osg::PositionAttitudeTransform;
-		modelForm->setPosition(osg::Vec3(0,0,0));
-
-		modelForm->addChild(loadedModel.get());
-
-		myOsg->setRootNode(modelForm);
-		
-    }
-
-    return;
-}
+/* OpenSceneGraph example, osgvolume.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+*  THE SOFTWARE.
+*/
+#include "osgvolume.h"
+#include "volumecache.h"
+#include "volumebricks.h"
+#include "volumeoccupancy.h"
+#include "volumeprofile.h"
+#include "volumeregistry.h"
+#include "volumeslice.h"
+
+#include <osg/Node>
+#include <osg/Geometry>
+#include <osg/Notify>
+#include <osg/Texture3D>
+#include <osg/Texture1D>
+#include <osg/ImageSequence>
+#include <osg/TexGen>
+#include <osg/Geode>
+#include <osg/Billboard>
+#include <osg/PositionAttitudeTransform>
+#include <osg/ClipNode>
+#include <osg/ClipPlane>
+#include <osg/AlphaFunc>
+#include <osg/TexGenNode>
+#include <osg/TexEnv>
+#include <osg/TexEnvCombine>
+#include <osg/Material>
+#include <osg/PrimitiveSet>
+#include <osg/Endian>
+#include <osg/BlendFunc>
+#include <osg/BlendEquation>
+#include <osg/TransferFunction>
+#include <osg/MatrixTransform>
+
+#include <osgDB/Registry>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+
+#include <osgGA/EventVisitor>
+#include <osgGA/TrackballManipulator>
+#include <osgGA/FlightManipulator>
+#include <osgGA/KeySwitchMatrixManipulator>
+
+#include <osgUtil/CullVisitor>
+
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+
+#include <osgManipulator/TabBoxDragger>
+#include <osgManipulator/TabPlaneTrackballDragger>
+#include <osgManipulator/TrackballDragger>
+
+#include <osg/io_utils>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <osg/ImageUtils>
+#include <osgVolume/Volume>
+#include <osgVolume/VolumeTile>
+#include <osgVolume/RayTracedTechnique>
+#include <osgVolume/FixedFunctionTechnique>
+
+#define OMEGA_NO_GL_HEADERS
+#include <omega.h>
+#include <omegaToolkit.h>
+#include <omegaOsg/omegaOsg.h>
+
+
+
+
+struct ScaleOperator
+{
+    ScaleOperator():_scale(1.0f) {}
+    ScaleOperator(float scale):_scale(scale) {}
+    ScaleOperator(const ScaleOperator& so):_scale(so._scale) {}
+
+    ScaleOperator& operator = (const ScaleOperator& so) { _scale = so._scale; return *this; }
+
+    float _scale;
+
+    inline void luminance(float& l) const { l*= _scale; }
+    inline void alpha(float& a) const { a*= _scale; }
+    inline void luminance_alpha(float& l,float& a) const { l*= _scale; a*= _scale;  }
+    inline void rgb(float& r,float& g,float& b) const { r*= _scale; g*=_scale; b*=_scale; }
+    inline void rgba(float& r,float& g,float& b,float& a) const { r*= _scale; g*=_scale; b*=_scale; a*=_scale; }
+};
+
+void clampToNearestValidPowerOfTwo(int& sizeX, int& sizeY, int& sizeZ, int s_maximumTextureSize, int t_maximumTextureSize, int r_maximumTextureSize)
+{
+    // compute nearest powers of two for each axis.
+    int s_nearestPowerOfTwo = 1;
+    while(s_nearestPowerOfTwo<sizeX && s_nearestPowerOfTwo<s_maximumTextureSize) s_nearestPowerOfTwo*=2;
+
+    int t_nearestPowerOfTwo = 1;
+    while(t_nearestPowerOfTwo<sizeY && t_nearestPowerOfTwo<t_maximumTextureSize) t_nearestPowerOfTwo*=2;
+
+    int r_nearestPowerOfTwo = 1;
+    while(r_nearestPowerOfTwo<sizeZ && r_nearestPowerOfTwo<r_maximumTextureSize) r_nearestPowerOfTwo*=2;
+
+    sizeX = s_nearestPowerOfTwo;
+    sizeY = t_nearestPowerOfTwo;
+    sizeZ = r_nearestPowerOfTwo;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Python wrapper code.
+#ifdef OMEGA_USE_PYTHON
+#include "omega/PythonInterpreterWrapper.h"
+BOOST_PYTHON_MODULE(myvolume)
+{
+	// SceneLoader
+	PYAPI_REF_BASE_CLASS(myOsgVolume)
+		PYAPI_STATIC_REF_GETTER(myOsgVolume, createAndInitialize)
+		PYAPI_STATIC_REF_GETTER(myOsgVolume, createAndInitializeRaw)
+		PYAPI_STATIC_REF_GETTER(myOsgVolume, createAndInitializeSequence)
+		PYAPI_METHOD(myOsgVolume, setPosition)
+		PYAPI_METHOD(myOsgVolume, setRotation)
+		PYAPI_METHOD(myOsgVolume, translate)
+		PYAPI_METHOD(myOsgVolume, rotate)
+		
+		PYAPI_METHOD(myOsgVolume, activateEffect)
+
+		PYAPI_METHOD(myOsgVolume, setCustomizedProperty)
+		PYAPI_METHOD(myOsgVolume, setClipping)
+		PYAPI_METHOD(myOsgVolume, setClipPlane)
+		PYAPI_METHOD(myOsgVolume, setClipPlaneInWorld)
+		PYAPI_METHOD(myOsgVolume, clearClipPlane)
+		PYAPI_METHOD(myOsgVolume, setClipBox)
+		PYAPI_METHOD(myOsgVolume, clearClipBox)
+		PYAPI_METHOD(myOsgVolume, clearClipping)
+		PYAPI_METHOD(myOsgVolume, addTransferPoint)
+		PYAPI_METHOD(myOsgVolume, clearTransferFunction)
+		PYAPI_METHOD(myOsgVolume, setTransferFunctionEnabled)
+		PYAPI_METHOD(myOsgVolume, beginTransferFunction)
+		PYAPI_METHOD(myOsgVolume, commitTransferFunction)
+		PYAPI_METHOD(myOsgVolume, setAlphaFunc)
+		PYAPI_METHOD(myOsgVolume, setScale)
+		PYAPI_METHOD(myOsgVolume, setSampleDensity)
+		PYAPI_METHOD(myOsgVolume, setTransparency)
+		PYAPI_METHOD(myOsgVolume, setEarlyRayTermination)
+		PYAPI_METHOD(myOsgVolume, setTargetFrameRate)
+		PYAPI_METHOD(myOsgVolume, setSampleDensityRange)
+		PYAPI_METHOD(myOsgVolume, getSampleDensity)
+		PYAPI_METHOD(myOsgVolume, getFrameTime)
+		PYAPI_METHOD(myOsgVolume, setDirty)
+		PYAPI_METHOD(myOsgVolume, setBrickBudget)
+		PYAPI_METHOD(myOsgVolume, setBrickCompression)
+		PYAPI_METHOD(myOsgVolume, getCompressedBrickMegabytes)
+		PYAPI_METHOD(myOsgVolume, getNumBricks)
+		PYAPI_METHOD(myOsgVolume, getNumResidentBricks)
+		PYAPI_METHOD(myOsgVolume, setSampleDensityWhenMoving)
+		PYAPI_METHOD(myOsgVolume, setLevelWhenMoving)
+		PYAPI_METHOD(myOsgVolume, getNumLevels)
+		PYAPI_METHOD(myOsgVolume, getOccupancy)
+		PYAPI_METHOD(myOsgVolume, setPlaybackRate)
+		PYAPI_METHOD(myOsgVolume, setTimestep)
+		PYAPI_METHOD(myOsgVolume, getTimestep)
+		PYAPI_METHOD(myOsgVolume, getNumTimesteps)
+		PYAPI_METHOD(myOsgVolume, getNumResidentTimesteps)
+		PYAPI_METHOD(myOsgVolume, addSlice)
+		PYAPI_METHOD(myOsgVolume, addObliqueSlice)
+		PYAPI_METHOD(myOsgVolume, setSlicePosition)
+		PYAPI_METHOD(myOsgVolume, setObliqueSlice)
+		PYAPI_REF_GETTER(myOsgVolume, getSlice)
+		PYAPI_METHOD(myOsgVolume, getNumSlices)
+		PYAPI_METHOD(myOsgVolume, setSliceWindow)
+		PYAPI_METHOD(myOsgVolume, setHistogramRegion)
+		PYAPI_METHOD(myOsgVolume, clearHistogramRegion)
+		PYAPI_METHOD(myOsgVolume, getHistogramBins)
+		PYAPI_METHOD(myOsgVolume, getHistogramGradientBins)
+		PYAPI_METHOD(myOsgVolume, getHistogramValue)
+		PYAPI_METHOD(myOsgVolume, getHistogramCount)
+		PYAPI_METHOD(myOsgVolume, getHistogramJointCount)
+		PYAPI_METHOD(myOsgVolume, getHistogramGradient)
+		PYAPI_METHOD(myOsgVolume, getValueMinimum)
+		PYAPI_METHOD(myOsgVolume, getValueMaximum)
+		PYAPI_METHOD(myOsgVolume, getValueMean)
+		PYAPI_METHOD(myOsgVolume, getValueDeviation)
+		PYAPI_METHOD(myOsgVolume, getValuePercentile)
+		PYAPI_METHOD(myOsgVolume, isLoaded)
+		PYAPI_METHOD(myOsgVolume, getLoadProgress)
+		PYAPI_METHOD(myOsgVolume, getProfileReport)
+		PYAPI_METHOD(myOsgVolume, getProfileTime)
+		PYAPI_METHOD(myOsgVolume, getProfileCount)
+		PYAPI_METHOD(myOsgVolume, getProfileCounter)
+		PYAPI_METHOD(myOsgVolume, writeProfileTrace)
+		PYAPI_METHOD(myOsgVolume, resetProfile)
+		;
+		//PYAPI_METHOD(HelloModule, )
+		
+}
+#endif
+
+void myOsgVolume::setPosition( float x, float y, float z)
+{
+	this->modelForm->setPosition(osg::Vec3f(x, y, z));
+}
+
+void myOsgVolume::setRotation( float fx, float fy, float fz, float degree)
+{
+	this->modelForm->setAttitude(osg::Quat(degree, osg::Vec3f(fx, fy, fz)));
+}
+
+void myOsgVolume::translate( float x, float y, float z)
+{
+	osg::Vec3d pos = this->modelForm->getPosition();
+	pos+=osg::Vec3d(x, y, z);
+	this->modelForm->setPosition(pos);
+}
+
+void myOsgVolume::rotate( float fx, float fy, float fz, float degree)
+{
+	osg::Quat quat = this->modelForm->getAttitude();
+	quat*=osg::Quat(degree,osg::Vec3f(fx, fy, fz));
+	this->modelForm->setAttitude(quat);
+}
+
+myOsgVolume* myOsgVolume::createAndInitialize(std::string filename, float alpha, float fx, float fy, float fz)
+{
+	myOsgVolume* instance = new myOsgVolume(filename, alpha, fx, fy, fz);
+	ModuleServices::addModule(instance);
+	instance->doInitialize(Engine::instance());
+	return instance;
+}
+
+myOsgVolume* myOsgVolume::createAndInitializeRaw(std::string filename, int sizeX, int sizeY, int sizeZ, int bytesPerComponent, int components, std::string endian, float alpha, float fx, float fy, float fz)
+{
+	myOsgVolume* instance = new myOsgVolume(filename, alpha, fx, fy, fz);
+	instance->_options.rawSizeX = sizeX;
+	instance->_options.rawSizeY = sizeY;
+	instance->_options.rawSizeZ = sizeZ;
+	instance->_options.rawBytesPerComponent = bytesPerComponent;
+	instance->_options.rawComponents = components;
+	instance->_options.rawEndian = endian;
+	ModuleServices::addModule(instance);
+	instance->doInitialize(Engine::instance());
+	return instance;
+}
+
+myOsgVolume* myOsgVolume::createAndInitializeSequence(std::string pattern, int ringSize, float alpha, float fx, float fy, float fz)
+{
+	std::vector<std::string> timesteps = volumeTimesteps(pattern);
+	if (timesteps.empty()) OSG_WARN<<"myOsgVolume: no timesteps found for "<<pattern<<std::endl;
+
+	// the first timestep loads as any volume would, the stream takes over from there
+	myOsgVolume* instance = new myOsgVolume(timesteps.empty() ? pattern : timesteps[0], alpha, fx, fy, fz);
+	instance->_timestepFiles = timesteps;
+	instance->_ringSize = std::max(2, ringSize);
+	ModuleServices::addModule(instance);
+	instance->doInitialize(Engine::instance());
+	return instance;
+}
+
+void myOsgVolume::update(const UpdateContext& context)
+{
+	ProfileScope scope("update");
+	updateLoading();
+	updateTimestep(context);
+	updateTransferFunction();
+	if (_occupancyDirty) updateOccupancy();
+	if (_bricks.valid()) _bricks->update();
+	updateLevelOfDetail(context);
+	updateSampleDensity(context);
+	updateProperties();
+	updateSlices();
+}
+
+void myOsgVolume::updateTimestep(const UpdateContext& context)
+{
+	if (!_stream.valid()) return;
+
+	// playback loops in either direction
+	double numTimesteps = _stream->getNumTimesteps();
+	_playbackTime = fmod(_playbackTime + context.dt*_playbackRate, numTimesteps);
+	if (_playbackTime<0.0) _playbackTime += numTimesteps;
+	unsigned int timestep = std::min(_stream->getNumTimesteps()-1, static_cast<unsigned int>(_playbackTime));
+
+	_stream->setPlayback(timestep, _playbackRate);
+	if (timestep==_timestep) return;
+
+	osg::ref_ptr<VolumeStream::Timestep> next;
+	if (!_stream->get(timestep, next))
+	{
+		// not decoded in time, the last one stays up
+		VolumeProfiler::instance()->count(VolumeProfiler::TimestepStalls);
+		return;
+	}
+	_timestep = timestep;
+	if (!next->image) return;
+
+	// into the images the textures were built from, one upload each and no re-init
+	replaceVoxels(_imageLayer->getImage(), next->image.get());
+	for (unsigned int i = 0; i < _levelTiles.size() && i < next->levels.size(); ++i)
+	{
+		replaceVoxels(_levelTiles[i]->getLayer()->getImage(), next->levels[i].get());
+	}
+	_occupancy = next->occupancy;
+	_occupancyDirty = true;
+	for (unsigned int i = 0; i < _slices.size(); ++i) _slices[i].dirty = true;
+	_regionHistogram = 0;
+}
+
+void myOsgVolume::setPlaybackRate(float timestepsPerSecond)
+{
+	_playbackRate = timestepsPerSecond;
+}
+
+void myOsgVolume::setTimestep(int timestep)
+{
+	if (getNumTimesteps()>0) _playbackTime = std::max(0, std::min(timestep, getNumTimesteps()-1));
+}
+
+int myOsgVolume::getTimestep()
+{
+	return _timestep;
+}
+
+int myOsgVolume::getNumTimesteps()
+{
+	return _timestepFiles.size();
+}
+
+int myOsgVolume::getNumResidentTimesteps()
+{
+	return _stream.valid() ? _stream->getNumResident() : 1;
+}
+
+void myOsgVolume::updateProperties()
+{
+	// a scalar property only updates its uniform, no need to rebuild the techniques
+	if ((_dirty & AlphaDirty) && _ap) _ap->setValue(_alpha);
+	if ((_dirty & SampleDensityDirty) && _sd)
+	{
+		_sd->setValue(_moving && _sampleDensityWhenMoving>0.0f ? _sampleDensityWhenMoving : _sampleDensity);
+	}
+	if ((_dirty & TransparencyDirty) && _tp) _tp->setValue(_transparency);
+
+	// however many changes came in this frame, the tiles are re-initialised once
+	if (_dirty & TechniqueDirty) dirtyTiles();
+	_dirty = 0;
+}
+
+void myOsgVolume::updateOccupancy()
+{
+	ProfileScope scope("classifyOccupancy");
+	_occupancyDirty = false;
+	if (!_occupancy.valid()) return;
+
+	// only compositing hides transparent voxels; isosurfaces and MIP look at every sample
+	int mode = _effectProperty.valid() ? _shadingModel : Standard;
+	if ((mode==Standard || mode==Light) && _tfEnabled && _tf.valid() && _ap.valid())
+	{
+		// the lookup RayTracedTechnique makes into the transfer function
+		float tfRange = _tf->getMaximum() - _tf->getMinimum();
+		float tfScale = _texelScale[3] / tfRange;
+		float tfOffset = (_texelOffset[3] - _tf->getMinimum()) / tfRange;
+		_occupancy->classify(_tf.get(), tfScale, tfOffset, _alpha);
+	}
+	else
+	{
+		_occupancy->occupyAll();
+	}
+
+	if (_bricks.valid()) _bricks->setOccupancy(_occupancy.get());
+
+	osg::BoundingBox box;
+	bool occupied = _occupancy->occupiedBox(0, 0, 0, (int)_volumeSize.x(), (int)_volumeSize.y(), (int)_volumeSize.z(), box);
+	if (occupied)
+	{
+		box = osg::BoundingBox(box.xMin()/_volumeSize.x(), box.yMin()/_volumeSize.y(), box.zMin()/_volumeSize.z(),
+							box.xMax()/_volumeSize.x(), box.yMax()/_volumeSize.y(), box.zMax()/_volumeSize.z());
+	}
+	else
+	{
+		box = osg::BoundingBox(0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f);
+	}
+
+	// the proxy box shrinks to the occupied cells, rays no longer march through the empty margins
+	osg::Matrix geometry = boxMatrix(transformBox(box, _flip)) * (*_matrix);
+	std::vector<osgVolume::VolumeTile*> tiles;
+	if (_volumeTile.valid()) tiles.push_back(_volumeTile.get());
+	for (unsigned int i = 0; i < _levelTiles.size(); ++i) tiles.push_back(_levelTiles[i].get());
+	for (unsigned int i = 0; i < tiles.size(); ++i)
+	{
+		tiles[i]->setNodeMask(occupied ? 0xffffffff : 0x0);
+		placeVolumeTile(tiles[i], geometry);
+	}
+}
+
+void myOsgVolume::submitTransferFunction()
+{
+	if (!_tfBuilder.valid()) return;
+	_tfBuilder->submit(_tfVersion, _tfPoints, _tf->getNumberImageCells());
+	_tfSubmitted = _tfVersion;
+}
+
+void myOsgVolume::updateTransferFunction()
+{
+	if (!_tfBuilder.valid()) return;
+	if (!_tfBatch && _tfSubmitted!=_tfVersion) submitTransferFunction();
+
+	TransferFunctionBuilder::Table table;
+	if (!_tfBuilder->take(table) || table.version<=_tfApplied) return;
+	_tfApplied = table.version;
+
+	float minimum = _tf->getMinimum();
+	float maximum = _tf->getMaximum();
+
+	// the table is already rasterised, so the points go in without updateImage()
+	// and the texture is uploaded once, however many points changed
+	_tf->getColorMap() = table.colorMap;
+	osg::Image* image = _tf->getImage();
+	if (image && image->getTotalSizeInBytes()==table.image->getTotalSizeInBytes())
+	{
+		memcpy(image->data(), table.image->data(), image->getTotalSizeInBytes());
+		image->dirty();
+		VolumeProfiler::instance()->count(VolumeProfiler::TextureUploadBytes, image->getTotalSizeInBytes());
+	}
+	else
+	{
+		_tf->updateImage();
+	}
+
+	// RayTracedTechnique bakes the function's range into its lookup when the tile is initialised
+	if (_tf->getMinimum()!=minimum || _tf->getMaximum()!=maximum) setDirty();
+	_occupancyDirty = true;
+}
+
+float myOsgVolume::getOccupancy()
+{
+	if (_occupancyDirty) updateOccupancy();
+	return _occupancy.valid() ? _occupancy->getOccupancy() : 1.0f;
+}
+
+bool myOsgVolume::viewChanged()
+{
+	bool changed = false;
+	if (modelForm)
+	{
+		changed = modelForm->getPosition()!=_lastPosition || modelForm->getAttitude()!=_lastAttitude;
+		_lastPosition = modelForm->getPosition();
+		_lastAttitude = modelForm->getAttitude();
+	}
+
+	// wand navigation moves the camera rather than the volume
+	Camera* camera = getEngine()->getDefaultCamera();
+	if (camera)
+	{
+		changed = changed || camera->getPosition()!=_lastCameraPosition || camera->getOrientation().coeffs()!=_lastCameraOrientation.coeffs();
+		_lastCameraPosition = camera->getPosition();
+		_lastCameraOrientation = camera->getOrientation();
+	}
+	return changed;
+}
+
+void myOsgVolume::updateLevelOfDetail(const UpdateContext& context)
+{
+	if (!_lod.valid()) return;
+
+	if (viewChanged()) _idleTime = 0.0f;
+	else _idleTime += context.dt;
+
+	// stay coarse for a moment after the last change, so stop-and-go navigation does not flicker
+	bool moving = _idleTime < _refineDelay;
+	if (moving==_moving) return;
+	_moving = moving;
+
+	int level = moving ? std::min<int>(_levelWhenMoving, _levelTiles.size()) : 0;
+	_lod->setSingleChildOn(level);
+	if (_sampleDensityWhenMoving>0.0f) _dirty |= SampleDensityDirty;
+}
+
+void myOsgVolume::updateSampleDensity(const UpdateContext& context)
+{
+	if (context.dt<=0.0f) return;
+	_frameTime = _frameTime>0.0f ? _frameTime*0.9f + context.dt*0.1f : context.dt;
+	if (_targetFrameTime<=0.0f) return;
+
+	// frames drawn coarse while moving say nothing about the step used at rest
+	if (_moving && _sampleDensityWhenMoving>0.0f)
+	{
+		_adaptTime = 0.0f;
+		return;
+	}
+
+	// give the average time to settle on the last step before the next
+	_adaptTime += context.dt;
+	if (_adaptTime<0.5f) return;
+
+	// inside the band the step is left as it is
+	float ratio = _frameTime/_targetFrameTime;
+	if (ratio>0.8f && ratio<1.1f) return;
+
+	// the samples, and so roughly the frame time, go with the inverse of the
+	// step; half the correction at a time, so it settles rather than overshoots
+	float step = sqrtf(osg::clampBetween(ratio, 0.25f, 4.0f));
+	float sd = osg::clampBetween(_sampleDensity*step, _finestSampleDensity, _coarsestSampleDensity);
+	if (sd==_sampleDensity) return;
+
+	_sampleDensity = sd;
+	_dirty |= SampleDensityDirty;
+	_adaptTime = 0.0f;
+}
+
+void myOsgVolume::setTargetFrameRate(float framesPerSecond)
+{
+	_targetFrameTime = framesPerSecond>0.0f ? 1.0f/framesPerSecond : 0.0f;
+	_adaptTime = 0.0f;
+}
+
+void myOsgVolume::setSampleDensityRange(float finest, float coarsest)
+{
+	if (finest<=0.0f || coarsest<finest)
+	{
+		OSG_WARN<<"myOsgVolume::setSampleDensityRange: needs 0 < finest <= coarsest"<<std::endl;
+		return;
+	}
+	_finestSampleDensity = finest;
+	_coarsestSampleDensity = coarsest;
+	if (_targetFrameTime>0.0f) setSampleDensity(osg::clampBetween(_sampleDensity, finest, coarsest));
+}
+
+float myOsgVolume::getSampleDensity()
+{
+	return _sd.valid() ? _sd->getValue() : _sampleDensity;
+}
+
+float myOsgVolume::getFrameTime()
+{
+	return _frameTime*1000.0f;
+}
+
+void myOsgVolume::setSampleDensityWhenMoving(float sd)
+{
+	_sampleDensityWhenMoving = sd;
+	_dirty |= SampleDensityDirty;
+}
+
+void myOsgVolume::setLevelWhenMoving(int level)
+{
+	// takes effect from the next time the view starts moving
+	_levelWhenMoving = std::max(0, level);
+}
+
+int myOsgVolume::getNumLevels()
+{
+	return _lod.valid() ? _lod->getNumChildren() : 0;
+}
+
+void myOsgVolume::setArguments()
+{
+	//std::cout << "*********************" << std::endl;
+	//imageFile = "C:\\AJ\\CS526\\data\\bmp\\"*;
+	//std::cout << imageFile << std::endl;
+	//_xScale = 1.0;
+	//_yScale = 1.0;
+	//_zScale = 1.0;
+	//_alpha = 0.02;
+	//modelForm = new osg::PositionAttitudeTransform();
+	//modelForm->setPosition(osg::Vec3(0,0,0));
+}
+
+void myOsgVolume::setAlphaFunc(float alpha)
+{
+	_alpha = alpha;
+	_dirty |= AlphaDirty;
+	_occupancyDirty = true;
+}
+
+void myOsgVolume::setScale( float x, float y, float z)
+{
+	_xScale = x;
+	_yScale = y;
+	_zScale = z;
+}
+
+void myOsgVolume::setSampleDensity(float sd)
+{
+	_sampleDensity = sd;
+	_dirty |= SampleDensityDirty;
+}
+
+void myOsgVolume::setTransparency(float tp)
+{
+	_transparency = tp;
+	_dirty |= TransparencyDirty;
+}
+
+void myOsgVolume::setEarlyRayTermination(float opacity)
+{
+	// a uniform shared by every tile, nothing to rebuild
+	if (_variants.valid()) _variants->setEarlyTermination(osg::clampBetween(opacity, 0.0f, 1.0f));
+}
+
+void myOsgVolume::clearTransferFunction()
+{
+	// as TransferFunction1D::clear(), white over the current range
+	float minimum = _tfPoints.empty() ? 0.0f : _tfPoints.begin()->first;
+	float maximum = _tfPoints.empty() ? 1.0f : _tfPoints.rbegin()->first;
+	_tfPoints.clear();
+	_tfPoints[minimum] = osg::Vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	_tfPoints[maximum] = osg::Vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	++_tfVersion;
+}
+
+void myOsgVolume::addTransferPoint(float intensity, float r, float g, float b, float alpha)
+{
+	_tfPoints[intensity] = osg::Vec4(r, g, b, alpha);
+	++_tfVersion;
+}
+
+void myOsgVolume::beginTransferFunction()
+{
+	_tfBatch = true;
+}
+
+void myOsgVolume::commitTransferFunction()
+{
+	_tfBatch = false;
+	// start rasterising now, the table is swapped in at the next update()
+	if (_tfSubmitted!=_tfVersion) submitTransferFunction();
+}
+
+void myOsgVolume::setDirty()
+{
+	_dirty |= TechniqueDirty;
+	VolumeProfiler::instance()->count(VolumeProfiler::DirtyRequests);
+}
+
+std::string myOsgVolume::getProfileReport()
+{
+	return VolumeProfiler::instance()->report();
+}
+
+float myOsgVolume::getProfileTime(std::string name)
+{
+	return VolumeProfiler::instance()->getTime(name);
+}
+
+int myOsgVolume::getProfileCount(std::string name)
+{
+	unsigned int numEvents = 0;
+	VolumeProfiler::instance()->getTime(name, &numEvents);
+	return numEvents;
+}
+
+float myOsgVolume::getProfileCounter(std::string name)
+{
+	int counter = VolumeProfiler::findCounter(name);
+	if (counter<0) return 0.0f;
+	return VolumeProfiler::instance()->getCounter(static_cast<VolumeProfiler::Counter>(counter));
+}
+
+bool myOsgVolume::writeProfileTrace(std::string filename)
+{
+	return VolumeProfiler::instance()->writeChromeTrace(filename);
+}
+
+void myOsgVolume::resetProfile()
+{
+	VolumeProfiler::instance()->reset();
+}
+
+void myOsgVolume::dirtyTiles()
+{
+	if (_bricks.valid()) _bricks->setDirty();
+	else if (_volumeTile.valid()) _volumeTile->setDirty(true);
+
+	for (unsigned int i = 0; i < _levelTiles.size(); ++i) _levelTiles[i]->setDirty(true);
+}
+
+void myOsgVolume::setBrickBudget(float megabytes)
+{
+	_brickBudget = megabytes;
+	if (_bricks.valid()) _bricks->setBudget((size_t)(megabytes*1024.0f*1024.0f));
+}
+
+void myOsgVolume::setBrickCompression(bool compress)
+{
+	_brickCompression = compress;
+	if (_bricks.valid()) _bricks->setCompression(compress);
+}
+
+float myOsgVolume::getCompressedBrickMegabytes()
+{
+	return _bricks.valid() ? _bricks->getCompressedBytes()/(1024.0f*1024.0f) : 0.0f;
+}
+
+int myOsgVolume::getNumBricks()
+{
+	return _bricks.valid() ? _bricks->getNumBricks() : 1;
+}
+
+int myOsgVolume::getNumResidentBricks()
+{
+	return _bricks.valid() ? _bricks->getNumResidentBricks() : 1;
+}
+
+
+void myOsgVolume::setCustomizedProperty()
+{
+}
+
+void myOsgVolume::setClipping()
+{
+	// the box the tiles used to be squeezed into
+	_clipping->setBox(osg::Matrix::translate(0.5, 0, 0)*osg::Matrix::rotate(osg::Quat(0.2, osg::Vec3f(0,1,0)))*osg::Matrix::scale(0.5,0.5,0.5));
+}
+
+void myOsgVolume::setClipPlane(int index, float px, float py, float pz, float nx, float ny, float nz)
+{
+	if (index<0 || index>=VolumeClipping::MaxPlanes)
+	{
+		OSG_WARN<<"myOsgVolume::setClipPlane: index out of range, there are "<<VolumeClipping::MaxPlanes<<" planes"<<std::endl;
+		return;
+	}
+	_clipping->setPlane(index, osg::Vec3(px, py, pz), osg::Vec3(nx, ny, nz));
+}
+
+void myOsgVolume::setClipPlaneInWorld(int index, float px, float py, float pz, float nx, float ny, float nz)
+{
+	if (!_matrix.valid())
+	{
+		OSG_WARN<<"myOsgVolume::setClipPlaneInWorld: the volume is still loading"<<std::endl;
+		return;
+	}
+
+	// the volume's unit cube into the world, through the transforms above it
+	osg::Matrix unitToWorld = *_matrix;
+	osg::MatrixList worldMatrices = _shift->getWorldMatrices();
+	if (!worldMatrices.empty()) unitToWorld = unitToWorld * worldMatrices.front();
+
+	// a point maps back through the inverse, a normal forward through the transpose
+	osg::Vec3 point = osg::Vec3(px, py, pz) * osg::Matrix::inverse(unitToWorld);
+	osg::Vec3 normal = osg::Matrix::transform3x3(unitToWorld, osg::Vec3(nx, ny, nz));
+	setClipPlane(index, point.x(), point.y(), point.z(), normal.x(), normal.y(), normal.z());
+}
+
+void myOsgVolume::clearClipPlane(int index)
+{
+	if (index>=0) _clipping->clearPlane(index);
+}
+
+void myOsgVolume::setClipBox(float cx, float cy, float cz, float sx, float sy, float sz, float fx, float fy, float fz, float angle)
+{
+	osg::Matrix box = osg::Matrix::translate(-0.5, -0.5, -0.5) * osg::Matrix::scale(sx, sy, sz);
+	if (angle!=0.0f) box = box * osg::Matrix::rotate(osg::Quat(angle, osg::Vec3f(fx, fy, fz)));
+	_clipping->setBox(box * osg::Matrix::translate(cx, cy, cz));
+}
+
+void myOsgVolume::clearClipBox()
+{
+	_clipping->clearBox();
+}
+
+void myOsgVolume::clearClipping()
+{
+	_clipping->clear();
+}
+
+void myOsgVolume::activateEffect(int index)
+{
+	//std::cout << index << " " << _volumeTile->getDirty() << std::endl;
+	switch(index)
+    {
+		case(0):	_shadingModel = Standard; break;
+        case(1):	_shadingModel = Light; break;
+        case(2):	_shadingModel = Isosurface; break;
+        case(3):	_shadingModel = MaximumIntensityProjection; break;
+		default:	std::cout<< "out of range" << std::endl; return;
+    }
+	//std::cout << "And: " << _volumeTile->getDirty() << std::endl;
+	//_imageLayer->dirty();
+	// the techniques hold every variant already built, switching needs no re-init;
+	// the occupied box changes with the mode and the proxies move to it in place
+	if (_effectProperty) _effectProperty->setActiveProperty(shadingVariant());
+	_occupancyDirty = true;
+}
+
+void myOsgVolume::setTransferFunctionEnabled(bool enabled)
+{
+	_tfEnabled = enabled;
+	// as activateEffect(), a switch of variant and a move of the proxies
+	if (_effectProperty) _effectProperty->setActiveProperty(shadingVariant());
+	_occupancyDirty = true;
+}
+
+int myOsgVolume::shadingVariant() const
+{
+	return _shadingModel + (_tfEnabled ? 0 : NumShadingModels);
+
+}
+
+
+void myOsgVolume::initialize()
+{
+	_startup = osg::Timer::instance()->tick();
+	//this->setArguments();
+	int argcT= 1;
+	char buffer[10] = "osgvolume";
+	char* q = buffer;
+	char* argvT[10];
+	*argvT = buffer;
+	osg::ArgumentParser arguments(&argcT, argvT);
+
+	osg::ref_ptr<osg::TransferFunction1D> transferFunction;
+	if(true)
+    {
+        transferFunction = new osg::TransferFunction1D;
+        transferFunction->setColor(0.0, osg::Vec4(1.0,1.0,1.0,0.0));
+        transferFunction->setColor(1.0, osg::Vec4(1.0,1.0,1.0,1.0));
+    }
+	_tf = transferFunction;
+	_tfPoints = _tf->getColorMap();
+	_tfBuilder = new TransferFunctionBuilder;
+	_tfBuilder->start();
+
+	float alphaFunc = this->_alpha;
+    
+	ShadingModel shadingModel = MaximumIntensityProjection;
+
+    VolumeOptions& options = _options;
+
+    // volumes past the texture size are bricked rather than downsampled, up to the volume size.
+    // No context is current here to ask GL_MAX_3D_TEXTURE_SIZE; 2048 is what current GPUs give,
+    // MYVOLUME_MAX_TEXTURE_SIZE sets another.
+    int maximumTextureSize = 2048;
+    const char* maximumTextureSizeVariable = getenv("MYVOLUME_MAX_TEXTURE_SIZE");
+    if (maximumTextureSizeVariable && atoi(maximumTextureSizeVariable)>0) maximumTextureSize = atoi(maximumTextureSizeVariable);
+    while(arguments.read("--maxTextureSize",maximumTextureSize)) {}
+    _maximumTextureSize = maximumTextureSize;
+
+    int maximumVolumeSize = 2048;
+    while(arguments.read("--maxVolumeSize",maximumVolumeSize)) {}
+    options.s_maximumTextureSize = maximumVolumeSize;
+    options.t_maximumTextureSize = maximumVolumeSize;
+    options.r_maximumTextureSize = maximumVolumeSize;
+    while(arguments.read("--s_maxTextureSize",options.s_maximumTextureSize)) {}
+    while(arguments.read("--t_maxTextureSize",options.t_maximumTextureSize)) {}
+    while(arguments.read("--r_maxTextureSize",options.r_maximumTextureSize)) {}
+
+    // set up colour space operation.
+    osg::Vec4& colourModulate = options.colourModulate;
+    while(arguments.read("--modulate-alpha-by-luminance")) { options.colourSpaceOperation = osg::MODULATE_ALPHA_BY_LUMINANCE; }
+    while(arguments.read("--modulate-alpha-by-colour", colourModulate.x(),colourModulate.y(),colourModulate.z(),colourModulate.w() )) { options.colourSpaceOperation = osg::MODULATE_ALPHA_BY_COLOR; }
+    while(arguments.read("--replace-alpha-with-luminance")) { options.colourSpaceOperation = osg::REPLACE_ALPHA_WITH_LUMINANCE; }
+    while(arguments.read("--replace-rgb-with-luminance")) { options.colourSpaceOperation = osg::REPLACE_RGB_WITH_LUMINANCE; }
+
+    options.rescaleOperation = RESCALE_TO_ZERO_TO_ONE_RANGE;
+
+    options.resizeToPowerOfTwo = false;
+
+    while(arguments.read("--num-components", options.numComponentsDesired)) {}
+
+    // MYVOLUME_QUANTIZE=8, 12 or 16 stores fewer bits per voxel than the source has.
+    const char* quantize = getenv("MYVOLUME_QUANTIZE");
+    if (quantize) options.quantizeBits = atoi(quantize);
+    while(arguments.read("--quantize", options.quantizeBits)) {}
+
+    // MYVOLUME_GRADIENTS=1 works out the gradients once at load, so lit shading reads its normals from a texture.
+    const char* gradientsVariable = getenv("MYVOLUME_GRADIENTS");
+    bool gradients = gradientsVariable && atoi(gradientsVariable)!=0;
+    while(arguments.read("--gradients")) { gradients = true; }
+
+    bool useManipulator = false;
+    
+    bool useShader = true;
+    
+    bool gpuTransferFunction = true;
+
+    // clip planes and boxes set before the volume is in apply from its first frame
+    _clipping = new VolumeClipping;
+
+    // the properties need no voxels, so scripts can set them up while the volume loads
+    if (useShader)
+    {
+		_effectProperty = new osgVolume::SwitchProperty;
+		osgVolume::SwitchProperty* sp = _effectProperty;
+        sp->setActiveProperty(0);
+
+        _ap = new osgVolume::AlphaFuncProperty(alphaFunc);
+        _sd = new osgVolume::SampleDensityProperty(_sampleDensity);
+        _tp = new osgVolume::TransparencyProperty(_transparency);
+		_is = new osgVolume::IsoSurfaceProperty(alphaFunc);
+        _tfp = transferFunction.valid() ? new osgVolume::TransferFunctionProperty(transferFunction.get()) : 0;
+        osg::ref_ptr<osgVolume::LightingProperty> lighting = new osgVolume::LightingProperty;
+        osg::ref_ptr<osgVolume::MaximumIntensityProjectionProperty> mip = new osgVolume::MaximumIntensityProjectionProperty;
+
+        // every mode with the transfer function, then every mode without, see shadingVariant()
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            osgVolume::TransferFunctionProperty* tfp = pass==0 ? _tfp.get() : 0;
+            {
+                // Standard
+                osgVolume::CompositeProperty* cp = new osgVolume::CompositeProperty;
+                cp->addProperty(_ap);
+                cp->addProperty(_sd);
+                cp->addProperty(_tp);
+                if (tfp) cp->addProperty(tfp);
+
+                sp->addProperty(cp);
+            }
+
+            {
+                // Light
+                osgVolume::CompositeProperty* cp = new osgVolume::CompositeProperty;
+                cp->addProperty(_ap);
+                cp->addProperty(_sd);
+                cp->addProperty(_tp);
+                cp->addProperty(lighting.get());
+                if (tfp) cp->addProperty(tfp);
+
+                sp->addProperty(cp);
+            }
+
+            {
+                // Isosurface
+                osgVolume::CompositeProperty* cp = new osgVolume::CompositeProperty;
+                cp->addProperty(_sd);
+                cp->addProperty(_tp);
+                cp->addProperty(_is);
+                if (tfp) cp->addProperty(tfp);
+
+                sp->addProperty(cp);
+            }
+
+            {
+                // MaximumIntensityProjection
+                osgVolume::CompositeProperty* cp = new osgVolume::CompositeProperty;
+                cp->addProperty(_ap);
+                cp->addProperty(_sd);
+                cp->addProperty(_tp);
+                cp->addProperty(mip.get());
+                if (tfp) cp->addProperty(tfp);
+
+                sp->addProperty(cp);
+            }
+        }
+
+        _shadingModel = shadingModel;
+        sp->setActiveProperty(shadingVariant());
+
+        // all the variants are built with the tiles and compiled on the first frames drawn
+        _variants = new ShadingVariants(sp);
+        _variants->setClipping(_clipping.get());
+    }
+
+    // the scene is in place from the start, the volume goes under _shift once it is loaded
+    {
+		osg::ref_ptr<osg::Group> group = new osg::Group;
+	    osg::ref_ptr<osg::Node> loadedModel;
+		_shift = new osg::PositionAttitudeTransform;
+
+		// clipping is done by the shaders, see VolumeClipping
+		loadedModel = group;
+		group->addChild(_shift.get());
+		modelForm = new osg::PositionAttitudeTransform;
+		modelForm->setPosition(osg::Vec3(0,0,0));
+
+		modelForm->addChild(loadedModel.get());
+
+		myOsg->setRootNode(modelForm);
+		
+    }
+
+    // reading and preprocessing go on in the background, see updateLoading()
+    // instances showing the same volume share one copy of it; later timesteps are copied
+    // into the first's images, so a sequence loads its own, and without gradients
+    if (_timestepFiles.size()<=1)
+    {
+        _loader = VolumeRegistry::instance()->getLoader(imageFile, options, maximumTextureSize, gradients && useShader);
+    }
+    else
+    {
+        _loader = new VolumeLoader(imageFile, options, maximumTextureSize);
+        _loader->start();
+    }
+
+	VolumeProfiler::instance()->record("initialize", _startup, osg::Timer::instance()->tick());
+
+    return;
+}
+
+void myOsgVolume::updateLoading()
+{
+	if (!_loader.valid()) return;
+
+	if (_loader->getStage()==VolumeLoader::Failed)
+	{
+		std::cout<<"No model loaded, please specify a volumetric image file on the command line."<<std::endl;
+		_loader = 0;
+		return;
+	}
+
+	// the coarsest level stands in while the rest is cached and classified
+	if (!_preview.valid() && !_loader->isDone() && _loader->getPreview() && _effectProperty.valid())
+	{
+		VolumeData* data = _loader->getData();
+		setupMatrix(data);
+
+		osg::ref_ptr<osgVolume::ImageLayer> previewLayer = new osgVolume::ImageLayer(_loader->getPreview());
+		previewLayer->setLocator(new osgVolume::Locator(_flip * (*_matrix)));
+		previewLayer->setTexelOffset(data->texelOffset);
+		previewLayer->setTexelScale(data->texelScale);
+		previewLayer->addProperty(_effectProperty);
+
+		osg::ref_ptr<osgVolume::VolumeTile> previewTile = new osgVolume::VolumeTile;
+		previewTile->setLocator(new osgVolume::Locator(*_matrix));
+		previewTile->setLayer(previewLayer.get());
+		previewTile->setVolumeTechnique(new VariantTechnique(_variants.get()));
+
+		_preview = new osgVolume::Volume;
+		_preview->addChild(previewTile.get());
+		_shift->addChild(_preview.get());
+
+		const osg::Image* previewImage = previewLayer->getImage();
+		OSG_NOTICE<<"myOsgVolume: preview of "<<previewImage->s()<<"x"<<previewImage->t()<<"x"<<previewImage->r()<<" shown while loading"<<std::endl;
+	}
+
+	if (!_loader->isDone()) return;
+
+	// for the tiles about to be built; the full volume is drawn from the copy mapped from the cache
+	const std::vector< osg::ref_ptr<osg::Image> >& gradients = _loader->getGradients();
+	if (_variants.valid() && !gradients.empty())
+	{
+		_variants->setGradients(_loader->getData()->image.get(), gradients[0].get());
+		for (unsigned int i = 1; i < gradients.size() && i <= _loader->getLevels().size(); ++i)
+		{
+			_variants->setGradients(_loader->getLevels()[i-1].get(), gradients[i].get());
+		}
+	}
+
+	buildVolume(_loader->getData(), _loader->getLevels(), _loader->getOccupancy());
+
+	// later timesteps are copied into the first's images, bricks keep copies of their own and can not follow
+	if (_timestepFiles.size()>1)
+	{
+		if (_bricks.valid()) OSG_NOTICE<<"myOsgVolume: time-varying volumes must fit one texture, only the first timestep is shown"<<std::endl;
+		else _stream = new VolumeStream(_timestepFiles, _options, _loader->getData(), _maximumTextureSize, _levelTiles.size(), _ringSize);
+	}
+	_loader->releaseLoadedCopy();
+	_source = _loader;
+	_loader = 0;
+
+	// where the startup went, also to be had from getProfileReport()
+	VolumeProfiler::instance()->record("startup", _startup, osg::Timer::instance()->tick());
+	OSG_INFO<<VolumeProfiler::instance()->report();
+}
+
+void myOsgVolume::setupMatrix(VolumeData* data)
+{
+	float xMultiplier = this->_xScale;
+	float yMultiplier = this->_yScale;
+	float zMultiplier = this->_zScale;
+
+    float xSize=0.0f, ySize=0.0f, zSize=0.0f;
+
+    osg::ref_ptr<osg::Image> image_3d = data->image;
+    int image_s = image_3d->s();
+    int image_t = image_3d->t();
+    int image_r = image_3d->r();
+
+    // copied, the scaling below must not leak into the source's matrix.
+    osg::ref_ptr<osg::RefMatrix> matrix = data->matrix.valid() ? new osg::RefMatrix(*data->matrix) : 0;
+
+    if (!matrix)
+    {
+        if (xSize==0.0) xSize = static_cast<float>(image_s);
+        if (ySize==0.0) ySize = static_cast<float>(image_t);
+        if (zSize==0.0) zSize = static_cast<float>(image_r);
+
+        matrix = new osg::RefMatrix(xSize, 0.0,   0.0,   0.0,
+                                    0.0,   ySize, 0.0,   0.0,
+                                    0.0,   0.0,   zSize, 0.0,
+                                    0.0,   0.0,   0.0,   1.0);
+    }
+	
+    if (xMultiplier!=1.0 || yMultiplier!=1.0 || zMultiplier!=1.0)
+    {
+        matrix->postMultScale(osg::Vec3d(fabs(xMultiplier), fabs(yMultiplier), fabs(zMultiplier)));
+    }
+
+	// AJ set the matrix to class variable
+	_matrix = matrix;
+	_clipping->setVolumeMatrix(*matrix);
+
+    if (xMultiplier<0.0 || yMultiplier<0.0 || zMultiplier<0.0)
+    {
+        _flip = osg::Matrix::translate(xMultiplier<0.0 ? -1.0 : 0.0, yMultiplier<0.0 ? -1.0 : 0.0, zMultiplier<0.0 ? -1.0 : 0.0) *
+            osg::Matrix::scale(xMultiplier<0.0 ? -1.0 : 1.0, yMultiplier<0.0 ? -1.0 : 1.0, zMultiplier<0.0 ? -1.0 : 1.0);
+    }
+
+    _shift->setPosition(osg::Vec3f( -0.5*_xScale*image_s , -0.5*_yScale*image_t, -0.5*_zScale*image_r ));
+}
+
+void myOsgVolume::buildVolume(VolumeData* data, const std::vector< osg::ref_ptr<osg::Image> >& levels, OccupancyGrid* occupancy)
+{
+	ProfileScope scope("buildVolume");
+	float alphaFunc = this->_alpha;
+    int maximumTextureSize = _maximumTextureSize;
+    bool useShader = _effectProperty.valid();
+
+    osg::ref_ptr<osg::Image> image_3d = data->image;
+    int image_s = image_3d->s();
+    int image_t = image_3d->t();
+    int image_r = image_3d->r();
+
+    // the preview has set it up already
+    if (!_matrix.valid()) setupMatrix(data);
+    osg::RefMatrix* matrix = _matrix.get();
+
+    // one 3D texture can not hold it, split it into bricks paged in as they come into view.
+    bool bricked = useShader && (image_s>maximumTextureSize || image_t>maximumTextureSize || image_r>maximumTextureSize);
+
+    osg::ref_ptr<osgVolume::Volume> volume = new osgVolume::Volume;
+    osg::ref_ptr<osgVolume::VolumeTile> tile = new osgVolume::VolumeTile;
+	_volumeTile = tile;
+    if (!bricked) volume->addChild(tile.get());
+
+    osg::ref_ptr<osgVolume::ImageLayer> layer = new osgVolume::ImageLayer(image_3d.get());
+	_imageLayer = layer;
+
+    // already rescaled by loadVolumeData.
+    layer->setTexelOffset(data->texelOffset);
+    layer->setTexelScale(data->texelScale);
+
+    layer->setLocator(new osgVolume::Locator(_flip * (*matrix)));
+	tile->setLocator(new osgVolume::Locator(*matrix));
+    
+	tile->setLayer(layer.get());
+
+    tile->setEventCallback(new osgVolume::PropertyAdjustmentCallback());
+
+    if (useShader)
+    {
+        layer->addProperty(_effectProperty);
+        tile->setVolumeTechnique(new VariantTechnique(_variants.get()));
+
+        if (bricked)
+        {
+            // the bricks share the layer's properties and locator, the tile itself is not drawn;
+            // small enough that many fit the budget and page in quickly, and with the
+            // voxel they copy either side still within the texture
+            int brickSize = std::min(256, maximumTextureSize-2);
+            _bricks = new BrickedVolume(image_3d.get(), *matrix, _flip,
+                                        brickSize, brickSize, brickSize,
+                                        _variants.get(), data->texelOffset, data->texelScale);
+            _bricks->setBudget((size_t)(_brickBudget*1024.0f*1024.0f));
+            _bricks->setCompression(_brickCompression);
+            volume->addChild(_bricks->getNode());
+            _volumeTile = 0;
+            _imageLayer = 0;
+        }
+    }
+    else
+    {
+        layer->addProperty(new osgVolume::AlphaFuncProperty(alphaFunc));
+        tile->setVolumeTechnique(new osgVolume::FixedFunctionTechnique);
+    }
+
+    // the coarser levels the loader built, drawn while the view moves.
+    _lod = new osg::Switch;
+    _lod->addChild(volume.get(), true);
+    for (unsigned int i = 0; i < levels.size() && useShader; ++i)
+    {
+        osg::Image* level = levels[i].get();
+
+        osg::ref_ptr<osgVolume::ImageLayer> levelLayer = new osgVolume::ImageLayer(level);
+        levelLayer->setLocator(new osgVolume::Locator(layer->getLocator()->getTransform()));
+        levelLayer->setTexelOffset(data->texelOffset);
+        levelLayer->setTexelScale(data->texelScale);
+        levelLayer->addProperty(_effectProperty);
+
+        osg::ref_ptr<osgVolume::VolumeTile> levelTile = new osgVolume::VolumeTile;
+        levelTile->setLocator(new osgVolume::Locator(*matrix));
+        levelTile->setLayer(levelLayer.get());
+        levelTile->setVolumeTechnique(new VariantTechnique(_variants.get()));
+
+        osg::ref_ptr<osgVolume::Volume> levelVolume = new osgVolume::Volume;
+        levelVolume->addChild(levelTile.get());
+        _lod->addChild(levelVolume.get(), false);
+        _levelTiles.push_back(levelTile.get());
+
+        OSG_NOTICE<<"myOsgVolume: level "<<_levelTiles.size()<<" of detail is "<<level->s()<<"x"<<level->t()<<"x"<<level->r()<<std::endl;
+    }
+	
+    // where maximum intensity projection can stop; later timesteps may go past
+    // the first's maximum, but not past what the texture can hold
+    if (_variants.valid() && data->texelScale[3]!=0.0f)
+    {
+        float maximum = (data->maxValue[3] - data->texelOffset[3]) / data->texelScale[3];
+        if (_timestepFiles.size()>1) maximum = image_3d->getDataType()==GL_FLOAT ? -1.0f : 1.0f;
+        _variants->setMaximumValue(maximumValueThreshold(image_3d, maximum));
+    }
+
+    // classified for this instance's transfer function, the grid as loaded may be shared
+    _occupancy = occupancy ? new OccupancyGrid(*occupancy) : 0;
+    _volumeSize.set(image_s, image_t, image_r);
+    _texelOffset = data->texelOffset;
+    _texelScale = data->texelScale;
+    _occupancyDirty = true;
+    for (unsigned int i = 0; i < _slices.size(); ++i) _slices[i].dirty = true;
+    _regionHistogram = 0;
+
+    // settings made while loading take effect on the new tiles
+    _dirty |= AlphaDirty | SampleDensityDirty | TransparencyDirty;
+    if (_moving) _lod->setSingleChildOn(std::min<int>(_levelWhenMoving, _levelTiles.size()));
+
+    // the full resolution volume replaces the preview
+    if (_preview.valid()) _shift->removeChild(_preview.get());
+    _preview = 0;
+    _shift->addChild(_lod.get());
+}
+
+namespace
+{
+
+// The plane of a slice across axis at position, in the volume's unit cube,
+// from the top left corner: x and y across, z up.
+void axisPlane(int axis, float position, osg::Vec3& origin, osg::Vec3& uAxis, osg::Vec3& vAxis)
+{
+	static const int across[3][2] = { {1, 2}, {0, 2}, {0, 1} };
+	axis = osg::clampBetween(axis, 0, 2);
+	osg::Vec3 u, v;
+	u[across[axis][0]] = 1.0f;
+	v[across[axis][1]] = 1.0f;
+	origin = v;
+	origin[axis] = osg::clampBetween(position, 0.0f, 1.0f);
+	uAxis = u;
+	vAxis = -v;
+}
+
+// A square across the whole cube through point, facing along normal, with z up it unless the normal is.
+void obliquePlane(const osg::Vec3& point, const osg::Vec3& normal, osg::Vec3& origin, osg::Vec3& uAxis, osg::Vec3& vAxis)
+{
+	osg::Vec3 n = normal;
+	if (n.normalize()==0.0f) n.set(0.0f, 0.0f, 1.0f);
+	osg::Vec3 up = fabsf(n.z())<0.9f ? osg::Vec3(0.0f, 0.0f, 1.0f) : osg::Vec3(0.0f, 1.0f, 0.0f);
+	osg::Vec3 u = up ^ n;
+	u.normalize();
+	osg::Vec3 v = n ^ u;
+
+	// the cube's diagonal, so the square covers it from any point inside
+	const float side = 1.7320508f;
+	origin = point - u*(side*0.5f) + v*(side*0.5f);
+	uAxis = u*side;
+	vAxis = -v*side;
+}
+
+}
+
+int myOsgVolume::addSlice(int axis, float position, int width, int height)
+{
+	Slice slice;
+	slice.axis = osg::clampBetween(axis, 0, 2);
+	axisPlane(slice.axis, position, slice.origin, slice.uAxis, slice.vAxis);
+	slice.dirty = true;
+
+	// the voxels across the plane: y and z across x, x and z across y, x and y across z
+	int acrossU = slice.axis==0 ? 1 : 0;
+	int acrossV = slice.axis==2 ? 1 : 2;
+	if (width<=0) width = _lod.valid() ? (int)_volumeSize[acrossU] : 256;
+	if (height<=0) height = _lod.valid() ? (int)_volumeSize[acrossV] : 256;
+	slice.pixels = new PixelData(PixelData::FormatMonochrome, width, height);
+	memset(slice.pixels->map(), 0, slice.pixels->getPitch()*height);
+	slice.pixels->unmap();
+
+	_slices.push_back(slice);
+	return _slices.size()-1;
+}
+
+int myOsgVolume::addObliqueSlice(float px, float py, float pz, float nx, float ny, float nz, int width, int height)
+{
+	Slice slice;
+	slice.axis = -1;
+	obliquePlane(osg::Vec3(px, py, pz), osg::Vec3(nx, ny, nz), slice.origin, slice.uAxis, slice.vAxis);
+	slice.dirty = true;
+
+	// as many pixels across as voxels along the longest side of the volume
+	int size = _lod.valid() ? (int)std::max(_volumeSize.x(), std::max(_volumeSize.y(), _volumeSize.z())) : 256;
+	if (width<=0) width = std::min(2048, size);
+	if (height<=0) height = std::min(2048, size);
+	slice.pixels = new PixelData(PixelData::FormatMonochrome, width, height);
+	memset(slice.pixels->map(), 0, slice.pixels->getPitch()*height);
+	slice.pixels->unmap();
+
+	_slices.push_back(slice);
+	return _slices.size()-1;
+}
+
+void myOsgVolume::setSlicePosition(int index, float position)
+{
+	if (index<0 || index>=(int)_slices.size() || _slices[index].axis<0) return;
+	Slice& slice = _slices[index];
+	axisPlane(slice.axis, position, slice.origin, slice.uAxis, slice.vAxis);
+	slice.dirty = true;
+}
+
+void myOsgVolume::setObliqueSlice(int index, float px, float py, float pz, float nx, float ny, float nz)
+{
+	if (index<0 || index>=(int)_slices.size()) return;
+	Slice& slice = _slices[index];
+	slice.axis = -1;
+	obliquePlane(osg::Vec3(px, py, pz), osg::Vec3(nx, ny, nz), slice.origin, slice.uAxis, slice.vAxis);
+	slice.dirty = true;
+}
+
+PixelData* myOsgVolume::getSlice(int index)
+{
+	if (index<0 || index>=(int)_slices.size()) return 0;
+	return _slices[index].pixels.get();
+}
+
+int myOsgVolume::getNumSlices()
+{
+	return _slices.size();
+}
+
+void myOsgVolume::setSliceWindow(float low, float high)
+{
+	_sliceLow = low;
+	_sliceHigh = high;
+	for (unsigned int i = 0; i < _slices.size(); ++i) _slices[i].dirty = true;
+}
+
+const osg::Image* myOsgVolume::drawnImage()
+{
+	if (_imageLayer.valid()) return _imageLayer->getImage();
+	if (_source.valid() && _source->getData()) return _source->getData()->image.get();
+	return 0;
+}
+
+void myOsgVolume::updateSlices()
+{
+	const osg::Image* image = drawnImage();
+	if (!image) return;
+
+	// the window in the texture's units, as the layer maps them back
+	float low = 0.0f, high = 1.0f;
+	if (_sliceLow<_sliceHigh && _texelScale[3]!=0.0f)
+	{
+		low = (_sliceLow - _texelOffset[3]) / _texelScale[3];
+		high = (_sliceHigh - _texelOffset[3]) / _texelScale[3];
+	}
+
+	// the image's texture coordinates from the volume's unit cube
+	osg::Matrix volumeToImage = osg::Matrix::inverse(_flip);
+	for (unsigned int i = 0; i < _slices.size(); ++i)
+	{
+		Slice& slice = _slices[i];
+		if (!slice.dirty) continue;
+		slice.dirty = false;
+
+		ProfileScope scope("reslice");
+		PixelData* pixels = slice.pixels.get();
+		resliceVolume(image, slice.origin * volumeToImage,
+					osg::Matrix::transform3x3(slice.uAxis, volumeToImage), osg::Matrix::transform3x3(slice.vAxis, volumeToImage),
+					low, high, pixels->map(), pixels->getWidth(), pixels->getHeight(), pixels->getPitch());
+		pixels->unmap();
+		pixels->setDirty();
+	}
+}
+
+void myOsgVolume::setHistogramRegion(float x0, float y0, float z0, float x1, float y1, float z1)
+{
+	_histogramRegion.set(std::min(x0, x1), std::min(y0, y1), std::min(z0, z1), std::max(x0, x1), std::max(y0, y1), std::max(z0, z1));
+	_regionHistogram = 0;
+}
+
+void myOsgVolume::clearHistogramRegion()
+{
+	_histogramRegion.init();
+	_regionHistogram = 0;
+}
+
+VolumeHistogram* myOsgVolume::histogram()
+{
+	VolumeHistogram* whole = _source.valid() ? _source->getHistogram() : 0;
+	if (!whole || !_histogramRegion.valid()) return whole;
+	if (!_regionHistogram.valid())
+	{
+		// the bins of the whole volume, so the region compares with it
+		_regionHistogram = new VolumeHistogram(drawnImage(), whole->getNumBins(), whole->getNumGradientBins(),
+									whole->getLow(), whole->getHigh(), transformBox(_histogramRegion, osg::Matrix::inverse(_flip)));
+	}
+	return _regionHistogram.get();
+}
+
+int myOsgVolume::getHistogramBins()
+{
+	VolumeHistogram* h = histogram();
+	return h ? h->getNumBins() : 0;
+}
+
+int myOsgVolume::getHistogramGradientBins()
+{
+	VolumeHistogram* h = histogram();
+	return h ? h->getNumGradientBins() : 0;
+}
+
+float myOsgVolume::getHistogramValue(int bin)
+{
+	VolumeHistogram* h = histogram();
+	return h && bin>=0 && bin<(int)h->getNumBins() ? h->getBinValue(bin)*_texelScale[3] + _texelOffset[3] : 0.0f;
+}
+
+float myOsgVolume::getHistogramCount(int bin)
+{
+	VolumeHistogram* h = histogram();
+	if (!h || h->empty() || bin<0) return 0.0f;
+	return double(h->getCount(bin))/h->getTotal();
+}
+
+float myOsgVolume::getHistogramJointCount(int bin, int gradientBin)
+{
+	VolumeHistogram* h = histogram();
+	if (!h || h->empty() || bin<0 || gradientBin<0) return 0.0f;
+	return double(h->getCount(bin, gradientBin))/h->getTotal();
+}
+
+float myOsgVolume::getHistogramGradient(int bin)
+{
+	VolumeHistogram* h = histogram();
+	return h && bin>=0 ? h->getMeanGradient(bin) : 0.0f;
+}
+
+float myOsgVolume::getValueMinimum()
+{
+	VolumeHistogram* h = histogram();
+	return h ? h->getMinimum()*_texelScale[3] + _texelOffset[3] : 0.0f;
+}
+
+float myOsgVolume::getValueMaximum()
+{
+	VolumeHistogram* h = histogram();
+	return h ? h->getMaximum()*_texelScale[3] + _texelOffset[3] : 0.0f;
+}
+
+float myOsgVolume::getValueMean()
+{
+	VolumeHistogram* h = histogram();
+	return h ? h->getMean()*_texelScale[3] + _texelOffset[3] : 0.0f;
+}
+
+float myOsgVolume::getValueDeviation()
+{
+	VolumeHistogram* h = histogram();
+	return h ? h->getDeviation()*fabsf(_texelScale[3]) : 0.0f;
+}
+
+float myOsgVolume::getValuePercentile(float fraction)
+{
+	VolumeHistogram* h = histogram();
+	return h ? h->getPercentile(fraction)*_texelScale[3] + _texelOffset[3] : 0.0f;
+}
+
+bool myOsgVolume::isLoaded()
+{
+	return _lod.valid();
+}
+
+float myOsgVolume::getLoadProgress()
+{
+	if (_loader.valid()) return _loader->getProgress();
+	return 1.0f;
+}
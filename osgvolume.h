@@ -1,98 +1,373 @@
-#ifndef	__AJ_OSGVOLUME__
-#define __AJ_OSGVOLUME__
-
-#include "cyclops/SceneManager.h"
-
-#include <osg/ClipNode>
-#include <osgVolume/Volume>
-
-enum ShadingModel
-{
-    Standard,
-    Light,
-    Isosurface,
-    MaximumIntensityProjection
-};
-
-using namespace omega;
-using namespace omegaToolkit;
-using namespace omegaOsg;
-
-class myOsgVolume : public EngineModule
-{
-public:
-	myOsgVolume(std::string filename, float alpha, float fx, float fy, float fz) 
-		: EngineModule("OsgViewer"),
-		_xScale(fx),
-		_yScale(fy),
-		_zScale(fz),
-		_alpha(alpha),
-		imageFile(filename)
-	{
-		//myOsg = new OsgModule();
-		//ModuleServices::addModule(myOsg);
-		myOsg = OsgModule::instance();
-	}
-
-	
-	virtual void initialize();
-	virtual void update(const UpdateContext& context);
-	void setArguments();
-
-	// Interfaces
-	void setPosition( float x, float y, float z );
-	void setRotation( float fx, float fy, float fz, float degree);
-	void translate( float x, float y, float z);
-	void rotate( float fx, float fy, float fz, float degree);
-	//void activateEffect( ShadingModel index );
-	void activateEffect( int index );
-	
-	void setCustomizedProperty();
-	void addTransferPoint(float intensity, float r, float g, float b, float alpha);
-	void clearTransferFunction();
-	void setClipping();
-
-	void setAlphaFunc(float alpha);
-	void setScale(float x, float y, float z);
-	void setSampleDensity(float sd);
-	void setTransparency(float tp);
-
-	void setDirty();
-	
-	//setup
-	static myOsgVolume* createAndInitialize(std::string filename, float alpha = 0.02, float fx=1, float fy=1, float fz=1);
-	//virtual void update(const UpdateContext&context);
-
-private:
-	Ref<OsgModule> myOsg;
-	Ref<osg::ClipNode> myClipNode;
-
-	Ref<osgVolume::VolumeTile> _volumeTile;
-	Ref<osgVolume::ImageLayer> _imageLayer;
-	
-	// property 4 -> osgVolume::AlphaFuncProperty* ap = new osgVolume::AlphaFuncProperty(alphaFunc);
-	// property 5 -> cp->addProperty(new osgVolume::MaximumIntensityProjectionProperty);
-	// property 3 -> osgVolume::TransferFunctionProperty* tfp = transferFunction.valid() ? new osgVolume::TransferFunctionProperty(transferFunction.get()) : 0;
-	Ref<osgVolume::SwitchProperty> _effectProperty;
-	Ref<osgVolume::CompositeProperty> _customProperty;
-	Ref<osgVolume::AlphaFuncProperty> _ap;
-	Ref<osgVolume::IsoSurfaceProperty> _is;
-	Ref<osgVolume::SampleDensityProperty> _sd;
-	Ref<osgVolume::TransparencyProperty> _tp;
-	Ref<osgVolume::TransferFunctionProperty> _tfp;
-	Ref<osg::TransferFunction1D> _tf;
-	
-	Ref<osg::RefMatrix> _matrix;
-	
-	//Ref<SceneManager> mySceneManager;
-	osg::PositionAttitudeTransform* modelForm;
-	std::string imageFile;
-	float _xScale;
-	float _yScale;
-	float _zScale;
-	float _alpha;
-	float _sampleDensity;
-	float _transparency;
-};
-
+#ifndef	__AJ_OSGVOLUME__
+#define __AJ_OSGVOLUME__
+
+#include "cyclops/SceneManager.h"
+#include "volumedata.h"
+#include "volumeloader.h"
+#include "volumebricks.h"
+#include "volumeclip.h"
+#include "volumehistogram.h"
+#include "volumeoccupancy.h"
+#include "volumestream.h"
+#include "volumetechnique.h"
+#include "volumetransfer.h"
+
+#include <osg/Switch>
+#include <osg/Timer>
+#include <osgVolume/Volume>
+
+enum ShadingModel
+{
+    Standard,
+    Light,
+    Isosurface,
+    MaximumIntensityProjection,
+    NumShadingModels
+};
+
+using namespace omega;
+using namespace omegaToolkit;
+using namespace omegaOsg;
+
+class myOsgVolume : public EngineModule
+{
+public:
+	myOsgVolume(std::string filename, float alpha, float fx, float fy, float fz) 
+		: EngineModule("OsgViewer"),
+		_xScale(fx),
+		_yScale(fy),
+		_zScale(fz),
+		_alpha(alpha),
+		_sampleDensity(0.005f),
+		_transparency(1.0f),
+		_brickBudget(512.0f),
+		_brickCompression(false),
+		_sampleDensityWhenMoving(0.02f),
+		_levelWhenMoving(1),
+		_refineDelay(0.25f),
+		_idleTime(0.0f),
+		_moving(false),
+		_targetFrameTime(0.0f),
+		_frameTime(0.0f),
+		_adaptTime(0.0f),
+		_finestSampleDensity(0.001f),
+		_coarsestSampleDensity(0.02f),
+		_occupancyDirty(false),
+		_dirty(0),
+		_sliceLow(0.0f),
+		_sliceHigh(0.0f),
+		_shadingModel(Standard),
+		_tfEnabled(true),
+		_tfVersion(0),
+		_tfSubmitted(0),
+		_tfApplied(0),
+		_tfBatch(false),
+		_maximumTextureSize(2048),
+		_ringSize(8),
+		_playbackRate(0.0f),
+		_playbackTime(0.0),
+		_timestep(0),
+		modelForm(0),
+		imageFile(filename)
+	{
+		//myOsg = new OsgModule();
+		//ModuleServices::addModule(myOsg);
+		myOsg = OsgModule::instance();
+	}
+
+	
+	virtual void initialize();
+	virtual void update(const UpdateContext& context);
+	void setArguments();
+
+	// Interfaces
+	void setPosition( float x, float y, float z );
+	void setRotation( float fx, float fy, float fz, float degree);
+	void translate( float x, float y, float z);
+	void rotate( float fx, float fy, float fz, float degree);
+	//void activateEffect( ShadingModel index );
+	void activateEffect( int index );
+	
+	void setCustomizedProperty();
+	void addTransferPoint(float intensity, float r, float g, float b, float alpha);
+	void clearTransferFunction();
+	// Between these two, transfer function edits are held back and go to the
+	// GPU together. Edits outside a batch are gathered until the next frame.
+	void beginTransferFunction();
+	void commitTransferFunction();
+	// Without it the shaders read the volume's values directly.
+	void setTransferFunctionEnabled(bool enabled);
+
+	// Clipping, in the unit cube of the volume as drawn, takes effect on the
+	// next frame without re-initialising anything. A plane keeps the side its
+	// normal points to; a box keeps its inside: a box of the given size about
+	// centre, turned angle radians about the axis, as rotate() turns.
+	void setClipPlane(int index, float px, float py, float pz, float nx, float ny, float nz);
+	// The same in world coordinates, for a plane held with the wand.
+	void setClipPlaneInWorld(int index, float px, float py, float pz, float nx, float ny, float nz);
+	void clearClipPlane(int index);
+	void setClipBox(float cx, float cy, float cz, float sx, float sy, float sz, float fx, float fy, float fz, float angle);
+	void clearClipBox();
+	void clearClipping();
+	// A fixed box cutting away most of the volume, for a quick look inside.
+	void setClipping();
+
+	void setAlphaFunc(float alpha);
+	void setScale(float x, float y, float z);
+	void setSampleDensity(float sd);
+	void setTransparency(float tp);
+
+	// Compositing stops along a ray once what it has passed is this opaque,
+	// 0.98 to begin with; 0 marches every ray to the end. Maximum intensity
+	// projection stops on reaching the volume's largest value regardless.
+	void setEarlyRayTermination(float opacity);
+
+	// With a target, the sample step is adjusted every half second or so,
+	// within the range, until the frames take about as long as the target
+	// allows; 0 keeps the step setSampleDensity() gave. The frame time is
+	// smoothed and must stray well past the target either way before the
+	// step changes, so the image does not pulse.
+	void setTargetFrameRate(float framesPerSecond);
+	void setSampleDensityRange(float finest, float coarsest);
+	// The step drawn with now, and the smoothed frame time in milliseconds.
+	float getSampleDensity();
+	float getFrameTime();
+
+	// The tiles are re-initialised at the next update(), once however often this is called.
+	void setDirty();
+
+	// Volumes larger than a 3D texture are split into bricks of 256 voxels a
+	// side, of which at most this many megabytes are kept in memory; never
+	// less than one brick.
+	void setBrickBudget(float megabytes);
+	// Bricks paged out stay in memory compressed, and page back in from there.
+	void setBrickCompression(bool compress);
+	float getCompressedBrickMegabytes();
+	int getNumBricks();
+	int getNumResidentBricks();
+
+	// While the volume or the camera moves, a coarser level of the pyramid is
+	// drawn with a coarser sample step; idle for a moment, it refines again.
+	// A step of 0 keeps the sample density while moving.
+	void setSampleDensityWhenMoving(float sd);
+	void setLevelWhenMoving(int level);
+	int getNumLevels();
+
+	// Fraction of the occupancy grid cells the transfer function leaves visible.
+	float getOccupancy();
+
+	// A time-varying volume plays through its timesteps at this many a
+	// second, backwards when negative; 0 holds the current one.
+	void setPlaybackRate(float timestepsPerSecond);
+	void setTimestep(int timestep);
+	int getTimestep();
+	int getNumTimesteps();
+	int getNumResidentTimesteps();
+
+	// Slices through the volume in memory for 2D views, with no file read
+	// again: grey images of the value, filled in place on the next update()
+	// after anything about them changes, so an image widget showing one
+	// follows the position, the timestep and the volume coming in. A slice is
+	// across an axis (0 x, 1 y, 2 z) at position 0..1, or oblique through a
+	// point along a normal, in the unit cube of the volume as drawn; the first
+	// axis of the plane runs across its rows, the second up it. Width and
+	// height of 0 take the voxels of the volume across the plane, 256 until
+	// it is loaded. Returns the index of the slice.
+	int addSlice(int axis, float position, int width = 0, int height = 0);
+	int addObliqueSlice(float px, float py, float pz, float nx, float ny, float nz, int width = 0, int height = 0);
+	void setSlicePosition(int index, float position);
+	void setObliqueSlice(int index, float px, float py, float pz, float nx, float ny, float nz);
+	PixelData* getSlice(int index);
+	int getNumSlices();
+	// Source values from black to white; low >= high for the whole range of the texture.
+	void setSliceWindow(float low, float high);
+
+	// How the values are spread, for drawing under the transfer function and
+	// placing its points: a histogram of the value, its mean gradient per bin,
+	// which peaks at the values of boundaries, and a joint histogram of value
+	// and gradient magnitude. Values are in source units; counts are fractions
+	// of the voxels; gradients are 0..1 along their bins. Over the whole volume
+	// as loaded, worked out once and shared by the instances showing it, or
+	// over the region set, a box in the volume's unit cube counted on demand
+	// from the timestep drawn. All 0 until the volume is loaded.
+	void setHistogramRegion(float x0, float y0, float z0, float x1, float y1, float z1);
+	void clearHistogramRegion();
+	int getHistogramBins();
+	int getHistogramGradientBins();
+	float getHistogramValue(int bin);
+	float getHistogramCount(int bin);
+	float getHistogramJointCount(int bin, int gradientBin);
+	float getHistogramGradient(int bin);
+	float getValueMinimum();
+	float getValueMaximum();
+	float getValueMean();
+	float getValueDeviation();
+	float getValuePercentile(float fraction);
+
+	// The volume loads in the background after createAndInitialize returns, a
+	// coarse preview first. Everything can be set up meanwhile, it applies to
+	// the volume once it is in.
+	bool isLoaded();
+	float getLoadProgress();
+
+	// Timings of loading and of every frame: milliseconds and number of the
+	// recent events called name, running totals of the counters, and all of
+	// it as a Chrome trace (chrome://tracing) for a closer look.
+	std::string getProfileReport();
+	float getProfileTime(std::string name);
+	int getProfileCount(std::string name);
+	float getProfileCounter(std::string name);
+	bool writeProfileTrace(std::string filename);
+	void resetProfile();
+	
+	//setup
+	static myOsgVolume* createAndInitialize(std::string filename, float alpha = 0.02, float fx=1, float fy=1, float fz=1);
+	// A headerless volume file, memory-mapped; .nrrd/.nhdr files go through createAndInitialize.
+	static myOsgVolume* createAndInitializeRaw(std::string filename, int sizeX, int sizeY, int sizeZ, int bytesPerComponent, int components, std::string endian, float alpha = 0.02, float fx=1, float fy=1, float fz=1);
+	// One volume per timestep, see volumeTimesteps() for the patterns. At
+	// most ringSize timesteps are held decoded at once.
+	static myOsgVolume* createAndInitializeSequence(std::string pattern, int ringSize = 8, float alpha = 0.02, float fx=1, float fy=1, float fz=1);
+	//virtual void update(const UpdateContext&context);
+
+private:
+	void updateLoading();
+	void updateTimestep(const UpdateContext& context);
+	void setupMatrix(VolumeData* data);
+	void buildVolume(VolumeData* data, const std::vector< osg::ref_ptr<osg::Image> >& levels, OccupancyGrid* occupancy);
+	bool viewChanged();
+	void updateLevelOfDetail(const UpdateContext& context);
+	void updateSampleDensity(const UpdateContext& context);
+	void updateOccupancy();
+	// the timestep drawn; a bricked volume has no layer, its bricks are copies of the volume as loaded
+	const osg::Image* drawnImage();
+	void updateSlices();
+	// the one the histogram getters answer from
+	VolumeHistogram* histogram();
+	void updateProperties();
+	void dirtyTiles();
+	int shadingVariant() const;
+	void submitTransferFunction();
+	void updateTransferFunction();
+
+	Ref<OsgModule> myOsg;
+
+	Ref<osgVolume::VolumeTile> _volumeTile;
+	Ref<osgVolume::ImageLayer> _imageLayer;
+	Ref<BrickedVolume> _bricks;
+
+	// level 0 is the full volume, the others single tiles of the halved copies
+	Ref<osg::Switch> _lod;
+	std::vector< Ref<osgVolume::VolumeTile> > _levelTiles;
+	
+	// property 4 -> osgVolume::AlphaFuncProperty* ap = new osgVolume::AlphaFuncProperty(alphaFunc);
+	// property 5 -> cp->addProperty(new osgVolume::MaximumIntensityProjectionProperty);
+	// property 3 -> osgVolume::TransferFunctionProperty* tfp = transferFunction.valid() ? new osgVolume::TransferFunctionProperty(transferFunction.get()) : 0;
+	Ref<osgVolume::SwitchProperty> _effectProperty;
+	Ref<ShadingVariants> _variants;
+	ShadingModel _shadingModel;
+	bool _tfEnabled;
+	Ref<osgVolume::CompositeProperty> _customProperty;
+	Ref<osgVolume::AlphaFuncProperty> _ap;
+	Ref<osgVolume::IsoSurfaceProperty> _is;
+	Ref<osgVolume::SampleDensityProperty> _sd;
+	Ref<osgVolume::TransparencyProperty> _tp;
+	Ref<osgVolume::TransferFunctionProperty> _tfp;
+	Ref<osg::TransferFunction1D> _tf;
+
+	// the points as edited; each edit bumps the version, and the table the
+	// builder rasterises for a version is swapped into _tf in update()
+	osg::TransferFunction1D::ColorMap _tfPoints;
+	unsigned int _tfVersion;
+	unsigned int _tfSubmitted;
+	unsigned int _tfApplied;
+	bool _tfBatch;
+	Ref<TransferFunctionBuilder> _tfBuilder;
+	
+	Ref<osg::RefMatrix> _matrix;
+	osg::Matrix _flip;
+
+	Ref<OccupancyGrid> _occupancy;
+	osg::Vec3 _volumeSize;
+	osg::Vec4 _texelOffset;
+	osg::Vec4 _texelScale;
+	bool _occupancyDirty;
+
+	// what has changed since the last update(); the scalar properties only
+	// need their uniform set, the rest rebuilds the tiles' technique
+	enum DirtyFlag
+	{
+		AlphaDirty = 1<<0,
+		SampleDensityDirty = 1<<1,
+		TransparencyDirty = 1<<2,
+		TechniqueDirty = 1<<3
+	};
+	unsigned int _dirty;
+
+	Ref<VolumeClipping> _clipping;
+
+	// the slices handed out, their planes in the volume's unit cube
+	struct Slice
+	{
+		Ref<PixelData> pixels;
+		int axis;
+		osg::Vec3 origin;
+		osg::Vec3 uAxis;
+		osg::Vec3 vAxis;
+		bool dirty;
+	};
+	std::vector<Slice> _slices;
+	float _sliceLow;
+	float _sliceHigh;
+
+	// over _histogramRegion when it is valid, counted again when dropped
+	Ref<VolumeHistogram> _regionHistogram;
+	osg::BoundingBox _histogramRegion;
+
+	// until it is done, then the volume's tiles go under _shift in place of the preview
+	Ref<VolumeLoader> _loader;
+	// kept once done, so instances created later share what it loaded, see VolumeRegistry
+	Ref<VolumeLoader> _source;
+	Ref<osg::PositionAttitudeTransform> _shift;
+	Ref<osgVolume::Volume> _preview;
+	int _maximumTextureSize;
+	osg::Timer_t _startup;
+
+	// timesteps past the first stream through a ring into the first's images
+	std::vector<std::string> _timestepFiles;
+	int _ringSize;
+	Ref<VolumeStream> _stream;
+	float _playbackRate;
+	double _playbackTime;
+	unsigned int _timestep;
+	
+	//Ref<SceneManager> mySceneManager;
+	osg::PositionAttitudeTransform* modelForm;
+	std::string imageFile;
+	float _xScale;
+	float _yScale;
+	float _zScale;
+	float _alpha;
+	float _sampleDensity;
+	float _transparency;
+	float _brickBudget;
+	bool _brickCompression;
+	float _sampleDensityWhenMoving;
+	int _levelWhenMoving;
+	float _refineDelay;
+	float _idleTime;
+	bool _moving;
+	// seconds, the target 0 when the step is left alone
+	float _targetFrameTime;
+	float _frameTime;
+	float _adaptTime;
+	float _finestSampleDensity;
+	float _coarsestSampleDensity;
+	osg::Vec3d _lastPosition;
+	osg::Quat _lastAttitude;
+	Vector3f _lastCameraPosition;
+	Quaternion _lastCameraOrientation;
+
+	VolumeOptions _options;
+};
+
 #endif
\ No newline at end of file
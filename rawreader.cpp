@@ -0,0 +1,425 @@
+#include "rawreader.h"
+
+#include <osg/Notify>
+#include <osg/Endian>
+#include <osg/Matrix>
+#include <osgDB/FileNameUtils>
+#include <osgDB/fstream>
+
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#ifdef WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+	: _data(0),
+	_size(0)
+#ifdef WIN32
+	, _file(INVALID_HANDLE_VALUE),
+	_mapping(0)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef WIN32
+	if (_data) UnmapViewOfFile(_data);
+	if (_mapping) CloseHandle(_mapping);
+	if (_file!=INVALID_HANDLE_VALUE) CloseHandle(_file);
+#else
+	if (_data) munmap(_data, _size);
+#endif
+}
+
+MappedFile* MappedFile::open(const std::string& filename, bool copyOnWrite)
+{
+	osg::ref_ptr<MappedFile> file = new MappedFile;
+
+#ifdef WIN32
+	file->_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file->_file==INVALID_HANDLE_VALUE) return 0;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file->_file, &size) || size.QuadPart==0) return 0;
+	file->_size = static_cast<size_t>(size.QuadPart);
+
+	file->_mapping = CreateFileMappingA(file->_file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	if (!file->_mapping) return 0;
+
+	file->_data = static_cast<unsigned char*>(MapViewOfFile(file->_mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+	if (!file->_data) return 0;
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd<0) return 0;
+
+	struct stat st;
+	if (fstat(fd, &st)!=0 || st.st_size==0)
+	{
+		close(fd);
+		return 0;
+	}
+	file->_size = static_cast<size_t>(st.st_size);
+
+	void* data = mmap(0, file->_size, copyOnWrite ? (PROT_READ|PROT_WRITE) : PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data==MAP_FAILED) return 0;
+	file->_data = static_cast<unsigned char*>(data);
+
+#ifdef MADV_SEQUENTIAL
+	// the texture upload walks the volume front to back
+	madvise(file->_data, file->_size, MADV_SEQUENTIAL);
+#endif
+#endif
+
+	return file.release();
+}
+
+MappedImage::MappedImage(MappedFile* file, size_t offset,
+						int s, int t, int r,
+						GLenum pixelFormat, GLenum dataType,
+						GLint internalTextureFormat, int packing)
+	: _file(file)
+{
+	setImage(s, t, r, internalTextureFormat ? internalTextureFormat : pixelFormat, pixelFormat, dataType,
+			file->data()+offset, osg::Image::NO_DELETE, packing);
+}
+
+namespace
+{
+
+// Plain loops over whole words, which the compiler turns into vector shuffles.
+void swapBytes(unsigned char* data, size_t count, unsigned int numberBytesPerComponent)
+{
+	switch(numberBytesPerComponent)
+	{
+		case(2):
+		{
+			unsigned short* ptr = reinterpret_cast<unsigned short*>(data);
+			for(size_t i=0; i<count; ++i)
+			{
+				unsigned short v = ptr[i];
+				ptr[i] = static_cast<unsigned short>((v>>8) | (v<<8));
+			}
+			break;
+		}
+		case(4):
+		{
+			unsigned int* ptr = reinterpret_cast<unsigned int*>(data);
+			for(size_t i=0; i<count; ++i)
+			{
+				unsigned int v = ptr[i];
+				ptr[i] = (v>>24) | ((v>>8)&0x0000ff00u) | ((v<<8)&0x00ff0000u) | (v<<24);
+			}
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+GLenum pixelFormatForComponents(int numberOfComponents)
+{
+	switch(numberOfComponents)
+	{
+		case 1 : return GL_LUMINANCE;
+		case 2 : return GL_LUMINANCE_ALPHA;
+		case 3 : return GL_RGB;
+		case 4 : return GL_RGBA;
+	}
+	return 0;
+}
+
+// Maps the file and wraps the volume found at offset; shared by readRaw and readNrrd.
+osg::Image* mapVolume(const std::string& filename, size_t offset, bool dataAtEnd,
+					int sizeX, int sizeY, int sizeZ,
+					int numberBytesPerComponent, int numberOfComponents,
+					GLenum dataType, bool endianSwap)
+{
+	GLenum pixelFormat = pixelFormatForComponents(numberOfComponents);
+	if (!pixelFormat)
+	{
+		OSG_NOTICE<<"Error: numberOfComponents="<<numberOfComponents<<" not supported, only 1,2,3 or 4 are supported."<<std::endl;
+		return 0;
+	}
+
+	// private writable pages: swapping and the later rescale modify the image without touching the file
+	osg::ref_ptr<MappedFile> file = MappedFile::open(filename, true);
+	if (!file)
+	{
+		OSG_NOTICE<<"Error: unable to map "<<filename<<std::endl;
+		return 0;
+	}
+
+	size_t count = static_cast<size_t>(sizeX)*sizeY*sizeZ*numberOfComponents;
+	size_t dataSize = count*numberBytesPerComponent;
+	if (dataAtEnd && file->size()>=dataSize) offset = file->size()-dataSize;
+	if (offset+dataSize > file->size())
+	{
+		OSG_NOTICE<<"Error: "<<filename<<" holds "<<file->size()<<" bytes, expected "<<offset+dataSize<<"."<<std::endl;
+		return 0;
+	}
+
+	// a misaligned start would make the swap loops read unaligned words
+	if (endianSwap && (offset % numberBytesPerComponent)!=0)
+	{
+		OSG_NOTICE<<"Error: "<<filename<<" needs byte swapping but its data is not aligned to the component size."<<std::endl;
+		return 0;
+	}
+
+	if (endianSwap)
+	{
+		swapBytes(file->data()+offset, count, numberBytesPerComponent);
+	}
+
+	osg::ref_ptr<osg::Image> image = new MappedImage(file.get(), offset, sizeX, sizeY, sizeZ, pixelFormat, dataType);
+	image->setFileName(filename);
+
+	OSG_NOTICE<<"Mapped "<<filename<<", pixelFormat=0x"<<std::hex<<pixelFormat<<", dataType=0x"<<dataType<<std::dec
+		<<", s="<<sizeX<<", t="<<sizeY<<", r="<<sizeZ<<(endianSwap ? ", byte swapped" : "")<<std::endl;
+
+	return image.release();
+}
+
+bool needsEndianSwap(const std::string& endian)
+{
+	return (osg::getCpuByteOrder()==osg::BigEndian) ? (endian!="big") : (endian=="big");
+}
+
+std::string trim(const std::string& str)
+{
+	std::string::size_type start = str.find_first_not_of(" \t\r\n");
+	if (start==std::string::npos) return std::string();
+	std::string::size_type end = str.find_last_not_of(" \t\r\n");
+	return str.substr(start, end-start+1);
+}
+
+bool nrrdType(const std::string& type, GLenum& dataType, int& numberBytesPerComponent)
+{
+	if (type=="uchar" || type=="unsigned char" || type=="uint8" || type=="uint8_t")
+	{
+		dataType = GL_UNSIGNED_BYTE; numberBytesPerComponent = 1;
+	}
+	else if (type=="signed char" || type=="int8" || type=="int8_t")
+	{
+		dataType = GL_BYTE; numberBytesPerComponent = 1;
+	}
+	else if (type=="short" || type=="short int" || type=="signed short" || type=="signed short int" || type=="int16" || type=="int16_t")
+	{
+		dataType = GL_SHORT; numberBytesPerComponent = 2;
+	}
+	else if (type=="ushort" || type=="unsigned short" || type=="unsigned short int" || type=="uint16" || type=="uint16_t")
+	{
+		dataType = GL_UNSIGNED_SHORT; numberBytesPerComponent = 2;
+	}
+	else if (type=="int" || type=="signed int" || type=="int32" || type=="int32_t")
+	{
+		dataType = GL_INT; numberBytesPerComponent = 4;
+	}
+	else if (type=="uint" || type=="unsigned int" || type=="uint32" || type=="uint32_t")
+	{
+		dataType = GL_UNSIGNED_INT; numberBytesPerComponent = 4;
+	}
+	else if (type=="float")
+	{
+		dataType = GL_FLOAT; numberBytesPerComponent = 4;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+}
+
+osg::Image* readRaw(int sizeX, int sizeY, int sizeZ, int numberBytesPerComponent, int numberOfComponents,
+					const std::string& endian, const std::string& raw_filename, size_t offset)
+{
+	GLenum dataType;
+	switch(numberBytesPerComponent)
+	{
+		case 1 : dataType = GL_UNSIGNED_BYTE; break;
+		case 2 : dataType = GL_UNSIGNED_SHORT; break;
+		case 4 : dataType = GL_UNSIGNED_INT; break;
+		default :
+			OSG_NOTICE<<"Error: numberBytesPerComponent="<<numberBytesPerComponent<<" not supported, only 1,2 or 4 are supported."<<std::endl;
+			return 0;
+	}
+
+	return mapVolume(raw_filename, offset, false, sizeX, sizeY, sizeZ, numberBytesPerComponent, numberOfComponents,
+					dataType, numberBytesPerComponent>1 && needsEndianSwap(endian));
+}
+
+std::string nrrdDataFile(const std::string& filename)
+{
+	osgDB::ifstream fin(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!fin) return std::string();
+
+	std::string line;
+	std::getline(fin, line);
+	if (line.compare(0, 4, "NRRD")!=0) return std::string();
+
+	while(std::getline(fin, line))
+	{
+		line = trim(line);
+		if (line.empty()) break;
+		std::string::size_type colon = line.find(':');
+		if (line[0]=='#' || colon==std::string::npos) continue;
+
+		std::string key = trim(line.substr(0, colon));
+		if (key=="data file" || key=="datafile") return osgDB::concatPaths(osgDB::getFilePath(filename), trim(line.substr(colon+1)));
+	}
+	return std::string();
+}
+
+osg::Image* readNrrd(const std::string& filename)
+{
+	osgDB::ifstream fin(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!fin) return 0;
+
+	std::string line;
+	std::getline(fin, line);
+	if (line.compare(0, 4, "NRRD")!=0)
+	{
+		OSG_NOTICE<<"Error: "<<filename<<" is not a NRRD file."<<std::endl;
+		return 0;
+	}
+
+	std::string type, encoding("raw"), endian("little"), dataFile;
+	int dimension = 0;
+	std::vector<int> sizes;
+	std::vector<double> spacings;
+	long byteSkip = 0;
+	int lineSkip = 0;
+	bool attached = false;
+
+	while(std::getline(fin, line))
+	{
+		line = trim(line);
+		if (line.empty())
+		{
+			// a blank line ends the header of a .nrrd, the data follows it
+			attached = true;
+			break;
+		}
+		if (line[0]=='#') continue;
+
+		std::string::size_type colon = line.find(':');
+		if (colon==std::string::npos) continue;
+
+		std::string key = trim(line.substr(0, colon));
+		std::string value = trim(line.substr(colon+1));
+		std::istringstream values(value);
+
+		if (key=="type") type = value;
+		else if (key=="dimension") values >> dimension;
+		else if (key=="sizes") { int size; while(values >> size) sizes.push_back(size); }
+		else if (key=="encoding") encoding = value;
+		else if (key=="endian") endian = value;
+		else if (key=="data file" || key=="datafile") dataFile = value;
+		else if (key=="byte skip" || key=="byteskip") values >> byteSkip;
+		else if (key=="line skip" || key=="lineskip") values >> lineSkip;
+		else if (key=="spacings")
+		{
+			std::string spacing;
+			while(values >> spacing) spacings.push_back(atof(spacing.c_str()));
+		}
+		else if (key=="space directions")
+		{
+			std::string direction;
+			while(values >> direction)
+			{
+				if (direction=="none") { spacings.push_back(0.0); continue; }
+
+				double x=0.0, y=0.0, z=0.0;
+				for(std::string::iterator itr = direction.begin(); itr != direction.end(); ++itr)
+				{
+					if (*itr=='(' || *itr==')' || *itr==',') *itr = ' ';
+				}
+				std::istringstream components(direction);
+				components >> x >> y >> z;
+				spacings.push_back(sqrt(x*x+y*y+z*z));
+			}
+		}
+	}
+
+	size_t offset = attached ? static_cast<size_t>(fin.tellg()) : 0;
+	fin.close();
+
+	GLenum dataType;
+	int numberBytesPerComponent;
+	if (!nrrdType(type, dataType, numberBytesPerComponent))
+	{
+		OSG_NOTICE<<"Error: NRRD type \""<<type<<"\" not supported."<<std::endl;
+		return 0;
+	}
+	if (encoding!="raw")
+	{
+		OSG_NOTICE<<"Error: NRRD encoding \""<<encoding<<"\" can not be mapped, only raw is supported."<<std::endl;
+		return 0;
+	}
+	if ((dimension!=3 && dimension!=4) || static_cast<int>(sizes.size())!=dimension)
+	{
+		OSG_NOTICE<<"Error: "<<filename<<" is not a 3D volume."<<std::endl;
+		return 0;
+	}
+
+	// a 4D nrrd carries its components on the fastest axis
+	int numberOfComponents = dimension==4 ? sizes[0] : 1;
+	int axis = dimension==4 ? 1 : 0;
+
+	std::string raw_filename = filename;
+	if (!dataFile.empty())
+	{
+		raw_filename = osgDB::concatPaths(osgDB::getFilePath(filename), dataFile);
+		offset = 0;
+	}
+	else if (!attached)
+	{
+		OSG_NOTICE<<"Error: "<<filename<<" has neither attached data nor a data file."<<std::endl;
+		return 0;
+	}
+
+	if (lineSkip>0)
+	{
+		osgDB::ifstream data(raw_filename.c_str(), std::ios::in | std::ios::binary);
+		data.seekg(offset);
+		for(int i=0; i<lineSkip && std::getline(data, line); ++i) {}
+		offset = static_cast<size_t>(data.tellg());
+	}
+
+	bool dataAtEnd = byteSkip<0;
+	if (byteSkip>0) offset += byteSkip;
+
+	osg::Image* image = mapVolume(raw_filename, offset, dataAtEnd,
+								sizes[axis], sizes[axis+1], sizes[axis+2],
+								numberBytesPerComponent, numberOfComponents,
+								dataType, numberBytesPerComponent>1 && needsEndianSwap(endian));
+
+	if (image && static_cast<int>(spacings.size())==dimension)
+	{
+		double xSize = sizes[axis]*(spacings[axis]>0.0 ? spacings[axis] : 1.0);
+		double ySize = sizes[axis+1]*(spacings[axis+1]>0.0 ? spacings[axis+1] : 1.0);
+		double zSize = sizes[axis+2]*(spacings[axis+2]>0.0 ? spacings[axis+2] : 1.0);
+		image->setUserData(new osg::RefMatrix(xSize, 0.0,   0.0,   0.0,
+											0.0,   ySize, 0.0,   0.0,
+											0.0,   0.0,   zSize, 0.0,
+											0.0,   0.0,   0.0,   1.0));
+	}
+
+	return image;
+}
@@ -0,0 +1,65 @@
+#ifndef	__AJ_RAWREADER__
+#define __AJ_RAWREADER__
+
+#include <osg/Image>
+
+#include <string>
+
+// A read-only view of a file mapped into memory. With copyOnWrite the pages
+// can be modified in place without touching the file.
+class MappedFile : public osg::Referenced
+{
+public:
+	static MappedFile* open(const std::string& filename, bool copyOnWrite = false);
+
+	unsigned char* data() const { return _data; }
+	size_t size() const { return _size; }
+
+protected:
+	MappedFile();
+	virtual ~MappedFile();
+
+	unsigned char* _data;
+	size_t _size;
+#ifdef WIN32
+	void* _file;
+	void* _mapping;
+#endif
+};
+
+// An osg::Image whose data points into a MappedFile, which it keeps alive.
+class MappedImage : public osg::Image
+{
+public:
+	MappedImage(MappedFile* file, size_t offset,
+				int s, int t, int r,
+				GLenum pixelFormat, GLenum dataType,
+				GLint internalTextureFormat = 0, int packing = 1);
+
+	MappedFile* getMappedFile() const { return _file.get(); }
+
+	// For data converted in place to another type of the same size.
+	void setDataType(GLenum dataType) { _dataType = dataType; dirty(); }
+
+protected:
+	virtual ~MappedImage() {}
+
+	osg::ref_ptr<MappedFile> _file;
+};
+
+// Maps a headerless volume file; endian is "big" or "little". The pages are
+// copy-on-write, bytes are swapped in place only when endian is not the
+// host's byte order.
+osg::Image* readRaw(int sizeX, int sizeY, int sizeZ, int numberBytesPerComponent, int numberOfComponents,
+					const std::string& endian, const std::string& raw_filename, size_t offset = 0);
+
+// Maps a NRRD volume (.nrrd, or .nhdr with a detached data file). Only the
+// raw encoding can be mapped. Spacings become an osg::RefMatrix in the image's
+// user data, the same place the dicom plugin leaves its matrix.
+osg::Image* readNrrd(const std::string& filename);
+
+// The detached data file the NRRD header filename names, with the header's
+// directory; empty when the data is attached or the header can not be read.
+std::string nrrdDataFile(const std::string& filename);
+
+#endif
@@ -0,0 +1,511 @@
+#include "sliceloader.h"
+#include "volumekernels.h"
+#include "volumeprofile.h"
+
+#include <osg/Notify>
+#include <osg/Timer>
+#include <osg/ImageUtils>
+#include <osgDB/ReadFile>
+#include <osgDB/FileNameUtils>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <deque>
+
+namespace
+{
+
+// Work done for one slice index; called concurrently for different indices.
+class SliceTask
+{
+public:
+	virtual ~SliceTask() {}
+	virtual void operator () (unsigned int i) = 0;
+};
+
+// Pulls the next slice index from a shared counter until the list is exhausted,
+// so fast workers pick up the slack of slow ones.
+class SliceWorker : public OpenThreads::Thread
+{
+public:
+	SliceWorker(SliceTask& task, unsigned int begin, unsigned int end,
+				std::vector<double>& times, OpenThreads::Atomic& next)
+		: _task(task),
+		_begin(begin),
+		_end(end),
+		_times(times),
+		_next(next)
+	{
+	}
+
+	virtual void run()
+	{
+		const osg::Timer* timer = osg::Timer::instance();
+		for(;;)
+		{
+			unsigned int i = _begin + (++_next - 1);
+			if (i >= _end) break;
+
+			osg::Timer_t start = timer->tick();
+			_task(i);
+			_times[i] = timer->delta_m(start, timer->tick());
+		}
+	}
+
+private:
+	SliceTask& _task;
+	unsigned int _begin;
+	unsigned int _end;
+	std::vector<double>& _times;
+	OpenThreads::Atomic& _next;
+};
+
+struct ModulateAlphaByLuminanceOperator
+{
+	inline void luminance(float&) const {}
+	inline void alpha(float&) const {}
+	inline void luminance_alpha(float& l,float& a) const { a*= l; }
+	inline void rgb(float&,float&,float&) const {}
+	inline void rgba(float& r,float& g,float& b,float& a) const { float l = (r+g+b)*0.3333333; a *= l; }
+};
+
+// A decoded slice on its way from a decoder to a packer.
+struct DecodedSlice
+{
+	DecodedSlice() : index(0), time(0.0) {}
+	DecodedSlice(unsigned int i, osg::Image* img, double t) : index(i), image(img), time(t) {}
+
+	unsigned int index;
+	osg::ref_ptr<osg::Image> image;
+	double time;
+};
+
+// Hands decoded slices from the decoders to the packers. push() blocks while
+// the queue is full, so decoding can not run further ahead of packing than
+// the capacity and decoded slices never pile up in memory. pop() returns
+// false once all numItems slices have gone through.
+class SliceQueue
+{
+public:
+	SliceQueue(unsigned int capacity, unsigned int numItems)
+		: _capacity(capacity), _numItems(numItems), _popped(0),
+		_pushWait(0.0), _popWait(0.0) {}
+
+	void push(const DecodedSlice& item)
+	{
+		const osg::Timer* timer = osg::Timer::instance();
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		if (_items.size()>=_capacity)
+		{
+			osg::Timer_t start = timer->tick();
+			while(_items.size()>=_capacity) _notFull.wait(&_mutex);
+			_pushWait += timer->delta_m(start, timer->tick());
+		}
+		_items.push_back(item);
+		_notEmpty.signal();
+	}
+
+	bool pop(DecodedSlice& item)
+	{
+		const osg::Timer* timer = osg::Timer::instance();
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		if (_items.empty() && _popped<_numItems)
+		{
+			osg::Timer_t start = timer->tick();
+			while(_items.empty() && _popped<_numItems) _notEmpty.wait(&_mutex);
+			_popWait += timer->delta_m(start, timer->tick());
+		}
+		if (_items.empty()) return false;
+
+		item = _items.front();
+		_items.pop_front();
+		++_popped;
+		_notFull.signal();
+		// wake the other packers so they see the end of the stream
+		if (_popped==_numItems) _notEmpty.broadcast();
+		return true;
+	}
+
+	// Time spent blocked, in milliseconds: decoders waiting on packing and packers waiting on decoding.
+	double getPushWait() const { return _pushWait; }
+	double getPopWait() const { return _popWait; }
+
+private:
+	OpenThreads::Mutex _mutex;
+	OpenThreads::Condition _notFull;
+	OpenThreads::Condition _notEmpty;
+	std::deque<DecodedSlice> _items;
+	unsigned int _capacity;
+	unsigned int _numItems;
+	unsigned int _popped;
+	double _pushWait;
+	double _popWait;
+};
+
+// The first stage: decodes slices and queues them for packing.
+class DecodeTask : public SliceTask
+{
+public:
+	DecodeTask(const osgDB::DirectoryContents& contents, SliceQueue& queue)
+		: _contents(contents), _queue(queue) {}
+
+	virtual void operator () (unsigned int i)
+	{
+		const osg::Timer* timer = osg::Timer::instance();
+		osg::Timer_t start = timer->tick();
+		osg::Image* slice = osgDB::readImageFile(_contents[i]);
+		osg::Timer_t end = timer->tick();
+		VolumeProfiler::instance()->record("decodeSlice", start, end);
+		_queue.push(DecodedSlice(i, slice, timer->delta_m(start, end)));
+	}
+
+private:
+	const osgDB::DirectoryContents& _contents;
+	SliceQueue& _queue;
+};
+
+// Pixel format osg::colorSpaceConversion turns format into.
+GLenum convertedPixelFormat(osg::ColorSpaceOperation op, GLenum format)
+{
+	if (format!=GL_RGB && format!=GL_BGR) return format;
+	switch(op)
+	{
+		case(osg::MODULATE_ALPHA_BY_LUMINANCE):
+		case(osg::MODULATE_ALPHA_BY_COLOR):
+		case(osg::REPLACE_ALPHA_WITH_LUMINANCE):
+			return GL_RGBA;
+		case(osg::REPLACE_RGB_WITH_LUMINANCE):
+			return GL_LUMINANCE;
+		default:
+			return format;
+	}
+}
+
+// The second stage: writes a decoded slice into its z-plane of the volume,
+// applies the colour space conversion to that plane and takes its range,
+// all while the plane is still in cache.
+class PackTask
+{
+public:
+	PackTask(const osgDB::DirectoryContents& contents, osg::Image* volume, GLenum packFormat, bool modulateAlpha,
+				osg::ColorSpaceOperation colourSpaceOperation, const osg::Vec4& colourModulate,
+				std::vector<float>& sliceMin, std::vector<float>& sliceMax)
+		: _contents(contents), _volume(volume), _packFormat(packFormat), _modulateAlpha(modulateAlpha),
+		_colourSpaceOperation(colourSpaceOperation), _colourModulate(colourModulate), _failed(0),
+		_sliceMin(sliceMin), _sliceMax(sliceMax) {}
+
+	void packSlice(osg::Image* slice, unsigned int r)
+	{
+		ProfileScope scope("packSlice");
+		if (!slice)
+		{
+			OSG_NOTICE<<"Unable to read slice "<<_contents[r]<<", leaving it empty."<<std::endl;
+			memset(_volume->data(0,0,r), 0, _volume->getImageSizeInBytes());
+			_sliceMin[r] = 0.0f;
+			_sliceMax[r] = 0.0f;
+			++_failed;
+			return;
+		}
+
+		if (slice->s()>_volume->s() || slice->t()>_volume->t())
+		{
+			slice->scaleImage(std::min(slice->s(), _volume->s()), std::min(slice->t(), _volume->t()), 1);
+		}
+
+		// a view of just this plane, so nothing touches slices owned by other packers
+		osg::ref_ptr<osg::Image> plane = new osg::Image;
+		plane->setImage(_volume->s(), _volume->t(), 1,
+						_volume->getInternalTextureFormat(), _volume->getPixelFormat(), _volume->getDataType(),
+						_volume->data(0,0,r), osg::Image::NO_DELETE, _volume->getPacking());
+
+		// a conversion that changes the format needs the plane in the packed format first
+		osg::ref_ptr<osg::Image> packed = plane;
+		if (_packFormat!=_volume->getPixelFormat())
+		{
+			packed = new osg::Image;
+			packed->allocateImage(_volume->s(), _volume->t(), 1, _packFormat, _volume->getDataType());
+		}
+
+		if (slice->s()<_volume->s() || slice->t()<_volume->t())
+		{
+			memset(packed->data(), 0, packed->getImageSizeInBytes());
+		}
+
+		osg::copyImage(slice, 0, 0, 0, slice->s(), slice->t(), 1, packed.get(), 0, 0, 0, false);
+
+		if (_modulateAlpha)
+		{
+			osg::modifyImage(packed.get(), ModulateAlphaByLuminanceOperator());
+		}
+
+		if (_colourSpaceOperation!=osg::NO_COLOR_SPACE_OPERATION)
+		{
+			osg::ref_ptr<osg::Image> converted = osg::colorSpaceConversion(_colourSpaceOperation, packed.get(), _colourModulate);
+			if (converted!=plane)
+			{
+				osg::copyImage(converted.get(), 0, 0, 0, converted->s(), converted->t(), 1, plane.get(), 0, 0, 0, false);
+			}
+		}
+
+		float minValue = FLT_MAX, maxValue = -FLT_MAX;
+		accumulateRange(plane->data(), plane->getImageSizeInBytes(), plane->getDataType(), minValue, maxValue);
+		_sliceMin[r] = minValue;
+		_sliceMax[r] = maxValue;
+	}
+
+	unsigned int getNumFailed() const { return _failed; }
+
+private:
+	const osgDB::DirectoryContents& _contents;
+	osg::Image* _volume;
+	GLenum _packFormat;
+	bool _modulateAlpha;
+	osg::ColorSpaceOperation _colourSpaceOperation;
+	osg::Vec4 _colourModulate;
+	OpenThreads::Atomic _failed;
+	std::vector<float>& _sliceMin;
+	std::vector<float>& _sliceMax;
+};
+
+// Drains the queue into the volume; run on the calling thread and on any extra packer threads.
+void packSlices(SliceQueue& queue, PackTask& task, std::vector<double>& times)
+{
+	DecodedSlice item;
+	while(queue.pop(item))
+	{
+		times[item.index] = item.time;
+		task.packSlice(item.image.get(), item.index);
+		item.image = 0;
+	}
+}
+
+class PackWorker : public OpenThreads::Thread
+{
+public:
+	PackWorker(SliceQueue& queue, PackTask& task, std::vector<double>& times)
+		: _queue(queue), _task(task), _times(times) {}
+
+	virtual void run() { packSlices(_queue, _task, _times); }
+
+private:
+	SliceQueue& _queue;
+	PackTask& _task;
+	std::vector<double>& _times;
+};
+
+// True for an 8-bit colour image whose channels all match, opaque where it has alpha.
+bool isGrey(const osg::Image* image)
+{
+	if (!image || image->getDataType()!=GL_UNSIGNED_BYTE) return false;
+	GLenum pixelFormat = image->getPixelFormat();
+	if (pixelFormat!=GL_RGB && pixelFormat!=GL_BGR && pixelFormat!=GL_RGBA && pixelFormat!=GL_BGRA) return false;
+
+	unsigned int numComponents = osg::Image::computeNumComponents(pixelFormat);
+	for (int r = 0; r < image->r(); ++r)
+	{
+		for (int t = 0; t < image->t(); ++t)
+		{
+			const unsigned char* pixel = image->data(0, t, r);
+			for (int s = 0; s < image->s(); ++s, pixel += numComponents)
+			{
+				if (pixel[0]!=pixel[1] || pixel[0]!=pixel[2]) return false;
+				if (numComponents==4 && pixel[3]!=255) return false;
+			}
+		}
+	}
+	return true;
+}
+
+int clampTextureSize(int size, int maximumTextureSize, bool resizeToPowerOfTwo)
+{
+	if (resizeToPowerOfTwo)
+	{
+		int nearestPowerOfTwo = 1;
+		while(nearestPowerOfTwo<size && nearestPowerOfTwo<maximumTextureSize) nearestPowerOfTwo*=2;
+		return nearestPowerOfTwo;
+	}
+	return std::min(size, maximumTextureSize);
+}
+
+}
+
+SliceLoader::SliceLoader(unsigned int numThreads)
+	: _numThreads(numThreads),
+	_numPackers(1),
+	_totalTime(0.0),
+	_decodeWait(0.0),
+	_packWait(0.0),
+	_padded(false)
+{
+	if (_numThreads == 0) _numThreads = OpenThreads::GetNumberOfProcessors();
+	if (_numThreads == 0) _numThreads = 1;
+
+	// packing is a copy and a few vectorised passes, a fraction of the decode cost
+	_numPackers = std::max(1u, _numThreads/4);
+}
+
+osg::Image* SliceLoader::loadVolume(const osgDB::DirectoryContents& allContents,
+									unsigned int numComponentsDesired,
+									int s_maximumTextureSize,
+									int t_maximumTextureSize,
+									int r_maximumTextureSize,
+									bool resizeToPowerOfTwo,
+									osg::ColorSpaceOperation colourSpaceOperation,
+									const osg::Vec4& colourModulate)
+{
+	const osg::Timer* timer = osg::Timer::instance();
+	osg::Timer_t start = timer->tick();
+	_sliceTimes.clear();
+	_totalTime = 0.0;
+	_decodeWait = 0.0;
+	_packWait = 0.0;
+
+	// the first readable slice fixes the volume's size and format
+	osg::ref_ptr<osg::Image> first;
+	unsigned int firstIndex = 0;
+	for (; firstIndex < allContents.size() && !first; ++firstIndex)
+	{
+		first = osgDB::readImageFile(allContents[firstIndex]);
+	}
+	if (!first) return 0;
+
+	// stray files in the stack directory (thumbnails, notes) would otherwise become empty slices
+	osgDB::DirectoryContents contents;
+	contents.push_back(allContents[firstIndex-1]);
+	std::string extension = osgDB::getLowerCaseFileExtension(contents.front());
+	for (unsigned int i = firstIndex; i < allContents.size(); ++i)
+	{
+		if (osgDB::getLowerCaseFileExtension(allContents[i]) == extension) contents.push_back(allContents[i]);
+	}
+
+	GLenum pixelFormat = first->getPixelFormat();
+	bool modulateAlpha = false;
+	switch(numComponentsDesired)
+	{
+		case(0) :
+			// grey scans saved as colour (palette BMPs) are packed as the one channel they carry
+			if (colourSpaceOperation==osg::NO_COLOR_SPACE_OPERATION && isGrey(first.get()) &&
+				(contents.size()<3 || isGrey(osg::ref_ptr<osg::Image>(osgDB::readImageFile(contents[contents.size()/2])).get())))
+			{
+				pixelFormat = GL_LUMINANCE;
+			}
+			else if (osg::Image::computeNumComponents(pixelFormat)==3)
+			{
+				pixelFormat = GL_RGBA;
+				modulateAlpha = true;
+			}
+			break;
+		case(1) : pixelFormat = GL_LUMINANCE; break;
+		case(2) : pixelFormat = GL_LUMINANCE_ALPHA; break;
+		case(3) : pixelFormat = GL_RGB; break;
+		case(4) : pixelFormat = GL_RGBA; break;
+	}
+
+	int sizeS = clampTextureSize(first->s(), s_maximumTextureSize, resizeToPowerOfTwo);
+	int sizeT = clampTextureSize(first->t(), t_maximumTextureSize, resizeToPowerOfTwo);
+	int sizeR = clampTextureSize(contents.size(), r_maximumTextureSize, resizeToPowerOfTwo);
+	unsigned int numSlices = std::min<unsigned int>(contents.size(), sizeR);
+
+	GLenum volumeFormat = convertedPixelFormat(colourSpaceOperation, pixelFormat);
+
+	osg::ref_ptr<osg::Image> volume = new osg::Image;
+	volume->allocateImage(sizeS, sizeT, sizeR, volumeFormat, GL_UNSIGNED_BYTE);
+	if (!volume->data()) return 0;
+
+	OSG_NOTICE<<"Assembling "<<numSlices<<" slices of "<<first->s()<<"x"<<first->t()<<" into a "
+		<<sizeS<<"x"<<sizeT<<"x"<<sizeR<<" volume, pixelFormat=0x"<<std::hex<<volumeFormat<<std::dec<<std::endl;
+
+	if (numSlices<(unsigned int)sizeR)
+	{
+		// power of two padding
+		size_t padding = (size_t)volume->getImageSizeInBytes()*(sizeR-numSlices);
+		memset(volume->data(0,0,numSlices), 0, padding);
+	}
+
+	_padded = numSlices<(unsigned int)sizeR;
+	_sliceTimes.assign(numSlices, 0.0);
+	_sliceMin.assign(numSlices, FLT_MAX);
+	_sliceMax.assign(numSlices, -FLT_MAX);
+
+	// decoders feed packers through a bounded queue, so packing, conversion and
+	// the range pass overlap decoding instead of running as passes after it
+	PackTask task(contents, volume.get(), pixelFormat, modulateAlpha, colourSpaceOperation, colourModulate, _sliceMin, _sliceMax);
+	SliceQueue queue(2*_numThreads, numSlices-1);
+	DecodeTask decode(contents, queue);
+
+	OpenThreads::Atomic next(0);
+	std::vector<double> workerTimes(numSlices, 0.0);
+	unsigned int numDecoders = std::min<unsigned int>(_numThreads, numSlices-1);
+	std::vector<OpenThreads::Thread*> threads;
+	for (unsigned int i = 0; i < numDecoders; ++i)
+	{
+		threads.push_back(new SliceWorker(decode, 1, numSlices, workerTimes, next));
+		threads.back()->start();
+	}
+	for (unsigned int i = 1; i < _numPackers && numDecoders>0; ++i)
+	{
+		threads.push_back(new PackWorker(queue, task, _sliceTimes));
+		threads.back()->start();
+	}
+
+	task.packSlice(first.get(), 0);
+	first = 0;
+	_sliceTimes[0] = timer->delta_m(start, timer->tick());
+	packSlices(queue, task, _sliceTimes);
+
+	for (unsigned int i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->join();
+		delete threads[i];
+	}
+
+	_totalTime = timer->delta_m(start, timer->tick());
+	_decodeWait = queue.getPushWait();
+	_packWait = queue.getPopWait();
+
+	if (task.getNumFailed()==numSlices) return 0;
+	return volume.release();
+}
+
+bool SliceLoader::getRange(float& minValue, float& maxValue) const
+{
+	if (_sliceMin.empty()) return false;
+
+	minValue = _padded ? 0.0f : FLT_MAX;
+	maxValue = _padded ? 0.0f : -FLT_MAX;
+	for (unsigned int i = 0; i < _sliceMin.size(); ++i)
+	{
+		minValue = std::min(minValue, _sliceMin[i]);
+		maxValue = std::max(maxValue, _sliceMax[i]);
+	}
+	return minValue<=maxValue;
+}
+
+void SliceLoader::report() const
+{
+	if (_sliceTimes.empty()) return;
+
+	double sum = 0.0;
+	double slowest = 0.0;
+	for (unsigned int i = 0; i < _sliceTimes.size(); ++i)
+	{
+		sum += _sliceTimes[i];
+		slowest = std::max(slowest, _sliceTimes[i]);
+	}
+
+	OSG_NOTICE<<"Decoded "<<_sliceTimes.size()<<" slices on "<<_numThreads<<" threads in "<<_totalTime<<"ms"
+		<<" (per slice: mean "<<sum/_sliceTimes.size()<<"ms, max "<<slowest<<"ms)"<<std::endl;
+
+	if (_decodeWait>0.0 || _packWait>0.0)
+	{
+		// whichever side waits longer is the faster stage
+		OSG_NOTICE<<"Pipeline stalls: decoders waited "<<_decodeWait<<"ms on packing, packers waited "<<_packWait<<"ms on decoding"<<std::endl;
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef	__AJ_SLICELOADER__
+#define __AJ_SLICELOADER__
+
+#include <osg/Image>
+#include <osg/ImageUtils>
+#include <osgDB/FileUtils>
+
+#include <vector>
+
+// Decodes the slices of an image stack on a pool of worker threads.
+// Slices come back in the order of the file list, whatever order the
+// workers finish them in.
+class SliceLoader
+{
+public:
+	// numThreads == 0 sizes the pool to the number of cores.
+	SliceLoader(unsigned int numThreads = 0);
+
+	// Assembles the stack straight into a single 3D image, allocated once from
+	// the dimensions of the first readable slice. Follows the sizing and format
+	// rules of createTexture3D: numComponentsDesired == 0 keeps the slice
+	// format (RGB gains an alpha modulated by luminance), otherwise 1-4 picks
+	// L, LA, RGB or RGBA.
+	//
+	// Runs as a pipeline: the decoder threads hand slices through a bounded
+	// queue to the packers, which copy each one into its z-plane, apply
+	// colourSpaceOperation and take its range before releasing it. Only a
+	// queue's worth of 2D images ever coexists with the volume.
+	osg::Image* loadVolume(const osgDB::DirectoryContents& contents,
+						unsigned int numComponentsDesired,
+						int s_maximumTextureSize,
+						int t_maximumTextureSize,
+						int r_maximumTextureSize,
+						bool resizeToPowerOfTwo,
+						osg::ColorSpaceOperation colourSpaceOperation = osg::NO_COLOR_SPACE_OPERATION,
+						const osg::Vec4& colourModulate = osg::Vec4(1.0f,1.0f,1.0f,1.0f));
+
+	unsigned int getNumThreads() const { return _numThreads; }
+
+	// Range over all components of the last loadVolume(), after the colour
+	// space conversion. Normalised as osg::computeMinMax.
+	bool getRange(float& minValue, float& maxValue) const;
+
+	// Timings of the last loadVolume(), in milliseconds.
+	double getTotalTime() const { return _totalTime; }
+	const std::vector<double>& getSliceTimes() const { return _sliceTimes; }
+
+	void report() const;
+
+private:
+	unsigned int _numThreads;
+	unsigned int _numPackers;
+	double _totalTime;
+	double _decodeWait;
+	double _packWait;
+	std::vector<double> _sliceTimes;
+	std::vector<float> _sliceMin;
+	std::vector<float> _sliceMax;
+	bool _padded;
+};
+
+#endif
@@ -9,11 +9,18 @@ class transferFunction(object):
 		self.key = [0, 1]
 		self.array.update({0: [0, 0, 0, 0]})
 		self.array.update({1: [1, 1, 1, 1]})
-		self.volume.clearTransferFunction()
-		self.volume.addTransferPoint(0, 0, 0, 0, 0);
-		self.volume.addTransferPoint(1, 1, 1, 1, 1);
+		self.send()
 		self.reDrawLine()
 		
+	# the whole table goes over in one batch, the volume uploads it once
+	def send(self):
+		self.volume.beginTransferFunction()
+		self.volume.clearTransferFunction()
+		for value in self.key:
+			[r, g, b, a] = self.array[value]
+			self.volume.addTransferPoint(value, r, g, b, a)
+		self.volume.commitTransferFunction()
+		
 	def update( self, intensity, r, g, b, a ):
 		
 		if (not intensity in self.key) :
@@ -57,6 +64,7 @@ class transferFunction(object):
 			rkey = self.getClosest(intensity)
 			self.key.remove(rkey)
 			del self.array[rkey]
+			self.send()
 	def show(self):
 		print self.array
 	def reDrawLine(self):
@@ -88,6 +96,62 @@ class transferFunction(object):
 				line.setThickness(self.width/2)
 				left = right
 		
+	# the histogram of the volume under the function, log scaled, once it is loaded
+	def drawHistogram(self):
+		bins = self.volume.getHistogramBins()
+		if (bins == 0): return False
+		for line in self.histogramList:
+			line.setThickness(0)
+		counts = [self.volume.getHistogramCount(i) for i in range(0, bins)]
+		top = log(1 + 10000 * max(counts))
+		if (top == 0): return False
+		for i in range(0, bins):
+			if (counts[i] == 0): continue
+			x = self.volume.getHistogramValue(i) * self.size[0]
+			if (i < len(self.histogramList)):
+				line = self.histogramList[i]
+			else:
+				line = self.histogram.addLine()
+				self.histogramList.append(line)
+			line.setStart(Vector3(x, 0, 0))
+			line.setEnd(Vector3(x, log(1 + 10000 * counts[i]) / top * self.size[1], 0))
+			line.setThickness(self.size[0] / bins)
+		return True
+		
+	# points where the mean gradient of the values peaks, the boundaries
+	# between materials, each a tent of colour along a ramp from red to blue
+	def suggest(self, count=3, alpha=0.5):
+		bins = self.volume.getHistogramBins()
+		if (bins == 0): return False
+		# bins with next to no voxels have noisy means
+		gradient = []
+		for i in range(0, bins):
+			if (self.volume.getHistogramCount(i) < 0.0001): gradient.append(0)
+			else: gradient.append(self.volume.getHistogramGradient(i))
+		smooth = [(gradient[max(i-1, 0)] + gradient[i] + gradient[min(i+1, bins-1)]) / 3 for i in range(0, bins)]
+		peaks = []
+		for i in range(1, bins-1):
+			if (smooth[i] > smooth[i-1] and smooth[i] >= smooth[i+1]):
+				peaks.append((smooth[i], i))
+		peaks = sorted(sorted(peaks, reverse=True)[0:count], key=lambda peak: peak[1])
+		
+		self.key = [0, 1]
+		self.array = {0: [0, 0, 0, 0], 1: [0, 0, 0, 0]}
+		width = max(bins / 64, 1)
+		for n in range(0, len(peaks)):
+			i = peaks[n][1]
+			t = float(n) / max(len(peaks)-1, 1)
+			[r, g, b] = [1 - t, 1 - abs(2*t - 1), t]
+			for (bin, a) in [(i - width, 0), (i, alpha), (i + width, 0)]:
+				value = self.volume.getHistogramValue(min(max(bin, 0), bins-1))
+				if (value <= 0 or value >= 1 or value in self.key): continue
+				self.key.append(value)
+				self.array.update({value: [r, g, b, a]})
+		self.key = sorted(self.key)
+		self.send()
+		self.reDrawLine()
+		return True
+		
 	def setPosition(self, x, y, z):
 		self.root.setPosition(Vector3(x, y, z))
 	def __init__(self, volume, x, y, z, width, height, lw):
@@ -103,6 +167,10 @@ class transferFunction(object):
 		self.sphereNode = SceneNode.create('sphereRoot')
 		self.root.addChild(self.sphereNode)
 		self.root.addChild(self.line)
+		self.histogram = LineSet.create()
+		self.histogramList = []
+		self.root.addChild(self.histogram)
+		self.histogram.setEffect('colored -e #80808080 -t')
 		self.line.setEffect('colored -e white')
 		line = self.line.addLine()
 		line.setStart(Vector3(0, 0, 0))
@@ -0,0 +1,250 @@
+// Renders a volume with VolumeRayCaster along a camera path and reports the
+// time per frame, so rendering performance can be tracked on machines
+// without a display.
+//
+//   volumebench <volume> [--mode standard|light|isosurface|mip] [--size <w> <h>]
+//       [--frames <n>] [--threads <n>] [--sampleDensity <d>] [--alpha <a>]
+//       [--transparency <t>] [--isoValue <v>] [--path <file>] [--output <image>]
+//       [--raw <x> <y> <z> <bytesPerComponent> <components> <endian>] [--quantize <bits>] [--cache]
+//       [--clipPlane <px> <py> <pz> <nx> <ny> <nz>]... [--clipBox <x0> <y0> <z0> <x1> <y1> <z1>]
+//       [--earlyTermination <opacity>] [--gradients] [--histogram]
+//
+// Without --path the camera orbits the volume once over the frames. A path
+// file holds one camera a line: eye, centre and up, nine numbers. Clip planes
+// and boxes are in the unit cube of the volume, as myOsgVolume takes them.
+//
+// With --cache the volume goes through VolumeCache as myOsgVolume loads it;
+// several volumebench --cache --frames 0 started together on a shared
+// MYVOLUME_CACHE_DIR should show one load and the rest mapping its entry.
+//
+// With --gradients the lit modes read normals worked out once after the load,
+// as myOsgVolume's tiles do with MYVOLUME_GRADIENTS; the time it took is shown.
+// With --histogram the histogram every load works out is timed as well.
+
+#include "volumecache.h"
+#include "volumeclip.h"
+#include "volumedata.h"
+#include "volumegradients.h"
+#include "volumehistogram.h"
+#include "volumeoccupancy.h"
+#include "volumeraycaster.h"
+
+#include <osg/ArgumentParser>
+#include <osg/BoundingSphere>
+#include <osg/Math>
+#include <osg/Timer>
+#include <osg/TransferFunction>
+#include <osgDB/WriteFile>
+#include <osgDB/fstream>
+#include <osgVolume/Layer>
+#include <osgVolume/Locator>
+#include <osgVolume/Property>
+
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+#include <cfloat>
+#include <iostream>
+#include <vector>
+
+struct CameraPose
+{
+	osg::Vec3 eye;
+	osg::Vec3 centre;
+	osg::Vec3 up;
+};
+
+static bool readPath(const std::string& filename, std::vector<CameraPose>& path)
+{
+	osgDB::ifstream in(filename.c_str());
+	if (!in) return false;
+
+	CameraPose pose;
+	while(in >> pose.eye.x() >> pose.eye.y() >> pose.eye.z()
+			>> pose.centre.x() >> pose.centre.y() >> pose.centre.z()
+			>> pose.up.x() >> pose.up.y() >> pose.up.z())
+	{
+		path.push_back(pose);
+	}
+	return !path.empty();
+}
+
+static void orbit(const osg::BoundingSphere& bound, unsigned int numFrames, std::vector<CameraPose>& path)
+{
+	for (unsigned int i = 0; i < numFrames; ++i)
+	{
+		float angle = 2.0f*osg::PI*i/numFrames;
+		CameraPose pose;
+		pose.centre = bound.center();
+		pose.eye = bound.center() + osg::Vec3(sinf(angle), -cosf(angle), 0.3f)*(bound.radius()*2.5f);
+		pose.up.set(0.0f, 0.0f, 1.0f);
+		path.push_back(pose);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	osg::ArgumentParser arguments(&argc, argv);
+
+	VolumeOptions options;
+	options.rescaleOperation = RESCALE_TO_ZERO_TO_ONE_RANGE;
+	while(arguments.read("--raw", options.rawSizeX, options.rawSizeY, options.rawSizeZ, options.rawBytesPerComponent, options.rawComponents, options.rawEndian)) {}
+	while(arguments.read("--quantize", options.quantizeBits)) {}
+
+	std::string mode = "standard";
+	while(arguments.read("--mode", mode)) {}
+	int width = 512, height = 512;
+	while(arguments.read("--size", width, height)) {}
+	unsigned int numFrames = 36;
+	while(arguments.read("--frames", numFrames)) {}
+	unsigned int numThreads = OpenThreads::GetNumberOfProcessors();
+	while(arguments.read("--threads", numThreads)) {}
+	float sampleDensity = 0.005f, alpha = 0.02f, transparency = 1.0f, isoValue = 0.5f, earlyTermination = 0.98f;
+	while(arguments.read("--sampleDensity", sampleDensity)) {}
+	while(arguments.read("--alpha", alpha)) {}
+	while(arguments.read("--transparency", transparency)) {}
+	while(arguments.read("--isoValue", isoValue)) {}
+	while(arguments.read("--earlyTermination", earlyTermination)) {}
+	std::string pathFile, outputFile;
+	while(arguments.read("--path", pathFile)) {}
+	while(arguments.read("--output", outputFile)) {}
+	bool useCache = false;
+	while(arguments.read("--cache")) useCache = true;
+	bool useGradients = false;
+	while(arguments.read("--gradients")) useGradients = true;
+	bool useHistogram = false;
+	while(arguments.read("--histogram")) useHistogram = true;
+	osg::ref_ptr<VolumeClipping> clipping = new VolumeClipping;
+	osg::Vec3 point, normal;
+	for (unsigned int i = 0; arguments.read("--clipPlane", point.x(), point.y(), point.z(), normal.x(), normal.y(), normal.z()); ++i)
+	{
+		clipping->setPlane(i, point, normal);
+	}
+	osg::Vec3 boxMin, boxMax;
+	while(arguments.read("--clipBox", boxMin.x(), boxMin.y(), boxMin.z(), boxMax.x(), boxMax.y(), boxMax.z()))
+	{
+		clipping->setBox(boxMatrix(osg::BoundingBox(boxMin, boxMax)));
+	}
+
+	if (arguments.argc()<2)
+	{
+		std::cout << "usage: volumebench <volume> [--mode standard|light|isosurface|mip] [--size w h] [--frames n] [--threads n]" << std::endl;
+		std::cout << "       [--sampleDensity d] [--alpha a] [--transparency t] [--isoValue v] [--path file] [--output image]" << std::endl;
+		std::cout << "       [--raw x y z bytesPerComponent components endian] [--quantize bits] [--cache]" << std::endl;
+		std::cout << "       [--clipPlane px py pz nx ny nz]... [--clipBox x0 y0 z0 x1 y1 z1] [--earlyTermination opacity]" << std::endl;
+		std::cout << "       [--gradients] [--histogram]" << std::endl;
+		return 1;
+	}
+
+	osg::Timer_t startLoad = osg::Timer::instance()->tick();
+	osg::ref_ptr<VolumeData> data;
+	if (useCache)
+	{
+		VolumeCache cache(arguments[1], options);
+		data = cache.readOrClaim();
+		if (!data)
+		{
+			data = loadVolumeData(arguments[1], options);
+			if (data.valid() && cache.write(data.get())) std::cout << "wrote " << cache.getFileName() << std::endl;
+		}
+	}
+	else data = loadVolumeData(arguments[1], options);
+	if (!data.valid() || !data->image.valid())
+	{
+		std::cout << "volumebench: could not load " << arguments[1] << std::endl;
+		return 1;
+	}
+	osg::Image* image = data->image.get();
+	std::cout << "loaded " << image->s() << "x" << image->t() << "x" << image->r() << ", " << image->getTotalSizeInBytes()/(1024*1024) << "MB in "
+			<< osg::Timer::instance()->delta_m(startLoad, osg::Timer::instance()->tick()) << " ms" << std::endl;
+	if (numFrames==0 && pathFile.empty()) return 0;
+
+	// the layer and properties myOsgVolume gives a tile, for the one mode asked for
+	osg::Matrix matrix = data->matrix.valid() ? osg::Matrix(*data->matrix) : osg::Matrix::scale(image->s(), image->t(), image->r());
+	osg::ref_ptr<osgVolume::ImageLayer> layer = new osgVolume::ImageLayer(image);
+	layer->setLocator(new osgVolume::Locator(matrix));
+	layer->setTexelOffset(data->texelOffset);
+	layer->setTexelScale(data->texelScale);
+
+	osg::ref_ptr<osg::TransferFunction1D> tf = new osg::TransferFunction1D;
+	tf->setColor(0.0, osg::Vec4(1.0,1.0,1.0,0.0));
+	tf->setColor(1.0, osg::Vec4(1.0,1.0,1.0,1.0));
+
+	osg::ref_ptr<osgVolume::CompositeProperty> cp = new osgVolume::CompositeProperty;
+	cp->addProperty(new osgVolume::SampleDensityProperty(sampleDensity));
+	cp->addProperty(new osgVolume::TransparencyProperty(transparency));
+	cp->addProperty(new osgVolume::TransferFunctionProperty(tf.get()));
+	if (mode=="isosurface") cp->addProperty(new osgVolume::IsoSurfaceProperty(isoValue));
+	else cp->addProperty(new osgVolume::AlphaFuncProperty(alpha));
+	if (mode=="light") cp->addProperty(new osgVolume::LightingProperty);
+	if (mode=="mip") cp->addProperty(new osgVolume::MaximumIntensityProjectionProperty);
+	layer->addProperty(cp.get());
+
+	osg::ref_ptr<VolumeRayCaster> caster = new VolumeRayCaster(layer.get(), matrix);
+	caster->setNumThreads(numThreads);
+	caster->setEarlyTermination(earlyTermination);
+	if (data->texelScale[3]!=0.0f) caster->setMaximumValue(maximumValueThreshold(data->image.get(), (data->maxValue[3] - data->texelOffset[3]) / data->texelScale[3]));
+	clipping->setVolumeMatrix(matrix);
+	if (clipping->isEnabled()) caster->setClipping(clipping.get());
+	if (useGradients)
+	{
+		osg::Timer_t startGradients = osg::Timer::instance()->tick();
+		osg::ref_ptr<osg::Image> gradients = computeGradients(image, numThreads);
+		std::cout << "gradients in " << osg::Timer::instance()->delta_m(startGradients, osg::Timer::instance()->tick()) << " ms" << std::endl;
+		caster->setGradients(gradients.get());
+	}
+	if (useHistogram)
+	{
+		osg::Timer_t startHistogram = osg::Timer::instance()->tick();
+		osg::ref_ptr<VolumeHistogram> histogram = new VolumeHistogram(image, 256, 64, 0.0f, 0.0f, osg::BoundingBox(0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f), numThreads);
+		std::cout << "histogram in " << osg::Timer::instance()->delta_m(startHistogram, osg::Timer::instance()->tick()) << " ms: "
+				<< histogram->getMinimum() << " to " << histogram->getMaximum() << ", mean " << histogram->getMean()
+				<< ", deviation " << histogram->getDeviation() << ", median " << histogram->getPercentile(0.5f) << std::endl;
+	}
+
+	std::vector<CameraPose> path;
+	if (!pathFile.empty() && !readPath(pathFile, path))
+	{
+		std::cout << "volumebench: could not read a camera path from " << pathFile << std::endl;
+		return 1;
+	}
+	osg::BoundingSphere bound(osg::Vec3(0.5f, 0.5f, 0.5f)*matrix, (osg::Vec3(1.0f, 1.0f, 1.0f)*matrix - osg::Vec3(0.0f, 0.0f, 0.0f)*matrix).length()*0.5f);
+	if (path.empty()) orbit(bound, std::max(1u, numFrames), path);
+
+	osg::ref_ptr<osg::Image> frame = new osg::Image;
+	frame->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+
+	double totalTime = 0.0, minTime = DBL_MAX, maxTime = 0.0;
+	unsigned long long totalRays = 0, totalSamples = 0;
+	for (unsigned int i = 0; i < path.size(); ++i)
+	{
+		float distance = (path[i].eye - path[i].centre).length();
+		osg::Matrix view = osg::Matrix::lookAt(path[i].eye, path[i].centre, path[i].up);
+		osg::Matrix projection = osg::Matrix::perspective(30.0, double(width)/double(height),
+														std::max(distance - bound.radius()*2.0f, distance*0.01f),
+														distance + bound.radius()*2.0f);
+
+		osg::Timer_t start = osg::Timer::instance()->tick();
+		caster->render(view, projection, frame.get());
+		double time = osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick());
+
+		totalTime += time;
+		minTime = std::min(minTime, time);
+		maxTime = std::max(maxTime, time);
+		totalRays += caster->getNumRays();
+		totalSamples += caster->getNumSamples();
+	}
+
+	const char* modeNames[] = { "standard", "light", "isosurface", "mip" };
+	std::cout << "mode " << modeNames[caster->getMode()] << ", " << width << "x" << height << ", "
+			<< path.size() << " frames, " << caster->getNumThreads() << " threads" << std::endl;
+	std::cout << "ms/frame: mean " << totalTime/path.size() << " min " << minTime << " max " << maxTime << std::endl;
+	std::cout << "Mrays/s: " << totalRays/(totalTime*1000.0) << ", Msamples/s: " << totalSamples/(totalTime*1000.0) << std::endl;
+	std::cout << "samples/ray: " << (totalRays>0 ? double(totalSamples)/totalRays : 0.0) << std::endl;
+
+	if (!outputFile.empty() && !osgDB::writeImageFile(*frame, outputFile))
+	{
+		std::cout << "volumebench: could not write " << outputFile << std::endl;
+	}
+	return 0;
+}
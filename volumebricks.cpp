@@ -0,0 +1,486 @@
+#include "volumebricks.h"
+#include "volumecompress.h"
+#include "volumeoccupancy.h"
+#include "volumeprofile.h"
+#include "volumetechnique.h"
+
+#include <osg/Notify>
+#include <osg/BoundingBox>
+#include <osg/BoundingSphere>
+#include <osgVolume/VolumeTile>
+#include <osgVolume/Layer>
+#include <osgVolume/Locator>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+struct Brick : public osg::Referenced
+{
+	enum State
+	{
+		EMPTY,
+		QUEUED,
+		RESIDENT
+	};
+
+	Brick() : s0(0), t0(0), r0(0), s(0), t(0), r(0), cs0(0), ct0(0), cr0(0), cs(0), ct(0), cr(0), bytes(0), empty(false), state(EMPTY), requested(0), lastUsed(0) {}
+
+	// voxel origin and size within the source
+	int s0, t0, r0;
+	int s, t, r;
+	// the voxels copied: the brick and one more either side within the
+	// source, so filtering up to its faces reads the neighbours' voxels as a
+	// single texture would
+	int cs0, ct0, cr0;
+	int cs, ct, cr;
+	size_t bytes;
+
+	// the part of the brick that can be seen under the transfer function,
+	// within the unit cube of the whole image
+	osg::BoundingBox occupied;
+	bool empty;
+	// the proxy box within the unit cube of the whole volume as drawn, for the clipping
+	osg::BoundingBox bounds;
+
+	// a compressed copy kept once the brick was first paged in, if compression is on;
+	// only touched by the pager
+	osg::ref_ptr<CompressedVoxels> compressed;
+
+	// always in the scene graph, so culling sees the brick; holds the tile when resident
+	osg::ref_ptr<osg::Group> node;
+	osg::ref_ptr<osgVolume::VolumeTile> tile;
+
+	// only touched by the update thread
+	State state;
+
+	// set by the cull traversal, cleared by update()
+	OpenThreads::Atomic requested;
+	unsigned int lastUsed;
+};
+
+namespace
+{
+
+// Flags the brick as wanted whenever culling lets its node through and the
+// clipping leaves some of it, so a brick cut away is neither drawn nor paged in.
+class BrickCullCallback : public osg::NodeCallback
+{
+public:
+	BrickCullCallback(Brick* brick, const VolumeClipping* clipping) : _brick(brick), _clipping(clipping) {}
+
+	virtual void operator () (osg::Node* node, osg::NodeVisitor* nv)
+	{
+		if (!_brick) return;
+		if (_clipping.valid() && _clipping->clipsAway(_brick->bounds)) return;
+		_brick->requested.exchange(1);
+		traverse(node, nv);
+	}
+
+	// the brick owns the node, and so this callback
+	void release() { _brick = 0; }
+
+private:
+	Brick* _brick;
+	osg::ref_ptr<const VolumeClipping> _clipping;
+};
+
+osg::Image* copyBrick(const osg::Image* source, const Brick* brick)
+{
+	ProfileScope scope("copyBrick");
+	osg::ref_ptr<osg::Image> image = new osg::Image;
+	image->allocateImage(brick->cs, brick->ct, brick->cr, source->getPixelFormat(), source->getDataType(), 1);
+	if (!image->data()) return 0;
+	image->setInternalTextureFormat(source->getInternalTextureFormat());
+
+	// row by row: faulting the pages of a mapped source in happens here, off the render thread
+	size_t rowBytes = (size_t)brick->cs*image->getPixelSizeInBits()/8;
+	for (int r = 0; r < brick->cr; ++r)
+	{
+		for (int t = 0; t < brick->ct; ++t)
+		{
+			memcpy(image->data(0,t,r), source->data(brick->cs0, brick->ct0+t, brick->cr0+r), rowBytes);
+		}
+	}
+	return image.release();
+}
+
+}
+
+// Copies bricks out of the source on its own thread, in the order update() asks for them.
+// With compression on, a brick paged in again is decompressed from the copy
+// kept the first time rather than read from the source.
+class BrickPager : public OpenThreads::Thread
+{
+public:
+	struct Loaded
+	{
+		osg::ref_ptr<Brick> brick;
+		osg::ref_ptr<osg::Image> image;
+	};
+
+	BrickPager(osg::Image* source) : _source(source), _compress(false), _compressedBytes(0), _quit(false) {}
+
+	~BrickPager()
+	{
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+			_quit = true;
+			_requested.signal();
+		}
+		join();
+	}
+
+	void add(Brick* brick)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		_queue.push_back(brick);
+		_requested.signal();
+	}
+
+	void setCompression(bool compress)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		_compress = compress;
+	}
+
+	size_t getCompressedBytes()
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		return _compressedBytes;
+	}
+
+	void takeLoaded(std::vector<Loaded>& loaded)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		loaded.swap(_loaded);
+		_loaded.clear();
+	}
+
+	virtual void run()
+	{
+		for(;;)
+		{
+			Loaded item;
+			bool compress = false;
+			{
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+				while(_queue.empty() && !_quit) _requested.wait(&_mutex);
+				if (_quit) return;
+				item.brick = _queue.front();
+				_queue.pop_front();
+				compress = _compress;
+			}
+
+			Brick* brick = item.brick.get();
+			long long compressedBytes = brick->compressed.valid() ? -(long long)brick->compressed->getCompressedSize() : 0;
+			if (compress && brick->compressed.valid())
+			{
+				item.image = brick->compressed->decompress();
+				compressedBytes = 0;
+			}
+			else
+			{
+				item.image = copyBrick(_source.get(), brick);
+				brick->compressed = compress && item.image.valid() ? CompressedVoxels::compress(item.image.get()) : 0;
+				if (brick->compressed.valid()) compressedBytes += brick->compressed->getCompressedSize();
+			}
+
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+			_compressedBytes += compressedBytes;
+			_loaded.push_back(item);
+		}
+	}
+
+private:
+	osg::ref_ptr<osg::Image> _source;
+	bool _compress;
+	size_t _compressedBytes;
+	OpenThreads::Mutex _mutex;
+	OpenThreads::Condition _requested;
+	std::deque< osg::ref_ptr<Brick> > _queue;
+	std::vector<Loaded> _loaded;
+	bool _quit;
+};
+
+BrickedVolume::BrickedVolume(osg::Image* source, const osg::Matrix& matrix, const osg::Matrix& flip,
+							int brickS, int brickT, int brickR,
+							ShadingVariants* variants,
+							const osg::Vec4& texelOffset, const osg::Vec4& texelScale)
+	: _source(source),
+	_matrix(matrix),
+	_flip(flip),
+	_variants(variants),
+	_texelOffset(texelOffset),
+	_texelScale(texelScale),
+	_root(new osg::Group),
+	_pager(0),
+	_budget(512*1024*1024),
+	_largestBrick(0),
+	_residentBytes(0),
+	_frame(0),
+	_overBudget(false)
+{
+	unsigned int pixelBytes = source->getPixelSizeInBits()/8;
+	for (int r0 = 0; r0 < source->r(); r0 += brickR)
+	{
+		for (int t0 = 0; t0 < source->t(); t0 += brickT)
+		{
+			for (int s0 = 0; s0 < source->s(); s0 += brickS)
+			{
+				osg::ref_ptr<Brick> brick = new Brick;
+				brick->s0 = s0;
+				brick->t0 = t0;
+				brick->r0 = r0;
+				brick->s = std::min(brickS, source->s()-s0);
+				brick->t = std::min(brickT, source->t()-t0);
+				brick->r = std::min(brickR, source->r()-r0);
+				brick->cs0 = std::max(s0-1, 0);
+				brick->ct0 = std::max(t0-1, 0);
+				brick->cr0 = std::max(r0-1, 0);
+				brick->cs = std::min(s0+brick->s+1, source->s()) - brick->cs0;
+				brick->ct = std::min(t0+brick->t+1, source->t()) - brick->ct0;
+				brick->cr = std::min(r0+brick->r+1, source->r()) - brick->cr0;
+				brick->bytes = (size_t)brick->cs*brick->ct*brick->cr*pixelBytes;
+				_largestBrick = std::max(_largestBrick, brick->bytes);
+				brick->occupied = brickBox(brick.get());
+				brick->node = new osg::Group;
+				brick->node->setCullCallback(new BrickCullCallback(brick.get(), variants->getClipping()));
+				_root->addChild(brick->node.get());
+				_bricks.push_back(brick);
+			}
+		}
+	}
+
+	setMatrix(matrix);
+
+	OSG_NOTICE<<"Split "<<source->s()<<"x"<<source->t()<<"x"<<source->r()<<" volume into "<<_bricks.size()
+		<<" bricks of up to "<<brickS<<"x"<<brickT<<"x"<<brickR<<std::endl;
+
+	_pager = new BrickPager(source);
+	_pager->start();
+}
+
+BrickedVolume::~BrickedVolume()
+{
+	delete _pager;
+
+	// the scene graph may hold on to the nodes after us
+	for (unsigned int i = 0; i < _bricks.size(); ++i)
+	{
+		BrickCullCallback* callback = dynamic_cast<BrickCullCallback*>(_bricks[i]->node->getCullCallback());
+		if (callback) callback->release();
+		_bricks[i]->node->setCullCallback(0);
+	}
+}
+
+osg::BoundingBox BrickedVolume::brickBox(const Brick* brick) const
+{
+	float S = _source->s(), T = _source->t(), R = _source->r();
+	return osg::BoundingBox(brick->s0/S, brick->t0/T, brick->r0/R,
+							(brick->s0+brick->s)/S, (brick->t0+brick->t)/T, (brick->r0+brick->r)/R);
+}
+
+osg::Matrix BrickedVolume::layerMatrix(const Brick* brick) const
+{
+	// the texture spans the voxels copied, so its texel centres fall where the
+	// whole image's do and the proxy samples it inset from the borders
+	float S = _source->s(), T = _source->t(), R = _source->r();
+	osg::BoundingBox copied(brick->cs0/S, brick->ct0/T, brick->cr0/R,
+							(brick->cs0+brick->cs)/S, (brick->ct0+brick->ct)/T, (brick->cr0+brick->cr)/R);
+	return boxMatrix(copied) * _flip * _matrix;
+}
+
+osg::Matrix BrickedVolume::geometryMatrix(const Brick* brick) const
+{
+	// mirroring the box rather than the matrix keeps the proxy's faces wound the right way
+	return boxMatrix(transformBox(brick->occupied, _flip)) * _matrix;
+}
+
+void BrickedVolume::place(Brick* brick)
+{
+	osg::Matrix m = geometryMatrix(brick);
+
+	// empty groups have no bound of their own, culling needs the brick's box
+	osg::BoundingBox bb = transformBox(osg::BoundingBox(0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f), m);
+	brick->node->setInitialBound(osg::BoundingSphere(bb));
+	brick->bounds = transformBox(brick->occupied, _flip);
+	brick->node->setNodeMask(brick->empty ? 0x0 : 0xffffffff);
+
+	if (brick->tile.valid()) placeVolumeTile(brick->tile.get(), m);
+}
+
+void BrickedVolume::setBudget(size_t bytes)
+{
+	if (bytes<_largestBrick)
+	{
+		OSG_NOTICE<<"BrickedVolume: a budget of "<<bytes/(1024*1024)<<"MB holds no brick, raised to "<<_largestBrick/(1024*1024)<<"MB"<<std::endl;
+		bytes = _largestBrick;
+	}
+	_budget = bytes;
+}
+
+void BrickedVolume::setMatrix(const osg::Matrix& matrix)
+{
+	_matrix = matrix;
+	for (unsigned int i = 0; i < _bricks.size(); ++i)
+	{
+		Brick* brick = _bricks[i].get();
+		if (brick->tile.valid()) brick->tile->getLayer()->setLocator(new osgVolume::Locator(layerMatrix(brick)));
+		place(brick);
+	}
+}
+
+void BrickedVolume::setOccupancy(const OccupancyGrid* grid)
+{
+	float S = _source->s(), T = _source->t(), R = _source->r();
+	for (unsigned int i = 0; i < _bricks.size(); ++i)
+	{
+		Brick* brick = _bricks[i].get();
+
+		osg::BoundingBox box;
+		bool empty = !grid->occupiedBox(brick->s0, brick->t0, brick->r0,
+										brick->s0+brick->s, brick->t0+brick->t, brick->r0+brick->r, box);
+		if (!empty) box = osg::BoundingBox(box.xMin()/S, box.yMin()/T, box.zMin()/R, box.xMax()/S, box.yMax()/T, box.zMax()/R);
+		else box = brickBox(brick);
+
+		if (empty==brick->empty && box==brick->occupied) continue;
+		brick->empty = empty;
+		brick->occupied = box;
+		place(brick);
+	}
+}
+
+void BrickedVolume::setCompression(bool compress)
+{
+	_pager->setCompression(compress);
+}
+
+size_t BrickedVolume::getCompressedBytes() const
+{
+	return _pager->getCompressedBytes();
+}
+
+unsigned int BrickedVolume::getNumResidentBricks() const
+{
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < _bricks.size(); ++i)
+	{
+		if (_bricks[i]->state==Brick::RESIDENT) ++count;
+	}
+	return count;
+}
+
+void BrickedVolume::setDirty()
+{
+	for (unsigned int i = 0; i < _bricks.size(); ++i)
+	{
+		if (_bricks[i]->tile.valid()) _bricks[i]->tile->setDirty(true);
+	}
+}
+
+void BrickedVolume::attach(Brick* brick, osg::Image* image)
+{
+	osg::ref_ptr<osgVolume::ImageLayer> layer = new osgVolume::ImageLayer(image);
+	layer->setLocator(new osgVolume::Locator(layerMatrix(brick)));
+	layer->setTexelOffset(_texelOffset);
+	layer->setTexelScale(_texelScale);
+	layer->addProperty(_variants->getModes());
+
+	brick->tile = new osgVolume::VolumeTile;
+	brick->tile->setLocator(new osgVolume::Locator(geometryMatrix(brick)));
+	brick->tile->setLayer(layer.get());
+	brick->tile->setVolumeTechnique(new VariantTechnique(_variants.get()));
+	brick->node->addChild(brick->tile.get());
+	brick->state = Brick::RESIDENT;
+}
+
+void BrickedVolume::evict(Brick* brick)
+{
+	brick->node->removeChildren(0, brick->node->getNumChildren());
+	brick->tile = 0;
+	brick->state = Brick::EMPTY;
+	_residentBytes -= brick->bytes;
+}
+
+namespace
+{
+
+struct LeastRecentlyUsed
+{
+	bool operator () (const Brick* lhs, const Brick* rhs) const { return lhs->lastUsed < rhs->lastUsed; }
+};
+
+}
+
+void BrickedVolume::update()
+{
+	++_frame;
+
+	std::vector<BrickPager::Loaded> loaded;
+	_pager->takeLoaded(loaded);
+	for (unsigned int i = 0; i < loaded.size(); ++i)
+	{
+		Brick* brick = loaded[i].brick.get();
+		if (!loaded[i].image)
+		{
+			OSG_NOTICE<<"Unable to page in brick at "<<brick->s0<<","<<brick->t0<<","<<brick->r0<<std::endl;
+			brick->state = Brick::EMPTY;
+			_residentBytes -= brick->bytes;
+			continue;
+		}
+
+		attach(brick, loaded[i].image.get());
+	}
+
+	// requests made by the cull traversal of the last frame
+	std::vector<Brick*> wanted;
+	std::vector<Brick*> unused;
+	for (unsigned int i = 0; i < _bricks.size(); ++i)
+	{
+		Brick* brick = _bricks[i].get();
+		if (brick->requested.exchange(0))
+		{
+			brick->lastUsed = _frame;
+			if (brick->state==Brick::EMPTY) wanted.push_back(brick);
+		}
+		else if (brick->state==Brick::RESIDENT)
+		{
+			unused.push_back(brick);
+		}
+	}
+	if (wanted.empty()) return;
+
+	// make room by dropping the bricks that have been out of view longest
+	std::sort(unused.begin(), unused.end(), LeastRecentlyUsed());
+	unsigned int nextUnused = 0;
+	for (unsigned int i = 0; i < wanted.size(); ++i)
+	{
+		Brick* brick = wanted[i];
+		while(_residentBytes+brick->bytes>_budget && nextUnused<unused.size())
+		{
+			evict(unused[nextUnused++]);
+		}
+
+		if (_residentBytes+brick->bytes>_budget)
+		{
+			if (!_overBudget)
+			{
+				OSG_NOTICE<<"Warning: the bricks in view exceed the residency budget of "<<_budget/(1024*1024)<<"MB, some are left out."<<std::endl;
+				_overBudget = true;
+			}
+			return;
+		}
+
+		// reserved now, so the bricks in flight count against the budget
+		_residentBytes += brick->bytes;
+		brick->state = Brick::QUEUED;
+		_pager->add(brick);
+	}
+	_overBudget = false;
+}
@@ -0,0 +1,103 @@
+#ifndef	__AJ_VOLUMEBRICKS__
+#define __AJ_VOLUMEBRICKS__
+
+#include "volumetechnique.h"
+
+#include <osg/Group>
+#include <osg/Image>
+#include <osg/Matrix>
+#include <osg/BoundingBox>
+#include <osgVolume/Property>
+
+#include <OpenThreads/Mutex>
+
+#include <vector>
+
+class BrickPager;
+class OccupancyGrid;
+struct Brick;
+
+// A volume too large for a single 3D texture, split into a grid of bricks,
+// each its own osgVolume::VolumeTile. The bricks are copied out of the
+// source image, normally a mapping of the file or of the cache entry, on a
+// background thread when culling first finds them in view, and kept while
+// they fit in the residency budget. Past the budget, the bricks that went
+// longest without being drawn are dropped, along with their textures.
+// Each brick's texture takes a voxel past its faces from its neighbours, so
+// filtering across a face matches the single texture and shows no seam;
+// brickS, brickT and brickR plus two must fit a texture.
+//
+// getNode() goes under the osgVolume::Volume. update() must be called once
+// a frame, from the update traversal.
+class BrickedVolume : public osg::Referenced
+{
+public:
+	// matrix maps the unit cube of the whole volume into the model, as the
+	// tile's Locator would; flip mirrors the image within that cube, as the
+	// layer's Locator does for negative scales.
+	BrickedVolume(osg::Image* source, const osg::Matrix& matrix, const osg::Matrix& flip,
+				int brickS, int brickT, int brickR,
+				ShadingVariants* variants,
+				const osg::Vec4& texelOffset, const osg::Vec4& texelScale);
+
+	osg::Group* getNode() { return _root.get(); }
+
+	void setMatrix(const osg::Matrix& matrix);
+	const osg::Matrix& getMatrix() const { return _matrix; }
+
+	// Shrinks the proxy geometry of each brick to its occupied cells. Empty
+	// bricks are hidden, so culling never asks for them to be paged in.
+	void setOccupancy(const OccupancyGrid* grid);
+
+	// Bytes of brick data allowed to be resident at once, never less than
+	// the largest brick so at least one can be drawn.
+	void setBudget(size_t bytes);
+	size_t getBudget() const { return _budget; }
+
+	// Keeps bricks that have been paged in compressed in memory, so they come
+	// back without touching the source; only 8 and 16-bit data compresses.
+	void setCompression(bool compress);
+	size_t getCompressedBytes() const;
+
+	unsigned int getNumBricks() const { return _bricks.size(); }
+	unsigned int getNumResidentBricks() const;
+	size_t getResidentBytes() const { return _residentBytes; }
+
+	// Reinitialises the techniques of the resident bricks, after a property change.
+	void setDirty();
+
+	// Attaches the bricks paged in since the last frame, then requests the
+	// bricks culling wants and evicts others to make room for them.
+	void update();
+
+protected:
+	virtual ~BrickedVolume();
+
+	void attach(Brick* brick, osg::Image* image);
+	void evict(Brick* brick);
+	void place(Brick* brick);
+
+	// the brick within the unit cube of the whole image
+	osg::BoundingBox brickBox(const Brick* brick) const;
+	osg::Matrix layerMatrix(const Brick* brick) const;
+	osg::Matrix geometryMatrix(const Brick* brick) const;
+
+	osg::ref_ptr<osg::Image> _source;
+	osg::Matrix _matrix;
+	osg::Matrix _flip;
+	osg::ref_ptr<ShadingVariants> _variants;
+	osg::Vec4 _texelOffset;
+	osg::Vec4 _texelScale;
+
+	osg::ref_ptr<osg::Group> _root;
+	std::vector< osg::ref_ptr<Brick> > _bricks;
+	BrickPager* _pager;
+
+	size_t _budget;
+	size_t _largestBrick;
+	size_t _residentBytes;
+	unsigned int _frame;
+	bool _overBudget;
+};
+
+#endif
@@ -0,0 +1,517 @@
+#include "volumecache.h"
+#include "rawreader.h"
+
+#include <osg/Notify>
+#include <osg/Timer>
+#include <osgDB/FileNameUtils>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef WIN32
+#include <io.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace
+{
+
+const char cacheMagic[8] = { 'M','Y','V','O','L','C','H','\0' };
+const unsigned int cacheVersion = 1;
+const unsigned long long cacheAlignment = 4096;
+
+// A claim refreshes its lock this often while the volume loads, and a lock
+// not refreshed for lockStale seconds was left by a process that died.
+const double lockRefresh = 10.0;
+const double lockStale = 60.0;
+
+// Fixed layout at the start of every cache file; the voxels follow at dataOffset.
+struct CacheHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int hasMatrix;
+	unsigned long long key;
+	unsigned long long dataOffset;
+	unsigned long long dataSize;
+
+	int s, t, r;
+	int packing;
+	unsigned int internalTextureFormat;
+	unsigned int pixelFormat;
+	unsigned int dataType;
+	unsigned int reserved;
+
+	double matrix[16];
+	float texelOffset[4];
+	float texelScale[4];
+	float minValue[4];
+	float maxValue[4];
+};
+
+// FNV-1a, enough to tell cache entries apart.
+class Hash
+{
+public:
+	Hash() : _value(14695981039346656037ULL) {}
+
+	void add(const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for(size_t i=0; i<size; ++i)
+		{
+			_value ^= bytes[i];
+			_value *= 1099511628211ULL;
+		}
+	}
+	void add(const std::string& str) { add(str.c_str(), str.size()+1); }
+	template<typename T> void add(const T& value) { add(&value, sizeof(T)); }
+
+	unsigned long long value() const { return _value; }
+
+private:
+	unsigned long long _value;
+};
+
+bool fileStatus(const std::string& filename, long long& size, long long& modified)
+{
+#ifdef WIN32
+	struct _stat64 st;
+	if (_stat64(filename.c_str(), &st)!=0) return false;
+#else
+	struct stat st;
+	if (stat(filename.c_str(), &st)!=0) return false;
+#endif
+	size = st.st_size;
+	modified = st.st_mtime;
+	return true;
+}
+
+// Host and process, unique among the processes sharing a cache directory.
+std::string processName()
+{
+	std::ostringstream name;
+#ifdef WIN32
+	const char* host = getenv("COMPUTERNAME");
+	name<<(host ? host : "localhost")<<"-"<<_getpid();
+#else
+	char host[256] = "localhost";
+	gethostname(host, sizeof(host)-1);
+	name<<host<<"-"<<getpid();
+#endif
+	return name.str();
+}
+
+// The process that wrote lockFileName, empty when it can not be read.
+std::string lockOwner(const std::string& lockFileName)
+{
+	FILE* file = fopen(lockFileName.c_str(), "rb");
+	if (!file) return std::string();
+	char owner[512];
+	size_t size = fread(owner, 1, sizeof(owner), file);
+	fclose(file);
+	return std::string(owner, size);
+}
+
+// Copies through a file of this process's own and renames it into place, so
+// readers never map half a file whoever else is copying.
+bool copyFile(const std::string& from, const std::string& to)
+{
+	FILE* in = fopen(from.c_str(), "rb");
+	if (!in) return false;
+
+	std::string tmpFileName = to + "." + processName() + ".tmp";
+	FILE* out = fopen(tmpFileName.c_str(), "wb");
+	if (!out)
+	{
+		fclose(in);
+		return false;
+	}
+
+	std::vector<char> buffer(4*1024*1024);
+	bool ok = true;
+	size_t size;
+	while(ok && (size = fread(&buffer.front(), 1, buffer.size(), in))>0)
+	{
+		ok = fwrite(&buffer.front(), 1, size, out)==size;
+	}
+	ok = !ferror(in) && ok;
+	fclose(in);
+	ok = (fclose(out)==0) && ok;
+
+	if (ok)
+	{
+#ifdef WIN32
+		remove(to.c_str());
+#endif
+		ok = rename(tmpFileName.c_str(), to.c_str())==0;
+	}
+	if (!ok) remove(tmpFileName.c_str());
+	return ok;
+}
+
+}
+
+unsigned long long volumeSourceKey(const std::string& imageFile, const VolumeOptions& options)
+{
+	Hash hash;
+	hash.add(cacheVersion);
+
+	osgDB::DirectoryContents sources = volumeSourceFiles(imageFile);
+	if (sources.empty()) return 0;
+	// a detached NRRD header says little about its data, which can be rewritten on its own
+	std::string ext = osgDB::getLowerCaseFileExtension(imageFile);
+	if (ext=="nhdr" || ext=="nrrd")
+	{
+		std::string dataFile = nrrdDataFile(sources.front());
+		if (!dataFile.empty()) sources.push_back(dataFile);
+	}
+
+	for(unsigned int i=0; i<sources.size(); ++i)
+	{
+		// a source that can not be looked at can not be told apart from a changed one
+		long long size = 0, modified = 0;
+		if (!fileStatus(sources[i], size, modified))
+		{
+			OSG_NOTICE<<"VolumeCache: can not stat "<<sources[i]<<", not caching "<<imageFile<<std::endl;
+			return 0;
+		}
+		hash.add(sources[i]);
+		hash.add(size);
+		hash.add(modified);
+	}
+
+	hash.add(options.numComponentsDesired);
+	hash.add(options.s_maximumTextureSize);
+	hash.add(options.t_maximumTextureSize);
+	hash.add(options.r_maximumTextureSize);
+	hash.add(options.resizeToPowerOfTwo);
+	hash.add(static_cast<int>(options.colourSpaceOperation));
+	hash.add(options.colourModulate);
+	hash.add(static_cast<int>(options.rescaleOperation));
+	hash.add(options.quantizeBits);
+	hash.add(options.rawSizeX);
+	hash.add(options.rawSizeY);
+	hash.add(options.rawSizeZ);
+	hash.add(options.rawBytesPerComponent);
+	hash.add(options.rawComponents);
+	hash.add(options.rawEndian);
+	return hash.value();
+}
+
+VolumeCache::VolumeCache(const std::string& imageFile, const VolumeOptions& options)
+	: _key(0),
+	_claimed(false),
+	_keeper(0)
+{
+	const char* enabled = getenv("MYVOLUME_CACHE");
+	if (enabled && std::string(enabled)=="off") return;
+
+	_key = volumeSourceKey(imageFile, options);
+	if (_key==0) return;
+
+	osgDB::DirectoryContents sources = volumeSourceFiles(imageFile);
+
+	std::string directory;
+	const char* cacheDir = getenv("MYVOLUME_CACHE_DIR");
+	if (cacheDir) directory = cacheDir;
+	else directory = osgDB::getFilePath(sources.front());
+	if (directory.empty()) directory = ".";
+
+	std::ostringstream name;
+	name<<"volume-"<<std::hex<<_key<<".cache";
+	_fileName = osgDB::concatPaths(directory, name.str());
+
+	const char* localCacheDir = getenv("MYVOLUME_LOCAL_CACHE_DIR");
+	if (localCacheDir) _localFileName = osgDB::concatPaths(localCacheDir, name.str());
+}
+
+// Keeps touching the lock of a claim until stopped, so the processes waiting
+// on it can tell a slow load from a dead one.
+class VolumeCache::LockKeeper : public OpenThreads::Thread
+{
+public:
+	LockKeeper(const std::string& lockFileName) : _lockFileName(lockFileName) {}
+
+	virtual void run()
+	{
+		const osg::Timer* timer = osg::Timer::instance();
+		osg::Timer_t touched = timer->tick();
+		std::string owner = processName() + "\n";
+		while(_stop==0)
+		{
+			OpenThreads::Thread::microSleep(200000);
+			if (timer->delta_s(touched, timer->tick())<lockRefresh) continue;
+			if (lockOwner(_lockFileName)!=owner) return;
+#ifdef WIN32
+			_utime(_lockFileName.c_str(), 0);
+#else
+			utime(_lockFileName.c_str(), 0);
+#endif
+			touched = timer->tick();
+		}
+	}
+
+	void stop()
+	{
+		_stop.exchange(1);
+		join();
+	}
+
+private:
+	std::string _lockFileName;
+	OpenThreads::Atomic _stop;
+};
+
+VolumeCache::~VolumeCache()
+{
+	release();
+}
+
+VolumeData* VolumeCache::read() const
+{
+	if (!isEnabled()) return 0;
+
+	if (!_localFileName.empty())
+	{
+		VolumeData* data = map(_localFileName);
+		if (data) return data;
+
+		// the first time on this node, one read of the shared entry over the network
+		if (copyFile(_fileName, _localFileName))
+		{
+			OSG_NOTICE<<"Copied volume cache "<<_fileName<<" to "<<_localFileName<<std::endl;
+			data = map(_localFileName);
+			if (data) return data;
+		}
+	}
+	return map(_fileName);
+}
+
+VolumeData* VolumeCache::readOrClaim()
+{
+	VolumeData* data = read();
+	if (data || !isEnabled()) return data;
+
+	double timeout = 600.0;
+	const char* wait = getenv("MYVOLUME_CACHE_WAIT");
+	if (wait) timeout = atof(wait);
+
+	const osg::Timer* timer = osg::Timer::instance();
+	osg::Timer_t start = timer->tick();
+	std::string lockFileName = _fileName + ".lock";
+	bool waiting = false;
+	for(;;)
+	{
+		if (claim())
+		{
+			// the last holder may have finished between the read and the claim
+			data = read();
+			if (data) release();
+			return data;
+		}
+
+		// the holder refreshes its lock while it loads, one left alone this
+		// long belongs to a process that died; it is looked at again just
+		// before going, in case another waiter already replaced it
+		long long size = 0, modified = 0;
+		if (fileStatus(lockFileName, size, modified) && difftime(time(0), (time_t)modified)>lockStale)
+		{
+			std::string owner = lockOwner(lockFileName);
+			if (fileStatus(lockFileName, size, modified) && difftime(time(0), (time_t)modified)>lockStale && lockOwner(lockFileName)==owner)
+			{
+				OSG_NOTICE<<"Removing stale volume cache lock "<<lockFileName<<" of "<<owner<<std::endl;
+				remove(lockFileName.c_str());
+			}
+			continue;
+		}
+
+		if (timer->delta_s(start, timer->tick())>timeout)
+		{
+			OSG_NOTICE<<"Gave up waiting for volume cache "<<_fileName<<", loading it here"<<std::endl;
+			return 0;
+		}
+		if (!waiting)
+		{
+			OSG_NOTICE<<"Waiting for another process to write volume cache "<<_fileName<<std::endl;
+			waiting = true;
+		}
+
+		OpenThreads::Thread::microSleep(200000);
+		data = read();
+		if (data) return data;
+	}
+}
+
+bool VolumeCache::claim()
+{
+	std::string lockFileName = _fileName + ".lock";
+#ifdef WIN32
+	int fd = _open(lockFileName.c_str(), _O_CREAT|_O_EXCL|_O_WRONLY, _S_IREAD|_S_IWRITE);
+#else
+	int fd = open(lockFileName.c_str(), O_CREAT|O_EXCL|O_WRONLY, 0644);
+#endif
+	if (fd<0) return false;
+
+	// who holds it, for whoever finds it left behind
+	std::string owner = processName() + "\n";
+#ifdef WIN32
+	_write(fd, owner.c_str(), owner.size());
+	_close(fd);
+#else
+	ssize_t written = ::write(fd, owner.c_str(), owner.size());
+	(void)written;
+	close(fd);
+#endif
+	_claimed = true;
+	_keeper = new LockKeeper(lockFileName);
+	_keeper->start();
+	return true;
+}
+
+void VolumeCache::release()
+{
+	if (!_claimed) return;
+	_keeper->stop();
+	delete _keeper;
+	_keeper = 0;
+
+	// taken for stale, the lock may belong to another process by now
+	std::string lockFileName = _fileName + ".lock";
+	if (lockOwner(lockFileName)==processName() + "\n") remove(lockFileName.c_str());
+	else OSG_NOTICE<<"Volume cache lock "<<lockFileName<<" was taken over, left to its new owner"<<std::endl;
+	_claimed = false;
+}
+
+VolumeData* VolumeCache::map(const std::string& fileName) const
+{
+	osg::ref_ptr<MappedFile> file = MappedFile::open(fileName, true);
+	if (!file) return 0;
+
+	CacheHeader header;
+	if (file->size()<sizeof(header)) return 0;
+	memcpy(&header, file->data(), sizeof(header));
+
+	if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic))!=0 ||
+		header.version!=cacheVersion ||
+		header.key!=_key ||
+		header.dataOffset+header.dataSize>file->size())
+	{
+		OSG_NOTICE<<"Ignoring stale volume cache "<<fileName<<std::endl;
+		return 0;
+	}
+
+	osg::ref_ptr<VolumeData> data = new VolumeData;
+	data->image = new MappedImage(file.get(), header.dataOffset,
+								header.s, header.t, header.r,
+								header.pixelFormat, header.dataType,
+								header.internalTextureFormat, header.packing);
+	data->image->setFileName(fileName);
+
+	if (header.hasMatrix)
+	{
+		data->matrix = new osg::RefMatrix;
+		data->matrix->set(header.matrix);
+	}
+	data->texelOffset.set(header.texelOffset[0], header.texelOffset[1], header.texelOffset[2], header.texelOffset[3]);
+	data->texelScale.set(header.texelScale[0], header.texelScale[1], header.texelScale[2], header.texelScale[3]);
+	data->minValue.set(header.minValue[0], header.minValue[1], header.minValue[2], header.minValue[3]);
+	data->maxValue.set(header.maxValue[0], header.maxValue[1], header.maxValue[2], header.maxValue[3]);
+
+	OSG_NOTICE<<"Mapped preprocessed volume from cache "<<fileName<<", s="<<header.s<<", t="<<header.t<<", r="<<header.r<<std::endl;
+
+	return data.release();
+}
+
+bool VolumeCache::write(const VolumeData* data)
+{
+	bool ok = writeEntry(data);
+	release();
+	return ok;
+}
+
+bool VolumeCache::writeEntry(const VolumeData* data) const
+{
+	if (!isEnabled() || !data || !data->image) return false;
+
+	const osg::Timer* timer = osg::Timer::instance();
+	osg::Timer_t start = timer->tick();
+
+	const osg::Image* image = data->image.get();
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+	header.version = cacheVersion;
+	header.key = _key;
+	header.dataOffset = ((sizeof(header)+cacheAlignment-1)/cacheAlignment)*cacheAlignment;
+	header.dataSize = static_cast<unsigned long long>(image->getImageSizeInBytes())*image->r();
+	header.s = image->s();
+	header.t = image->t();
+	header.r = image->r();
+	header.packing = image->getPacking();
+	header.internalTextureFormat = image->getInternalTextureFormat();
+	header.pixelFormat = image->getPixelFormat();
+	header.dataType = image->getDataType();
+
+	header.hasMatrix = data->matrix.valid() ? 1 : 0;
+	if (data->matrix.valid())
+	{
+		const double* m = data->matrix->ptr();
+		for(unsigned int i=0; i<16; ++i) header.matrix[i] = m[i];
+	}
+	for(unsigned int i=0; i<4; ++i)
+	{
+		header.texelOffset[i] = data->texelOffset[i];
+		header.texelScale[i] = data->texelScale[i];
+		header.minValue[i] = data->minValue[i];
+		header.maxValue[i] = data->maxValue[i];
+	}
+
+	// write next to the entry and rename it into place, so readers never map half a file
+	std::string tmpFileName = _fileName + "." + processName() + ".tmp";
+	FILE* fp = fopen(tmpFileName.c_str(), "wb");
+	if (!fp)
+	{
+		OSG_NOTICE<<"Unable to write volume cache "<<_fileName<<std::endl;
+		return false;
+	}
+
+	std::vector<char> padding(static_cast<size_t>(header.dataOffset-sizeof(header)), 0);
+	bool ok = fwrite(&header, sizeof(header), 1, fp)==1 &&
+			(padding.empty() || fwrite(&padding.front(), padding.size(), 1, fp)==1) &&
+			fwrite(image->data(), 1, static_cast<size_t>(header.dataSize), fp)==header.dataSize;
+	ok = (fclose(fp)==0) && ok;
+
+	if (ok)
+	{
+#ifdef WIN32
+		// rename does not replace an existing file on windows
+		remove(_fileName.c_str());
+#endif
+		ok = rename(tmpFileName.c_str(), _fileName.c_str())==0;
+	}
+	if (!ok)
+	{
+		remove(tmpFileName.c_str());
+		OSG_NOTICE<<"Unable to write volume cache "<<_fileName<<std::endl;
+		return false;
+	}
+
+	OSG_NOTICE<<"Wrote volume cache "<<_fileName<<" ("<<header.dataSize/(1024*1024)<<"MB) in "<<timer->delta_m(start, timer->tick())<<"ms"<<std::endl;
+	return true;
+}
@@ -0,0 +1,66 @@
+#ifndef	__AJ_VOLUMECACHE__
+#define __AJ_VOLUMECACHE__
+
+#include "volumedata.h"
+
+#include <string>
+
+// A hash of the source files imageFile stands for (names, sizes, modification
+// times), the data file of a detached NRRD header among them, and of the
+// options: what the volume loaded from them depends on. 0 when there are no
+// source files or one of them can not be looked at.
+unsigned long long volumeSourceKey(const std::string& imageFile, const VolumeOptions& options);
+
+// Preprocessed volumes kept on disk between runs. An entry is named after a
+// hash of the source files (names, sizes, modification times) and of the
+// options, so touching the data or changing the processing misses the cache.
+// The voxels sit page aligned after a small header and are mapped back
+// rather than read.
+//
+// Entries live in $MYVOLUME_CACHE_DIR, or next to the source files when it is
+// not set. MYVOLUME_CACHE=off disables the cache.
+//
+// On a cluster the directory is shared, and the processes starting together
+// agree through a lock file on one of them to load a missing entry while the
+// others wait for it, up to $MYVOLUME_CACHE_WAIT seconds (600 by default).
+// The lock names the host and process holding it, which refreshes it while
+// loading; one not refreshed for a minute is taken for stale.
+// With $MYVOLUME_LOCAL_CACHE_DIR set, an entry is copied there from the
+// shared directory the first time a node needs it and mapped from its own
+// disk from then on.
+class VolumeCache
+{
+public:
+	VolumeCache(const std::string& imageFile, const VolumeOptions& options);
+	~VolumeCache();
+
+	bool isEnabled() const { return !_fileName.empty(); }
+	const std::string& getFileName() const { return _fileName; }
+
+	// Returns 0 when there is no valid entry.
+	VolumeData* read() const;
+
+	// The entry, once some process has written it. Returns 0 when this one is
+	// to load the volume and write() it; the others wait for it meanwhile.
+	VolumeData* readOrClaim();
+
+	// Also lets the processes waiting on a claim go, whether it succeeds or not.
+	bool write(const VolumeData* data);
+
+private:
+	VolumeData* map(const std::string& fileName) const;
+	bool writeEntry(const VolumeData* data) const;
+	bool claim();
+	void release();
+
+	// refreshes the lock of a claim while the volume loads
+	class LockKeeper;
+
+	std::string _fileName;
+	std::string _localFileName;
+	unsigned long long _key;
+	bool _claimed;
+	LockKeeper* _keeper;
+};
+
+#endif
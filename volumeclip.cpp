@@ -0,0 +1,234 @@
+#include "volumeclip.h"
+
+#include <osg/Notify>
+#include <osg/Program>
+#include <osg/Shader>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// osgVolume's fragment shaders have the ray's end points, in the proxy's
+// unit cube, in t0 and te just before they move them into the texture.
+const char* rayMarker = "t0 = t0 * texgen;";
+
+const char* clipSource =
+	"uniform vec4 volumeClipPlanes[6];\n"
+	"uniform mat4 volumeClipBox;\n"
+	"uniform mat4 volumeClipTransform;\n"
+	"\n"
+	"bool volumeClip(inout vec4 t0, inout vec4 te)\n"
+	"{\n"
+	"    vec3 a = (volumeClipTransform * vec4(t0.xyz, 1.0)).xyz;\n"
+	"    vec3 b = (volumeClipTransform * vec4(te.xyz, 1.0)).xyz;\n"
+	"    float s0 = 0.0;\n"
+	"    float s1 = 1.0;\n"
+	"    for(int i=0; i<6; ++i)\n"
+	"    {\n"
+	"        float fa = dot(volumeClipPlanes[i].xyz, a) + volumeClipPlanes[i].w;\n"
+	"        float fb = dot(volumeClipPlanes[i].xyz, b) + volumeClipPlanes[i].w;\n"
+	"        if (fa<0.0 && fb<0.0) return false;\n"
+	"        if (fa<0.0) s0 = max(s0, fa/(fa-fb));\n"
+	"        else if (fb<0.0) s1 = min(s1, fa/(fa-fb));\n"
+	"    }\n"
+	"    vec3 ba = (volumeClipBox * vec4(a, 1.0)).xyz;\n"
+	"    vec3 d = (volumeClipBox * vec4(b, 1.0)).xyz - ba;\n"
+	"    if (abs(d.x)<1e-6) d.x = 1e-6;\n"
+	"    if (abs(d.y)<1e-6) d.y = 1e-6;\n"
+	"    if (abs(d.z)<1e-6) d.z = 1e-6;\n"
+	"    vec3 sa = -ba/d;\n"
+	"    vec3 sb = (vec3(1.0,1.0,1.0)-ba)/d;\n"
+	"    vec3 sNear = min(sa, sb);\n"
+	"    vec3 sFar = max(sa, sb);\n"
+	"    s0 = max(s0, max(sNear.x, max(sNear.y, sNear.z)));\n"
+	"    s1 = min(s1, min(sFar.x, min(sFar.y, sFar.z)));\n"
+	"    if (s0>=s1) return false;\n"
+	"    vec4 start = t0;\n"
+	"    t0 = mix(start, te, s0);\n"
+	"    te = mix(start, te, s1);\n"
+	"    return true;\n"
+	"}\n"
+	"\n";
+
+const osg::Vec4 noPlane(0.0f, 0.0f, 0.0f, 1.0f);
+
+// what a disabled box maps the volume's unit cube into, well inside its own
+osg::Matrix noBox()
+{
+	return osg::Matrix::scale(0.5, 0.5, 0.5) * osg::Matrix::translate(0.25, 0.25, 0.25);
+}
+
+osg::Shader* clippingShader(const osg::Shader* shader)
+{
+	const std::string& source = shader->getShaderSource();
+	std::string::size_type marker = source.find(rayMarker);
+	std::string::size_type main = source.find("void main");
+	if (marker==std::string::npos || main==std::string::npos || main>marker) return 0;
+
+	std::string clipped = source.substr(0, main) + clipSource +
+						source.substr(main, marker-main) + "if (!volumeClip(t0, te)) discard;\n    " +
+						source.substr(marker);
+	return new osg::Shader(shader->getType(), clipped);
+}
+
+}
+
+VolumeClipping::VolumeClipping()
+	: _numPlanes(0),
+	_box(noBox()),
+	_boxEnabled(false)
+{
+	_planesUniform = new osg::Uniform(osg::Uniform::FLOAT_VEC4, "volumeClipPlanes", MaxPlanes);
+	_planesUniform->setDataVariance(osg::Object::DYNAMIC);
+	_boxUniform = new osg::Uniform("volumeClipBox", _box);
+	_boxUniform->setDataVariance(osg::Object::DYNAMIC);
+	clear();
+}
+
+void VolumeClipping::setPlane(unsigned int index, const osg::Vec3& point, const osg::Vec3& normal)
+{
+	if (index>=MaxPlanes) return;
+	osg::Vec3 n = normal;
+	if (n.normalize()==0.0f) return;
+
+	if (_planes[index]==noPlane) ++_numPlanes;
+	_planes[index].set(n.x(), n.y(), n.z(), -(n*point));
+	_planesUniform->setElement(index, _planes[index]);
+}
+
+void VolumeClipping::clearPlane(unsigned int index)
+{
+	if (index>=MaxPlanes || _planes[index]==noPlane) return;
+	--_numPlanes;
+	_planes[index] = noPlane;
+	_planesUniform->setElement(index, _planes[index]);
+}
+
+void VolumeClipping::setBox(const osg::Matrix& boxMatrix)
+{
+	_box = osg::Matrix::inverse(boxMatrix);
+	_boxEnabled = true;
+	_boxUniform->set(_box);
+}
+
+void VolumeClipping::clearBox()
+{
+	_box = noBox();
+	_boxEnabled = false;
+	_boxUniform->set(_box);
+}
+
+void VolumeClipping::clear()
+{
+	for (unsigned int i = 0; i < MaxPlanes; ++i)
+	{
+		_planes[i] = noPlane;
+		_planesUniform->setElement(i, _planes[i]);
+	}
+	_numPlanes = 0;
+	clearBox();
+}
+
+bool VolumeClipping::clipSegment(const osg::Vec3& a, const osg::Vec3& b, float& t0, float& t1) const
+{
+	// as the shaders do it
+	for (unsigned int i = 0; i < MaxPlanes && _numPlanes>0; ++i)
+	{
+		const osg::Vec4& p = _planes[i];
+		float fa = p.x()*a.x() + p.y()*a.y() + p.z()*a.z() + p.w();
+		float fb = p.x()*b.x() + p.y()*b.y() + p.z()*b.z() + p.w();
+		if (fa<0.0f && fb<0.0f) return false;
+		if (fa<0.0f) t0 = std::max(t0, fa/(fa-fb));
+		else if (fb<0.0f) t1 = std::min(t1, fa/(fa-fb));
+	}
+
+	if (_boxEnabled)
+	{
+		osg::Vec3 ba = a * _box;
+		osg::Vec3 d = b * _box - ba;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (fabsf(d[i])<1e-6f)
+			{
+				if (ba[i]<0.0f || ba[i]>1.0f) return false;
+				continue;
+			}
+			float sa = -ba[i]/d[i];
+			float sb = (1.0f-ba[i])/d[i];
+			t0 = std::max(t0, std::min(sa, sb));
+			t1 = std::min(t1, std::max(sa, sb));
+		}
+	}
+	return t0<t1;
+}
+
+bool VolumeClipping::clipsAway(const osg::BoundingBox& box) const
+{
+	if (!box.valid()) return true;
+
+	// conservative: all corners behind one plane, or beyond one face of the box
+	for (unsigned int i = 0; i < MaxPlanes && _numPlanes>0; ++i)
+	{
+		if (_planes[i]==noPlane) continue;
+		bool behind = true;
+		for (unsigned int c = 0; c < 8 && behind; ++c)
+		{
+			osg::Vec3 corner = box.corner(c);
+			behind = _planes[i].x()*corner.x() + _planes[i].y()*corner.y() + _planes[i].z()*corner.z() + _planes[i].w() < 0.0f;
+		}
+		if (behind) return true;
+	}
+
+	if (_boxEnabled)
+	{
+		osg::Vec3 corners[8];
+		for (unsigned int c = 0; c < 8; ++c) corners[c] = box.corner(c) * _box;
+		for (int i = 0; i < 3; ++i)
+		{
+			bool below = true, above = true;
+			for (unsigned int c = 0; c < 8; ++c)
+			{
+				below = below && corners[c][i]<0.0f;
+				above = above && corners[c][i]>1.0f;
+			}
+			if (below || above) return true;
+		}
+	}
+	return false;
+}
+
+bool VolumeClipping::apply(osg::StateSet* stateset, const osg::Matrix& proxyToVolume) const
+{
+	osg::Program* program = dynamic_cast<osg::Program*>(stateset->getAttribute(osg::StateAttribute::PROGRAM));
+	if (!program) return false;
+
+	// a copy, the technique's shaders may be shared through the registry
+	osg::ref_ptr<osg::Program> clipping = new osg::Program;
+	for (unsigned int i = 0; i < program->getNumShaders(); ++i)
+	{
+		const osg::Shader* shader = program->getShader(i);
+		if (shader->getType()!=osg::Shader::FRAGMENT)
+		{
+			clipping->addShader(const_cast<osg::Shader*>(shader));
+			continue;
+		}
+
+		osg::ref_ptr<osg::Shader> clipped = clippingShader(shader);
+		if (!clipped)
+		{
+			static bool warned = false;
+			if (!warned) OSG_NOTICE<<"VolumeClipping: no ray to clip in this fragment shader, the volume is drawn unclipped"<<std::endl;
+			warned = true;
+			return false;
+		}
+		clipping->addShader(clipped.get());
+	}
+	stateset->setAttribute(clipping.get());
+
+	stateset->addUniform(_planesUniform.get());
+	stateset->addUniform(_boxUniform.get());
+	stateset->addUniform(new osg::Uniform("volumeClipTransform", osg::Matrixf(proxyToVolume)));
+	return true;
+}
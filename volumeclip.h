@@ -0,0 +1,64 @@
+#ifndef	__AJ_VOLUMECLIP__
+#define __AJ_VOLUMECLIP__
+
+#include <osg/BoundingBox>
+#include <osg/Matrix>
+#include <osg/StateSet>
+#include <osg/Uniform>
+
+// Planes and a box that cut away part of a volume, in the unit cube of the
+// whole volume as drawn: the frame the volume tile's Locator maps into the
+// model, whatever proxy box a tile, brick or level actually draws.
+//
+// The shaders trim each ray to what is left before they start sampling, so
+// the part cut away takes no samples. Everything reaches them as uniforms
+// shared by all the tiles; moving the planes or the box only sets those.
+class VolumeClipping : public osg::Referenced
+{
+public:
+	enum { MaxPlanes = 6 };
+
+	VolumeClipping();
+
+	// Keeps the side of the plane through point that normal points to.
+	void setPlane(unsigned int index, const osg::Vec3& point, const osg::Vec3& normal);
+	void clearPlane(unsigned int index);
+
+	// Keeps the inside of the box, the unit cube under boxMatrix.
+	void setBox(const osg::Matrix& boxMatrix);
+	void clearBox();
+
+	void clear();
+	bool isEnabled() const { return _numPlanes>0 || _boxEnabled; }
+
+	// The volume's unit cube into the model, as the volume tile's Locator.
+	void setVolumeMatrix(const osg::Matrix& matrix) { _volumeMatrix = matrix; }
+	const osg::Matrix& getVolumeMatrix() const { return _volumeMatrix; }
+
+	// Narrows [t0, t1] along the segment from a to b, both in the volume's
+	// unit cube, to the part left; false when none is.
+	bool clipSegment(const osg::Vec3& a, const osg::Vec3& b, float& t0, float& t1) const;
+
+	// True when all of box, in the volume's unit cube, is cut away.
+	bool clipsAway(const osg::BoundingBox& box) const;
+
+	// Makes the program of a technique's stateset clip, with the proxy cube
+	// of its tile mapped into the volume's by proxyToVolume. False when the
+	// shaders are not ones it knows where to cut the rays in.
+	bool apply(osg::StateSet* stateset, const osg::Matrix& proxyToVolume) const;
+
+protected:
+	virtual ~VolumeClipping() {}
+
+	osg::Vec4 _planes[MaxPlanes];
+	unsigned int _numPlanes;
+	// the volume's unit cube into the box's
+	osg::Matrix _box;
+	bool _boxEnabled;
+	osg::Matrix _volumeMatrix;
+
+	osg::ref_ptr<osg::Uniform> _planesUniform;
+	osg::ref_ptr<osg::Uniform> _boxUniform;
+};
+
+#endif
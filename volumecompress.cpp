@@ -0,0 +1,141 @@
+#include "volumecompress.h"
+#include "volumeprofile.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+const size_t BlockSize = 64;
+
+template<typename T>
+void compressBlocks(const T* values, size_t count, std::vector<unsigned char>& out)
+{
+	for (size_t begin = 0; begin < count; begin += BlockSize)
+	{
+		size_t n = std::min(BlockSize, count-begin);
+		const T* block = values+begin;
+
+		T minValue = block[0], maxValue = block[0];
+		for (size_t i = 1; i < n; ++i)
+		{
+			minValue = std::min(minValue, block[i]);
+			maxValue = std::max(maxValue, block[i]);
+		}
+		unsigned int range = maxValue - minValue;
+		unsigned int width = 0;
+		while((range>>width)!=0) ++width;
+
+		// minimum, width in bits, then the offsets packed low bit first
+		size_t pos = out.size();
+		out.resize(pos + sizeof(T) + 1 + (n*width+7)/8);
+		memcpy(&out[pos], &minValue, sizeof(T));
+		out[pos+sizeof(T)] = static_cast<unsigned char>(width);
+		if (width==0) continue;
+
+		unsigned char* bits = &out[pos+sizeof(T)+1];
+		unsigned int buffer = 0;
+		unsigned int filled = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			buffer |= static_cast<unsigned int>(block[i]-minValue) << filled;
+			filled += width;
+			while(filled>=8)
+			{
+				*bits++ = static_cast<unsigned char>(buffer);
+				buffer >>= 8;
+				filled -= 8;
+			}
+		}
+		if (filled>0) *bits = static_cast<unsigned char>(buffer);
+	}
+}
+
+template<typename T>
+bool decompressBlocks(const unsigned char* in, const unsigned char* end, T* values, size_t count)
+{
+	for (size_t begin = 0; begin < count; begin += BlockSize)
+	{
+		size_t n = std::min(BlockSize, count-begin);
+		if (in+sizeof(T)+1>end) return false;
+
+		T minValue;
+		memcpy(&minValue, in, sizeof(T));
+		unsigned int width = in[sizeof(T)];
+		in += sizeof(T)+1;
+
+		T* block = values+begin;
+		size_t numBytes = (n*width+7)/8;
+		if (width>sizeof(T)*8 || in+numBytes>end) return false;
+		if (width==0)
+		{
+			std::fill(block, block+n, minValue);
+			continue;
+		}
+
+		const unsigned char* bits = in;
+		unsigned int mask = (1u<<width) - 1;
+		unsigned int buffer = 0;
+		unsigned int filled = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			while(filled<width)
+			{
+				buffer |= static_cast<unsigned int>(*bits++) << filled;
+				filled += 8;
+			}
+			block[i] = static_cast<T>(minValue + (buffer & mask));
+			buffer >>= width;
+			filled -= width;
+		}
+		in += numBytes;
+	}
+	return in==end;
+}
+
+}
+
+CompressedVoxels* CompressedVoxels::compress(const osg::Image* image)
+{
+	GLenum dataType = image->getDataType();
+	if (dataType!=GL_UNSIGNED_BYTE && dataType!=GL_UNSIGNED_SHORT) return 0;
+
+	size_t rowBytes = (size_t)image->s()*image->getPixelSizeInBits()/8;
+	if (image->getRowSizeInBytes()!=rowBytes) return 0;
+
+	ProfileScope scope("compressBrick");
+	osg::ref_ptr<CompressedVoxels> compressed = new CompressedVoxels;
+	compressed->_s = image->s();
+	compressed->_t = image->t();
+	compressed->_r = image->r();
+	compressed->_pixelFormat = image->getPixelFormat();
+	compressed->_dataType = dataType;
+	compressed->_internalFormat = image->getInternalTextureFormat();
+	compressed->_count = (size_t)image->s()*image->t()*image->r()*osg::Image::computeNumComponents(image->getPixelFormat());
+
+	if (dataType==GL_UNSIGNED_BYTE) compressBlocks(image->data(), compressed->_count, compressed->_data);
+	else compressBlocks(reinterpret_cast<const unsigned short*>(image->data()), compressed->_count, compressed->_data);
+
+	// noise does not compress, the brick is better copied from the source again
+	if (compressed->_data.size()>=compressed->getSize()) return 0;
+
+	// the runs are all written, the slack of the doublings is not needed
+	std::vector<unsigned char>(compressed->_data).swap(compressed->_data);
+	return compressed.release();
+}
+
+osg::Image* CompressedVoxels::decompress() const
+{
+	ProfileScope scope("decompressBrick");
+	osg::ref_ptr<osg::Image> image = new osg::Image;
+	image->allocateImage(_s, _t, _r, _pixelFormat, _dataType, 1);
+	if (!image->data()) return 0;
+	image->setInternalTextureFormat(_internalFormat);
+
+	const unsigned char* begin = _data.empty() ? 0 : &_data[0];
+	bool ok = _dataType==GL_UNSIGNED_BYTE ?
+		decompressBlocks(begin, begin+_data.size(), image->data(), _count) :
+		decompressBlocks(begin, begin+_data.size(), reinterpret_cast<unsigned short*>(image->data()), _count);
+	return ok ? image.release() : 0;
+}
@@ -0,0 +1,40 @@
+#ifndef	__AJ_VOLUMECOMPRESS__
+#define __AJ_VOLUMECOMPRESS__
+
+#include <osg/Image>
+
+#include <vector>
+
+// Voxels held losslessly compressed in host memory, for bricks out of view.
+//
+// Values go in runs of 64 in memory order, each stored as its minimum and
+// the offsets from it in as few bits as the run's range needs. Scans are
+// mostly smooth or empty, so runs of air cost a few bytes and tissue a
+// fraction of its size; quantizing to 12 bits shortens every offset further.
+// Decoding is a shift and a mask per voxel, cheap enough for the pager thread
+// to do just before the brick is uploaded.
+class CompressedVoxels : public osg::Referenced
+{
+public:
+	// Returns 0 for data types other than unsigned byte and unsigned short,
+	// for images whose rows are padded and when compression would not save anything.
+	static CompressedVoxels* compress(const osg::Image* image);
+
+	osg::Image* decompress() const;
+
+	size_t getCompressedSize() const { return _data.size(); }
+	size_t getSize() const { return _count*(_dataType==GL_UNSIGNED_SHORT ? 2 : 1); }
+
+protected:
+	CompressedVoxels() {}
+	virtual ~CompressedVoxels() {}
+
+	int _s, _t, _r;
+	GLenum _pixelFormat;
+	GLenum _dataType;
+	GLint _internalFormat;
+	size_t _count;
+	std::vector<unsigned char> _data;
+};
+
+#endif
@@ -0,0 +1,517 @@
+#include "volumedata.h"
+#include "sliceloader.h"
+#include "rawreader.h"
+#include "volumekernels.h"
+#include "volumeprofile.h"
+
+#include <osg/Notify>
+#include <osg/io_utils>
+#include <osgDB/ReadFile>
+#include <osgDB/FileNameUtils>
+#include <osgVolume/Layer>
+
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+VolumeOptions::VolumeOptions()
+	: numComponentsDesired(0),
+	s_maximumTextureSize(256),
+	t_maximumTextureSize(256),
+	r_maximumTextureSize(256),
+	resizeToPowerOfTwo(false),
+	colourSpaceOperation(osg::NO_COLOR_SPACE_OPERATION),
+	colourModulate(0.25f,0.25f,0.25f,0.25f),
+	rescaleOperation(RESCALE_TO_ZERO_TO_ONE_RANGE),
+	quantizeBits(0),
+	rawSizeX(0),
+	rawSizeY(0),
+	rawSizeZ(0),
+	rawBytesPerComponent(1),
+	rawComponents(1),
+	rawEndian("little")
+{
+}
+
+VolumeData::VolumeData()
+	: texelOffset(0.0f,0.0f,0.0f,0.0f),
+	texelScale(1.0f,1.0f,1.0f,1.0f),
+	minValue(FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX),
+	maxValue(-FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX)
+{
+}
+
+osg::Image* createTexture3D(osg::ImageList& imageList,
+            unsigned int numComponentsDesired,
+            int s_maximumTextureSize,
+            int t_maximumTextureSize,
+            int r_maximumTextureSize,
+            bool resizeToPowerOfTwo)
+{
+
+    // single channel stays single channel, createImage3DWithAlpha would add a copy as alpha
+    if (numComponentsDesired==0 && !imageList.empty() && imageList.front()->getPixelFormat()==GL_LUMINANCE)
+    {
+        numComponentsDesired = 1;
+    }
+
+    if (numComponentsDesired==0)
+    {
+        return osg::createImage3DWithAlpha(imageList,
+                                        s_maximumTextureSize,
+                                        t_maximumTextureSize,
+                                        r_maximumTextureSize,
+                                        resizeToPowerOfTwo);
+    }
+    else
+    {
+        GLenum desiredPixelFormat = 0;
+        switch(numComponentsDesired)
+        {
+            case(1) : desiredPixelFormat = GL_LUMINANCE; break;
+            case(2) : desiredPixelFormat = GL_LUMINANCE_ALPHA; break;
+            case(3) : desiredPixelFormat = GL_RGB; break;
+            case(4) : desiredPixelFormat = GL_RGBA; break;
+        }
+
+        return osg::createImage3D(imageList,
+                                        desiredPixelFormat,
+                                        s_maximumTextureSize,
+                                        t_maximumTextureSize,
+                                        r_maximumTextureSize,
+                                        resizeToPowerOfTwo);
+    }
+}
+
+osgDB::DirectoryContents volumeSourceFiles(const std::string& imageFile)
+{
+	if (imageFile.find('*') != std::string::npos) return osgDB::expandWildcardsInFilename(imageFile);
+
+	osgDB::DirectoryContents contents;
+	contents.push_back(imageFile);
+	return contents;
+}
+
+osg::Image* readVolumeImage(const std::string& imageFile, const VolumeOptions& options, VolumeReadInfo* info)
+{
+	ProfileScope scope("readVolume");
+	osg::Image* image = 0;
+	if (imageFile.empty()) return image;
+
+	std::string ext = osgDB::getLowerCaseFileExtension(imageFile);
+	if (ext == "nrrd" || ext == "nhdr" || options.rawSizeX > 0)
+	{
+		// binary volumes are mapped as they are, no decode and no packing.
+		image = (options.rawSizeX > 0) ?
+			readRaw(options.rawSizeX, options.rawSizeY, options.rawSizeZ, options.rawBytesPerComponent, options.rawComponents, options.rawEndian, imageFile) :
+			readNrrd(imageFile);
+
+		if (image && (image->s()>options.s_maximumTextureSize || image->t()>options.t_maximumTextureSize || image->r()>options.r_maximumTextureSize))
+		{
+			// osg::Image can not rescale 3D images, and copying would defeat the mapping.
+			OSG_NOTICE<<"Warning: mapped volume exceeds the maximum texture size of "<<options.s_maximumTextureSize<<"x"<<options.t_maximumTextureSize<<"x"<<options.r_maximumTextureSize<<", using it at full resolution."<<std::endl;
+		}
+	}
+	else if (imageFile.find('*') != std::string::npos)
+	{
+		// decode the slices straight into the 3D image, converting and reducing them as they arrive.
+		SliceLoader loader;
+		image = loader.loadVolume(volumeSourceFiles(imageFile), options.numComponentsDesired,
+								options.s_maximumTextureSize, options.t_maximumTextureSize, options.r_maximumTextureSize,
+								options.resizeToPowerOfTwo, options.colourSpaceOperation, options.colourModulate);
+		loader.report();
+
+		float minValue, maxValue;
+		if (image && info)
+		{
+			info->colourConverted = true;
+			if (loader.getRange(minValue, maxValue)) info->range.set(minValue, maxValue);
+		}
+	}
+	else
+	{
+		osg::ImageList imageList;
+
+		// not an option so assume string is a filename.
+		osg::Image *slice = osgDB::readImageFile( imageFile );
+
+		if(slice)
+		{
+			OSG_NOTICE<<"Read osg::Image FileName::"<<slice->getFileName()<<", pixelFormat=0x"<<std::hex<<slice->getPixelFormat()<<std::dec<<", s="<<slice->s()<<", t="<<slice->t()<<", r="<<slice->r()<<std::endl;
+			imageList.push_back(slice);
+		}
+
+		// pack the textures into a single texture.
+		image = createTexture3D(imageList, options.numComponentsDesired,
+								options.s_maximumTextureSize, options.t_maximumTextureSize, options.r_maximumTextureSize,
+								options.resizeToPowerOfTwo);
+	}
+
+	return image;
+}
+
+namespace
+{
+
+// the integer types round to nearest, float stays exact
+template<typename T> inline T averageOf8(float sum) { return static_cast<T>(sum*0.125f + 0.5f); }
+template<> inline float averageOf8<float>(float sum) { return sum*0.125f; }
+
+template<typename T>
+void halveVolume(const osg::Image* source, osg::Image* dest, unsigned int numComponents)
+{
+	for (int r = 0; r < dest->r(); ++r)
+	{
+		int r0 = 2*r, r1 = std::min(2*r+1, source->r()-1);
+		for (int t = 0; t < dest->t(); ++t)
+		{
+			int t0 = 2*t, t1 = std::min(2*t+1, source->t()-1);
+			const T* rows[4] =
+			{
+				reinterpret_cast<const T*>(source->data(0, t0, r0)),
+				reinterpret_cast<const T*>(source->data(0, t1, r0)),
+				reinterpret_cast<const T*>(source->data(0, t0, r1)),
+				reinterpret_cast<const T*>(source->data(0, t1, r1))
+			};
+			T* out = reinterpret_cast<T*>(dest->data(0, t, r));
+
+			for (int s = 0; s < dest->s(); ++s)
+			{
+				unsigned int s0 = 2*s*numComponents;
+				unsigned int s1 = std::min(2*s+1, source->s()-1)*numComponents;
+				for (unsigned int c = 0; c < numComponents; ++c)
+				{
+					float sum = 0.0f;
+					for (unsigned int i = 0; i < 4; ++i) sum += float(rows[i][s0+c]) + float(rows[i][s1+c]);
+					*out++ = averageOf8<T>(sum);
+				}
+			}
+		}
+	}
+}
+
+}
+
+osg::Image* halveVolume(const osg::Image* image)
+{
+	ProfileScope scope("halveVolume");
+	GLenum dataType = image->getDataType();
+	if (dataType!=GL_UNSIGNED_BYTE && dataType!=GL_UNSIGNED_SHORT && dataType!=GL_FLOAT) return 0;
+
+	osg::ref_ptr<osg::Image> halved = new osg::Image;
+	halved->allocateImage(std::max(1, (image->s()+1)/2), std::max(1, (image->t()+1)/2), std::max(1, (image->r()+1)/2),
+						image->getPixelFormat(), dataType, 1);
+	if (!halved->data()) return 0;
+	halved->setInternalTextureFormat(image->getInternalTextureFormat());
+
+	unsigned int numComponents = osg::Image::computeNumComponents(image->getPixelFormat());
+	switch(dataType)
+	{
+		case(GL_UNSIGNED_BYTE): halveVolume<unsigned char>(image, halved.get(), numComponents); break;
+		case(GL_UNSIGNED_SHORT): halveVolume<unsigned short>(image, halved.get(), numComponents); break;
+		case(GL_FLOAT): halveVolume<float>(image, halved.get(), numComponents); break;
+	}
+	return halved.release();
+}
+
+unsigned int volumeValueComponent(const osg::Image* image)
+{
+	GLint internalFormat = image->getInternalTextureFormat();
+	if (internalFormat==GL_INTENSITY || internalFormat==GL_INTENSITY8 || internalFormat==GL_INTENSITY12 || internalFormat==GL_INTENSITY16) return 0;
+	GLenum format = image->getPixelFormat();
+	bool hasAlpha = format==GL_ALPHA || format==GL_LUMINANCE_ALPHA || format==GL_RGBA || format==GL_BGRA;
+	return hasAlpha ? osg::Image::computeNumComponents(format)-1 : 0;
+}
+
+unsigned int numWorkers(unsigned int numThreads, unsigned int numItems)
+{
+	if (numThreads==0) numThreads = OpenThreads::GetNumberOfProcessors();
+	return std::max(1u, std::min(numThreads, numItems));
+}
+
+float maximumValueThreshold(const osg::Image* image, float maximum)
+{
+	if (maximum<0.0f) return maximum;
+	float step = 0.0f;
+	switch(image->getDataType())
+	{
+		case(GL_UNSIGNED_BYTE): step = 1.0f/255.0f; break;
+		case(GL_UNSIGNED_SHORT): step = 1.0f/65535.0f; break;
+		default: break;
+	}
+	return maximum - step - 1e-3f;
+}
+
+namespace
+{
+
+// osg::computeMinMax fills the channels a format lacks with 1.0, and the
+// layer rescale takes the extremes over all four channels.
+void foldMissingChannels(const osg::Image* image, osg::Vec2& range)
+{
+	switch(image->getPixelFormat())
+	{
+		case(GL_RGB):
+		case(GL_BGR):
+		case(GL_ALPHA):
+			range.x() = std::min(range.x(), 1.0f);
+			range.y() = std::max(range.y(), 1.0f);
+			break;
+	}
+}
+
+bool computeVolumeRange(const osg::Image* image, osg::Vec2& range)
+{
+	ProfileScope scope("computeRange");
+	float minValue, maxValue;
+	if (!computeRange(image, minValue, maxValue)) return false;
+	range.set(minValue, maxValue);
+	return true;
+}
+
+// Signed shorts over to unsigned ones, which every pass, the levels and the
+// texture cover, with the texel mapping giving the signed values back. A
+// mapped volume has private pages and is converted where it lies.
+void unsignShortVolume(VolumeData* data)
+{
+	ProfileScope scope("unsignShorts");
+	osg::Image* image = data->image.get();
+	size_t count = static_cast<size_t>(image->getTotalSizeInBytes())/sizeof(short);
+	MappedImage* mapped = dynamic_cast<MappedImage*>(image);
+	if (mapped)
+	{
+		unsignShorts(mapped->data(), count);
+		mapped->setDataType(GL_UNSIGNED_SHORT);
+	}
+	else
+	{
+		osg::ref_ptr<osg::Image> converted = new osg::Image;
+		converted->allocateImage(image->s(), image->t(), image->r(), image->getPixelFormat(), GL_UNSIGNED_SHORT, image->getPacking());
+		if (!converted->data()) return;
+		converted->setFileName(image->getFileName());
+		converted->setUserData(image->getUserData());
+		memcpy(converted->data(), image->data(), converted->getTotalSizeInBytes());
+		unsignShorts(converted->data(), count);
+		data->image = converted;
+	}
+
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		data->texelOffset[i] += signedShortOffset*data->texelScale[i];
+		data->texelScale[i] *= signedShortScale;
+	}
+}
+
+// Applies v*scale + offset to every component, in normalised units, and
+// updates the texel mapping the way osgVolume::ImageLayer::offsetAndScaleImage does.
+void offsetAndScaleData(VolumeData* data, float offset, float scale)
+{
+	ProfileScope scope("rescale");
+	offsetAndScaleVolume(data->image.get(), offset, scale);
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		data->texelScale[i] /= scale;
+		data->texelOffset[i] -= offset*data->texelScale[i];
+	}
+}
+
+template<typename S, typename D>
+void quantizeVoxels(const osg::Image* source, osg::Image* dest, float normalise, unsigned int bits)
+{
+	// fewer bits than the type holds are replicated into the low ones, so the
+	// largest level still normalises to 1
+	const unsigned int storageBits = sizeof(D)*8;
+	const unsigned int levels = (1u<<bits) - 1;
+	const unsigned int shift = storageBits - bits;
+	const float scale = normalise*levels;
+
+	unsigned int rowLength = source->s()*osg::Image::computeNumComponents(source->getPixelFormat());
+	for (int r = 0; r < source->r(); ++r)
+	{
+		for (int t = 0; t < source->t(); ++t)
+		{
+			const S* in = reinterpret_cast<const S*>(source->data(0, t, r));
+			D* out = reinterpret_cast<D*>(dest->data(0, t, r));
+			for (unsigned int i = 0; i < rowLength; ++i)
+			{
+				float v = float(in[i])*scale + 0.5f;
+				unsigned int q = v<=0.0f ? 0 : (v>=float(levels) ? levels : static_cast<unsigned int>(v));
+				out[i] = static_cast<D>(shift ? (q<<shift) | (q>>(bits-shift)) : q);
+			}
+		}
+	}
+}
+
+// Brings the voxels down to bits per component, in the same normalised units.
+// Floats are first mapped onto [0,1] with the texel mapping following, so
+// values past it survive the conversion.
+void quantizeVolume(VolumeData* data, int bits)
+{
+	osg::Image* image = data->image.get();
+	GLenum dataType = image->getDataType();
+	GLenum quantizedType = bits<=8 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
+	if (dataType==GL_UNSIGNED_BYTE || (dataType==GL_UNSIGNED_SHORT && bits==16)) return;
+	if (dataType!=GL_UNSIGNED_SHORT && dataType!=GL_FLOAT)
+	{
+		OSG_NOTICE<<"Quantization does not cover data type 0x"<<std::hex<<dataType<<std::dec<<", keeping it."<<std::endl;
+		return;
+	}
+
+	ProfileScope scope("quantize");
+	if (dataType==GL_FLOAT)
+	{
+		float minValue, maxValue;
+		if (computeRange(image, minValue, maxValue) && (minValue<0.0f || maxValue>1.0f))
+		{
+			float scale = maxValue>minValue ? 1.0f/(maxValue-minValue) : 1.0f;
+			offsetAndScaleData(data, -minValue*scale, scale);
+		}
+	}
+
+	osg::ref_ptr<osg::Image> quantized = new osg::Image;
+	quantized->allocateImage(image->s(), image->t(), image->r(), image->getPixelFormat(), quantizedType, 1);
+	if (!quantized->data()) return;
+	quantized->setFileName(image->getFileName());
+
+	bits = bits<=8 ? 8 : (bits<=12 ? 12 : 16);
+	float normalise = dataType==GL_UNSIGNED_SHORT ? 1.0f/65535.0f : 1.0f;
+	if (dataType==GL_UNSIGNED_SHORT)
+	{
+		if (quantizedType==GL_UNSIGNED_BYTE) quantizeVoxels<unsigned short, unsigned char>(image, quantized.get(), normalise, bits);
+		else quantizeVoxels<unsigned short, unsigned short>(image, quantized.get(), normalise, bits);
+	}
+	else
+	{
+		if (quantizedType==GL_UNSIGNED_BYTE) quantizeVoxels<float, unsigned char>(image, quantized.get(), normalise, bits);
+		else quantizeVoxels<float, unsigned short>(image, quantized.get(), normalise, bits);
+	}
+
+	OSG_NOTICE<<"Quantized volume to "<<bits<<" bits, "<<image->getTotalSizeInBytes()/(1024*1024)<<"MB to "<<quantized->getTotalSizeInBytes()/(1024*1024)<<"MB"<<std::endl;
+	data->image = quantized;
+}
+
+// The last stage of loading: the data type and the texture format the volume keeps.
+void selectVolumeFormat(VolumeData* data, const VolumeOptions& options)
+{
+	if (options.quantizeBits>0) quantizeVolume(data, options.quantizeBits);
+
+	// one channel that reads back in alpha as well, as the L+A copy
+	// createImage3DWithAlpha makes would, at half the texture memory
+	osg::Image* image = data->image.get();
+	if (image->getPixelFormat()==GL_LUMINANCE)
+	{
+		if (image->getDataType()==GL_UNSIGNED_BYTE) image->setInternalTextureFormat(GL_INTENSITY8);
+		else if (image->getDataType()==GL_UNSIGNED_SHORT) image->setInternalTextureFormat(GL_INTENSITY16);
+	}
+}
+
+}
+
+VolumeData* loadVolumeData(const std::string& imageFile, const VolumeOptions& options)
+{
+	osg::ref_ptr<VolumeData> data = new VolumeData;
+	VolumeReadInfo info;
+	data->image = readVolumeImage(imageFile, options, &info);
+	if (!data->image)
+	{
+		OSG_NOTICE<<"Unable to create 3D image from source files."<<std::endl;
+		return 0;
+	}
+
+	osg::ref_ptr<osgVolume::ImageDetails> details = dynamic_cast<osgVolume::ImageDetails*>(data->image->getUserData());
+	data->matrix = details ? details->getMatrix() : dynamic_cast<osg::RefMatrix*>(data->image->getUserData());
+	if (details)
+	{
+		data->texelOffset = details->getTexelOffset();
+		data->texelScale = details->getTexelScale();
+	}
+
+	if (data->image->getDataType()==GL_SHORT)
+	{
+		// any range the reader found is of the signed values
+		unsignShortVolume(data.get());
+		info.range.set(FLT_MAX, -FLT_MAX);
+	}
+
+	// the slice loader has the range already, mapped volumes take one vectorised pass
+	osg::Vec2 range = info.range;
+	bool haveRange = range.x()<=range.y() || computeVolumeRange(data->image.get(), range);
+	if (haveRange)
+	{
+		foldMissingChannels(data->image.get(), range);
+		data->minValue.set(range.x(), range.x(), range.x(), range.x());
+		data->maxValue.set(range.y(), range.y(), range.y(), range.y());
+	}
+	else if (osg::computeMinMax(data->image.get(), data->minValue, data->maxValue))
+	{
+		// a data type the kernels do not cover
+		float minValue = std::min(std::min(data->minValue[0], data->minValue[1]), std::min(data->minValue[2], data->minValue[3]));
+		float maxValue = std::max(std::max(data->maxValue[0], data->maxValue[1]), std::max(data->maxValue[2], data->maxValue[3]));
+		range.set(minValue, maxValue);
+	}
+
+	if (range.x()<=range.y())
+	{
+		osg::notify(osg::NOTICE)<<"Min value "<<data->minValue<<std::endl;
+		osg::notify(osg::NOTICE)<<"Max value "<<data->maxValue<<std::endl;
+	}
+
+	if (options.colourSpaceOperation!=osg::NO_COLOR_SPACE_OPERATION && !info.colourConverted)
+	{
+		data->image = osg::colorSpaceConversion(options.colourSpaceOperation, data->image.get(), options.colourModulate);
+
+		// the rescale works on the converted values
+		range.set(FLT_MAX, -FLT_MAX);
+		haveRange = computeVolumeRange(data->image.get(), range);
+		if (haveRange)
+		{
+			foldMissingChannels(data->image.get(), range);
+			data->minValue.set(range.x(), range.x(), range.x(), range.x());
+			data->maxValue.set(range.y(), range.y(), range.y(), range.y());
+		}
+	}
+
+	if (!haveRange)
+	{
+		// fall back on the layer for the data types the kernels do not cover
+		osg::ref_ptr<osgVolume::ImageLayer> layer = new osgVolume::ImageLayer(data->image.get());
+		layer->setTexelOffset(data->texelOffset);
+		layer->setTexelScale(data->texelScale);
+
+		if (options.rescaleOperation==RESCALE_TO_ZERO_TO_ONE_RANGE) layer->rescaleToZeroToOneRange();
+		else if (options.rescaleOperation==SHIFT_MIN_TO_ZERO) layer->translateMinToZero();
+
+		data->texelOffset = layer->getTexelOffset();
+		data->texelScale = layer->getTexelScale();
+		selectVolumeFormat(data.get(), options);
+		return data.release();
+	}
+
+	switch(options.rescaleOperation)
+	{
+		case(NO_RESCALE):
+			break;
+
+		case(RESCALE_TO_ZERO_TO_ONE_RANGE):
+		{
+			// same mapping as osgVolume::ImageLayer::rescaleToZeroToOneRange
+			if (range.y()>range.x())
+			{
+				float scale = 0.99f/(range.y()-range.x());
+				float offset = -range.x()*scale;
+				offsetAndScaleData(data.get(), offset, scale);
+			}
+			break;
+		}
+		case(SHIFT_MIN_TO_ZERO):
+		{
+			if (range.x()!=0.0f) offsetAndScaleData(data.get(), -range.x(), 1.0f);
+			break;
+		}
+	};
+
+	selectVolumeFormat(data.get(), options);
+	return data.release();
+}
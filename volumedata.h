@@ -0,0 +1,134 @@
+#ifndef	__AJ_VOLUMEDATA__
+#define __AJ_VOLUMEDATA__
+
+#include <osg/Image>
+#include <osg/ImageUtils>
+#include <osg/Matrix>
+#include <osgDB/FileUtils>
+
+#include <cfloat>
+#include <string>
+#include <vector>
+
+enum RescaleOperation
+{
+	NO_RESCALE,
+	RESCALE_TO_ZERO_TO_ONE_RANGE,
+	SHIFT_MIN_TO_ZERO
+};
+
+// Everything that decides what the preprocessed volume looks like.
+struct VolumeOptions
+{
+	VolumeOptions();
+
+	unsigned int numComponentsDesired;
+	int s_maximumTextureSize;
+	int t_maximumTextureSize;
+	int r_maximumTextureSize;
+	bool resizeToPowerOfTwo;
+
+	osg::ColorSpaceOperation colourSpaceOperation;
+	osg::Vec4 colourModulate;
+	RescaleOperation rescaleOperation;
+
+	// bits per component kept after the rescale: 8, or 12 or 16 held in
+	// shorts; 0 keeps the data type read. Never widens the data.
+	int quantizeBits;
+
+	// layout of a .raw file, which has no header to read it from
+	int rawSizeX;
+	int rawSizeY;
+	int rawSizeZ;
+	int rawBytesPerComponent;
+	int rawComponents;
+	std::string rawEndian;
+};
+
+// The volume as the renderer consumes it: packed, colour converted and rescaled.
+class VolumeData : public osg::Referenced
+{
+public:
+	VolumeData();
+
+	osg::ref_ptr<osg::Image> image;
+
+	// the matrix the source came with, if any
+	osg::ref_ptr<osg::RefMatrix> matrix;
+
+	// for the osgVolume::ImageLayer, maps rescaled texels back to source values
+	osg::Vec4 texelOffset;
+	osg::Vec4 texelScale;
+
+	// range over all components of the values the rescale saw
+	osg::Vec4 minValue;
+	osg::Vec4 maxValue;
+
+protected:
+	virtual ~VolumeData() {}
+};
+
+// The files imageFile stands for: the stack matched by a wildcard, otherwise the file itself.
+osgDB::DirectoryContents volumeSourceFiles(const std::string& imageFile);
+
+// What a reader already did to the image on the way, sparing loadVolumeData those passes.
+struct VolumeReadInfo
+{
+	VolumeReadInfo() : range(FLT_MAX, -FLT_MAX), colourConverted(false) {}
+
+	// over all components of the image as returned, valid when x <= y
+	osg::Vec2 range;
+
+	// options.colourSpaceOperation has been applied
+	bool colourConverted;
+};
+
+// Reads imageFile into a single 3D image. Image stacks come back colour
+// converted, the other sources without any preprocessing.
+osg::Image* readVolumeImage(const std::string& imageFile, const VolumeOptions& options, VolumeReadInfo* info = 0);
+
+// Halves image along each axis with a 2x2x2 box filter, for the level of
+// detail pyramid; odd sizes round up by repeating the last voxel. Returns 0
+// for data types other than unsigned byte, unsigned short and float.
+osg::Image* halveVolume(const osg::Image* image);
+
+// The component of image that texture3D() hands the shaders the value in:
+// alpha where the texture has one, the first component otherwise.
+unsigned int volumeValueComponent(const osg::Image* image);
+
+// Where maximum intensity projection can stop in image, whose largest value
+// as the shaders read it is maximum: the texel holding it may have been
+// truncated by one step of the data type, and filtering rarely gives it back
+// exactly. Negative, never, when maximum is.
+float maximumValueThreshold(const osg::Image* image, float maximum);
+
+// A voxel as the shaders read it from the texture: integers normalised to
+// 0..1, floats as they are.
+template<typename T> inline float normalised(T v) { return float(v); }
+template<> inline float normalised<unsigned char>(unsigned char v) { return v/255.0f; }
+template<> inline float normalised<unsigned short>(unsigned short v) { return v/65535.0f; }
+
+// The longest central difference of normalised values, sqrt(3), inverted:
+// scales gradient magnitudes into 0..1.
+const float inverseSqrtThree = 0.57735027f;
+
+// How many threads share out numItems: numThreads, 0 for one per processor,
+// but no more than there are items, and at least one.
+unsigned int numWorkers(unsigned int numThreads, unsigned int numItems);
+
+// Runs workers, OpenThreads threads taking their items off a shared task, to
+// the end; the calling thread is the last worker. The caller still owns them,
+// to gather what each did and delete them.
+template<class Worker>
+void runWorkers(const std::vector<Worker*>& workers)
+{
+	if (workers.empty()) return;
+	for (unsigned int i = 0; i+1 < workers.size(); ++i) workers[i]->start();
+	workers.back()->run();
+	for (unsigned int i = 0; i+1 < workers.size(); ++i) workers[i]->join();
+}
+
+// Reads imageFile and runs the preprocessing passes on it.
+VolumeData* loadVolumeData(const std::string& imageFile, const VolumeOptions& options);
+
+#endif
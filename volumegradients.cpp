@@ -0,0 +1,177 @@
+#include "volumegradients.h"
+#include "volumedata.h"
+#include "volumeprofile.h"
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define VOLUME_GRADIENTS_SSE2
+	#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+// slices a worker takes at a time, each slab loads two more for its neighbours
+const int slabSize = 8;
+
+template<typename T>
+void loadSlice(const osg::Image* image, int r, unsigned int numComponents, unsigned int component, float* values)
+{
+	for (int t = 0; t < image->t(); ++t)
+	{
+		const T* voxel = reinterpret_cast<const T*>(image->data(0, t, r)) + component;
+		for (int s = 0; s < image->s(); ++s, voxel += numComponents) *(values++) = normalised(*voxel);
+	}
+}
+
+void packGradient(float gx, float gy, float gz, unsigned char* pixel)
+{
+	float length = sqrtf(gx*gx + gy*gy + gz*gz);
+	float scale = length>0.0f ? 127.5f/length : 0.0f;
+	pixel[0] = static_cast<unsigned char>(gx*scale + 128.0f);
+	pixel[1] = static_cast<unsigned char>(gy*scale + 128.0f);
+	pixel[2] = static_cast<unsigned char>(gz*scale + 128.0f);
+	pixel[3] = static_cast<unsigned char>(std::min(sqrtf(length*inverseSqrtThree)*255.0f + 0.5f, 255.0f));
+}
+
+// One row of the gradients from the values of the same row in the slices
+// before and after, and of the rows below and above in its own slice.
+void gradientRow(const float* previous, const float* row, const float* next, const float* down, const float* up,
+				int width, unsigned char* pixels)
+{
+	int last = width-1;
+	packGradient(row[std::min(1, last)] - row[0], up[0] - down[0], next[0] - previous[0], pixels);
+	if (last==0) return;
+
+	int s = 1;
+#if defined(VOLUME_GRADIENTS_SSE2)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 half = _mm_set1_ps(127.5f);
+	const __m128 centre = _mm_set1_ps(128.0f);
+	const __m128 slopeScale = _mm_set1_ps(inverseSqrtThree);
+	const __m128 byteScale = _mm_set1_ps(255.0f);
+	const __m128 round = _mm_set1_ps(0.5f);
+	const __m128 byteMax = _mm_set1_ps(255.0f);
+	for(; s+4<=last; s+=4)
+	{
+		__m128 gx = _mm_sub_ps(_mm_loadu_ps(row+s+1), _mm_loadu_ps(row+s-1));
+		__m128 gy = _mm_sub_ps(_mm_loadu_ps(up+s), _mm_loadu_ps(down+s));
+		__m128 gz = _mm_sub_ps(_mm_loadu_ps(next+s), _mm_loadu_ps(previous+s));
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), _mm_mul_ps(gz, gz)));
+
+		// flat voxels get the 0/0 of their scale masked to 0
+		__m128 scale = _mm_and_ps(_mm_cmpgt_ps(length, zero), _mm_div_ps(half, length));
+		__m128i r = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(gx, scale), centre));
+		__m128i g = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(gy, scale), centre));
+		__m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(gz, scale), centre));
+		__m128i a = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(_mm_mul_ps(length, slopeScale)), byteScale), round), byteMax));
+
+		// each lane one RGBA pixel, red in the lowest byte
+		__m128i packed = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + s*4), packed);
+	}
+#endif
+	for(; s<last; ++s)
+	{
+		packGradient(row[s+1] - row[s-1], up[s] - down[s], next[s] - previous[s], pixels + s*4);
+	}
+	packGradient(row[last] - row[last-1], up[last] - down[last], next[last] - previous[last], pixels + last*4);
+}
+
+struct GradientTask
+{
+	const osg::Image* image;
+	osg::Image* gradients;
+	unsigned int numComponents;
+	unsigned int component;
+	OpenThreads::Atomic next;
+
+	void loadValues(int r, float* values) const
+	{
+		switch(image->getDataType())
+		{
+			case(GL_UNSIGNED_BYTE): loadSlice<unsigned char>(image, r, numComponents, component, values); break;
+			case(GL_UNSIGNED_SHORT): loadSlice<unsigned short>(image, r, numComponents, component, values); break;
+			case(GL_FLOAT): loadSlice<float>(image, r, numComponents, component, values); break;
+		}
+	}
+};
+
+// Takes the next slab off the task until there are none left, with the
+// values of three slices at hand: the one worked on and its neighbours.
+class GradientWorker : public OpenThreads::Thread
+{
+public:
+	GradientWorker(GradientTask& task) : _task(task) {}
+
+	virtual void run()
+	{
+		int width = _task.image->s(), height = _task.image->t(), depth = _task.image->r();
+		size_t sliceSize = size_t(width)*height;
+		std::vector<float> previous(sliceSize), current(sliceSize), next(sliceSize);
+		for(;;)
+		{
+			int z0 = (++_task.next - 1)*slabSize;
+			if (z0>=depth) return;
+			int z1 = std::min(z0+slabSize, depth);
+
+			_task.loadValues(std::max(z0-1, 0), &previous[0]);
+			_task.loadValues(z0, &current[0]);
+			_task.loadValues(std::min(z0+1, depth-1), &next[0]);
+			for (int r = z0; r < z1; ++r)
+			{
+				for (int t = 0; t < height; ++t)
+				{
+					const float* row = &current[0] + size_t(t)*width;
+					const float* down = &current[0] + size_t(std::max(t-1, 0))*width;
+					const float* up = &current[0] + size_t(std::min(t+1, height-1))*width;
+					gradientRow(&previous[0] + size_t(t)*width, row, &next[0] + size_t(t)*width, down, up,
+								width, _task.gradients->data(0, t, r));
+				}
+
+				if (r+1>=z1) break;
+				previous.swap(current);
+				current.swap(next);
+				_task.loadValues(std::min(r+2, depth-1), &next[0]);
+			}
+		}
+	}
+
+private:
+	GradientTask& _task;
+};
+
+}
+
+osg::Image* computeGradients(const osg::Image* image, unsigned int numThreads)
+{
+	if (!image || !image->data()) return 0;
+	GLenum dataType = image->getDataType();
+	if (dataType!=GL_UNSIGNED_BYTE && dataType!=GL_UNSIGNED_SHORT && dataType!=GL_FLOAT) return 0;
+
+	ProfileScope scope("gradients");
+	osg::ref_ptr<osg::Image> gradients = new osg::Image;
+	gradients->allocateImage(image->s(), image->t(), image->r(), GL_RGBA, GL_UNSIGNED_BYTE);
+	if (!gradients->data()) return 0;
+	gradients->setInternalTextureFormat(GL_RGBA8);
+
+	GradientTask task;
+	task.image = image;
+	task.gradients = gradients.get();
+	task.numComponents = osg::Image::computeNumComponents(image->getPixelFormat());
+	task.component = volumeValueComponent(image);
+
+	unsigned int numSlabs = (image->r()+slabSize-1)/slabSize;
+	std::vector<GradientWorker*> workers;
+	for (unsigned int i = 0; i < numWorkers(numThreads, numSlabs); ++i) workers.push_back(new GradientWorker(task));
+	runWorkers(workers);
+	for (unsigned int i = 0; i < workers.size(); ++i) delete workers[i];
+
+	return gradients.release();
+}
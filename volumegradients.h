@@ -0,0 +1,22 @@
+#ifndef	__AJ_VOLUMEGRADIENTS__
+#define __AJ_VOLUMEGRADIENTS__
+
+#include <osg/Image>
+
+// The gradient of a volume's value worked out once, for lit shading to read
+// in one lookup instead of six. Central differences one voxel apart, clamped
+// at the faces, as the lit shaders take them, of the component they read:
+// alpha where the texture has one, the first component otherwise.
+//
+// The result is GL_RGBA GL_UNSIGNED_BYTE of the volume's size: the unit
+// normal in rgb as n*0.5+0.5, and in alpha the square root of the gradient's
+// length over sqrt(3), the longest it gets for values in [0,1], so gentle
+// slopes keep more of the eight bits than steep ones.
+//
+// Slabs of slices are shared out among numThreads threads, 0 for one per
+// processor; within a row four voxels go at a time through SSE2 where the
+// compiler targets it. 0 for data types other than GL_UNSIGNED_BYTE,
+// GL_UNSIGNED_SHORT and GL_FLOAT.
+osg::Image* computeGradients(const osg::Image* image, unsigned int numThreads = 0);
+
+#endif
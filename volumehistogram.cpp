@@ -0,0 +1,253 @@
+#include "volumehistogram.h"
+#include "volumedata.h"
+#include "volumeprofile.h"
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+
+struct HistogramTask
+{
+	const osg::Image* image;
+	// the voxels [s0,s1)x[t0,t1)x[r0,r1) counted
+	int box[6];
+	// only the range is wanted, for a histogram without one
+	bool rangeOnly;
+	float low;
+	float high;
+	unsigned int bins;
+	unsigned int gradientBins;
+	OpenThreads::Atomic next;
+};
+
+// What one thread has counted.
+struct HistogramBins
+{
+	HistogramBins(const HistogramTask& task)
+		: counts(task.rangeOnly ? 0 : task.bins, 0),
+		jointCounts(task.rangeOnly ? 0 : task.bins*task.gradientBins, 0),
+		gradientSums(task.rangeOnly ? 0 : task.bins, 0.0),
+		total(0),
+		sum(0.0),
+		sumSquares(0.0),
+		minimum(FLT_MAX),
+		maximum(-FLT_MAX)
+	{
+	}
+
+	std::vector<unsigned long long> counts;
+	std::vector<unsigned long long> jointCounts;
+	std::vector<double> gradientSums;
+	unsigned long long total;
+	double sum;
+	double sumSquares;
+	float minimum;
+	float maximum;
+};
+
+template<typename T>
+void countSlice(const HistogramTask& task, int r, HistogramBins& bins)
+{
+	const osg::Image* image = task.image;
+	int width = image->s(), height = image->t(), depth = image->r();
+	size_t componentStride = osg::Image::computeNumComponents(image->getPixelFormat());
+	size_t rowStride = image->getRowSizeInBytes()/sizeof(T);
+	size_t sliceStride = image->getImageSizeInBytes()/sizeof(T);
+	const T* voxels = reinterpret_cast<const T*>(image->data()) + volumeValueComponent(image);
+
+	const T* slice = voxels + r*sliceStride;
+	const T* previous = voxels + std::max(r-1, 0)*sliceStride;
+	const T* next = voxels + std::min(r+1, depth-1)*sliceStride;
+
+	float range = task.high - task.low;
+	float binScale = range>0.0f ? task.bins/range : 0.0f;
+	float gradientScale = range>0.0f ? inverseSqrtThree/range : 0.0f;
+	int lastBin = task.bins-1, lastGradientBin = task.gradientBins-1;
+
+	for (int t = task.box[1]; t < task.box[4]; ++t)
+	{
+		size_t row = t*rowStride;
+		size_t down = std::max(t-1, 0)*rowStride;
+		size_t up = std::min(t+1, height-1)*rowStride;
+		for (int s = task.box[0]; s < task.box[3]; ++s)
+		{
+			size_t column = s*componentStride;
+			float value = normalised(slice[row + column]);
+			bins.minimum = std::min(bins.minimum, value);
+			bins.maximum = std::max(bins.maximum, value);
+			if (task.rangeOnly) continue;
+
+			size_t left = std::max(s-1, 0)*componentStride;
+			size_t right = std::min(s+1, width-1)*componentStride;
+			float gx = normalised(slice[row + right]) - normalised(slice[row + left]);
+			float gy = normalised(slice[up + column]) - normalised(slice[down + column]);
+			float gz = normalised(next[row + column]) - normalised(previous[row + column]);
+			float gradient = sqrtf(std::min(sqrtf(gx*gx + gy*gy + gz*gz)*gradientScale, 1.0f));
+
+			int bin = osg::clampBetween(int((value - task.low)*binScale), 0, lastBin);
+			int gradientBin = std::min(int(gradient*task.gradientBins), lastGradientBin);
+			++bins.counts[bin];
+			++bins.jointCounts[bin*task.gradientBins + gradientBin];
+			bins.gradientSums[bin] += gradient;
+			++bins.total;
+			bins.sum += value;
+			bins.sumSquares += double(value)*value;
+		}
+	}
+}
+
+// Takes the next slice of the box off the task until there are none left.
+class HistogramWorker : public OpenThreads::Thread
+{
+public:
+	HistogramWorker(HistogramTask& task) : _task(task), _bins(task) {}
+
+	virtual void run()
+	{
+		for(;;)
+		{
+			int r = _task.box[2] + ++_task.next - 1;
+			if (r>=_task.box[5]) return;
+			switch(_task.image->getDataType())
+			{
+				case(GL_UNSIGNED_BYTE): countSlice<unsigned char>(_task, r, _bins); break;
+				case(GL_UNSIGNED_SHORT): countSlice<unsigned short>(_task, r, _bins); break;
+				case(GL_FLOAT): countSlice<float>(_task, r, _bins); break;
+			}
+		}
+	}
+
+	const HistogramBins& getBins() const { return _bins; }
+
+private:
+	HistogramTask& _task;
+	HistogramBins _bins;
+};
+
+// Runs task on numThreads threads and sums what they counted into total.
+void countVoxels(HistogramTask& task, unsigned int numThreads, HistogramBins& total)
+{
+	task.next.exchange(0);
+	unsigned int numSlices = task.box[5] - task.box[2];
+	std::vector<HistogramWorker*> workers;
+	for (unsigned int i = 0; i < numWorkers(numThreads, numSlices); ++i) workers.push_back(new HistogramWorker(task));
+	runWorkers(workers);
+	for (unsigned int i = 0; i < workers.size(); ++i)
+	{
+		const HistogramBins& bins = workers[i]->getBins();
+		for (unsigned int j = 0; j < total.counts.size(); ++j) total.counts[j] += bins.counts[j];
+		for (unsigned int j = 0; j < total.jointCounts.size(); ++j) total.jointCounts[j] += bins.jointCounts[j];
+		for (unsigned int j = 0; j < total.gradientSums.size(); ++j) total.gradientSums[j] += bins.gradientSums[j];
+		total.total += bins.total;
+		total.sum += bins.sum;
+		total.sumSquares += bins.sumSquares;
+		total.minimum = std::min(total.minimum, bins.minimum);
+		total.maximum = std::max(total.maximum, bins.maximum);
+		delete workers[i];
+	}
+}
+
+}
+
+VolumeHistogram::VolumeHistogram(const osg::Image* image, unsigned int bins, unsigned int gradientBins,
+								float low, float high, const osg::BoundingBox& region, unsigned int numThreads)
+	: _bins(std::max(bins, 1u)),
+	_gradientBins(std::max(gradientBins, 1u)),
+	_low(low),
+	_high(high),
+	_total(0),
+	_counts(_bins, 0),
+	_jointCounts(_bins*_gradientBins, 0),
+	_gradientSums(_bins, 0.0),
+	_minimum(0.0f),
+	_maximum(0.0f),
+	_mean(0.0f),
+	_deviation(0.0f)
+{
+	if (!image || !image->data()) return;
+	GLenum dataType = image->getDataType();
+	if (dataType!=GL_UNSIGNED_BYTE && dataType!=GL_UNSIGNED_SHORT && dataType!=GL_FLOAT) return;
+
+	ProfileScope scope("histogram");
+	HistogramTask task;
+	task.image = image;
+	task.low = _low;
+	task.high = _high;
+	int size[3] = { image->s(), image->t(), image->r() };
+	for (int a = 0; a < 3; ++a)
+	{
+		// at least the voxel a flat region lies in
+		task.box[a] = osg::clampBetween(int(floorf(region._min[a]*size[a])), 0, size[a]);
+		task.box[a+3] = osg::clampBetween(int(ceilf(region._max[a]*size[a])), 0, size[a]);
+		if (task.box[a+3]==task.box[a] && task.box[a]<size[a]) ++task.box[a+3];
+		if (task.box[a+3]<=task.box[a]) return;
+	}
+	task.bins = _bins;
+	task.gradientBins = _gradientBins;
+
+	if (_low>=_high)
+	{
+		task.rangeOnly = true;
+		HistogramBins range(task);
+		countVoxels(task, numThreads, range);
+		_low = range.minimum;
+		_high = range.maximum;
+	}
+	task.rangeOnly = false;
+	task.low = _low;
+	task.high = _high;
+
+	HistogramBins total(task);
+	countVoxels(task, numThreads, total);
+	_counts.swap(total.counts);
+	_jointCounts.swap(total.jointCounts);
+	_gradientSums.swap(total.gradientSums);
+	_total = total.total;
+	_minimum = total.minimum;
+	_maximum = total.maximum;
+	_mean = total.sum/total.total;
+	_deviation = sqrt(std::max(total.sumSquares/total.total - double(_mean)*_mean, 0.0));
+}
+
+float VolumeHistogram::getBinValue(unsigned int bin) const
+{
+	return _low + (_high - _low)*(bin + 0.5f)/_bins;
+}
+
+unsigned long long VolumeHistogram::getCount(unsigned int bin, unsigned int gradientBin) const
+{
+	if (bin>=_bins || gradientBin>=_gradientBins) return 0;
+	return _jointCounts[bin*_gradientBins + gradientBin];
+}
+
+float VolumeHistogram::getMeanGradient(unsigned int bin) const
+{
+	if (bin>=_bins || _counts[bin]==0) return 0.0f;
+	return _gradientSums[bin]/_counts[bin];
+}
+
+float VolumeHistogram::getPercentile(float fraction) const
+{
+	if (_total==0) return 0.0f;
+	double wanted = osg::clampBetween(fraction, 0.0f, 1.0f)*double(_total);
+	double below = 0.0;
+	for (unsigned int bin = 0; bin < _bins; ++bin)
+	{
+		if (_counts[bin]==0 || below + _counts[bin] < wanted)
+		{
+			below += _counts[bin];
+			continue;
+		}
+		float within = (wanted - below)/_counts[bin];
+		float value = _low + (_high - _low)*(bin + within)/_bins;
+		return osg::clampBetween(value, _minimum, _maximum);
+	}
+	return _maximum;
+}
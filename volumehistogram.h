@@ -0,0 +1,80 @@
+#ifndef	__AJ_VOLUMEHISTOGRAM__
+#define __AJ_VOLUMEHISTOGRAM__
+
+#include <osg/Image>
+#include <osg/BoundingBox>
+
+#include <vector>
+
+// How the values of a volume are spread, for editing its transfer function:
+// a histogram of the values, and a joint one of value and gradient magnitude
+// where the boundaries between materials stand out as arches, with the
+// statistics of the values besides.
+//
+// Values are normalised as the texture holds them, from the component the
+// shaders read: alpha where the texture has one, the first otherwise.
+// Gradients are central differences one voxel apart, clamped at the faces,
+// as computeGradients() takes them; their magnitude over the histogram's
+// range, out of sqrt(3), is binned on a square root scale so gentle slopes
+// get more of the bins than steep ones.
+//
+// Slices are shared out among numThreads threads, 0 for one per processor,
+// each counting into bins of its own that are summed at the end.
+class VolumeHistogram : public osg::Referenced
+{
+public:
+	// Over the voxels of image in region, a box in its texture coordinates,
+	// with bins from low to high; low >= high takes the range of the region.
+	// Empty for data types other than GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT and
+	// GL_FLOAT.
+	VolumeHistogram(const osg::Image* image, unsigned int bins = 256, unsigned int gradientBins = 64,
+					float low = 0.0f, float high = 0.0f, const osg::BoundingBox& region = osg::BoundingBox(0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f),
+					unsigned int numThreads = 0);
+
+	bool empty() const { return _total==0; }
+	unsigned long long getTotal() const { return _total; }
+
+	unsigned int getNumBins() const { return _bins; }
+	unsigned int getNumGradientBins() const { return _gradientBins; }
+	float getLow() const { return _low; }
+	float getHigh() const { return _high; }
+
+	// the value at the middle of bin
+	float getBinValue(unsigned int bin) const;
+
+	unsigned long long getCount(unsigned int bin) const { return bin<_bins ? _counts[bin] : 0; }
+	unsigned long long getCount(unsigned int bin, unsigned int gradientBin) const;
+
+	// Mean gradient of the voxels in bin, in [0,1] along the gradient bins;
+	// it peaks at the values of boundaries.
+	float getMeanGradient(unsigned int bin) const;
+
+	float getMinimum() const { return _minimum; }
+	float getMaximum() const { return _maximum; }
+	float getMean() const { return _mean; }
+	float getDeviation() const { return _deviation; }
+
+	// The value below which fraction of the voxels lie, interpolated within its bin.
+	float getPercentile(float fraction) const;
+
+protected:
+	virtual ~VolumeHistogram() {}
+
+	unsigned int _bins;
+	unsigned int _gradientBins;
+	float _low;
+	float _high;
+
+	unsigned long long _total;
+	std::vector<unsigned long long> _counts;
+	// gradientBins for each bin in turn
+	std::vector<unsigned long long> _jointCounts;
+	std::vector<double> _gradientSums;
+
+	float _minimum;
+	float _maximum;
+	float _mean;
+	float _deviation;
+};
+
+#endif
@@ -0,0 +1,367 @@
+#include "volumekernels.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define VOLUME_KERNELS_SSE2
+	#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+	#define VOLUME_KERNELS_AVX2
+	#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// The image holds its voxels contiguously unless rows are padded, in which
+// case the padding bytes are just processed along with the voxels.
+size_t componentCount(const osg::Image* image)
+{
+	unsigned int bytesPerComponent = osg::Image::computePixelSizeInBits(GL_LUMINANCE, image->getDataType())/8;
+	if (bytesPerComponent==0) return 0;
+	return static_cast<size_t>(image->getImageSizeInBytes())*image->r()/bytesPerComponent;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// min/max
+
+void rangeUByte(const unsigned char* data, size_t count, unsigned char& minValue, unsigned char& maxValue)
+{
+	size_t i = 0;
+	unsigned char lo = minValue, hi = maxValue;
+#if defined(VOLUME_KERNELS_AVX2)
+	if (count>=32)
+	{
+		__m256i vmin = _mm256_set1_epi8(static_cast<char>(lo));
+		__m256i vmax = _mm256_set1_epi8(static_cast<char>(hi));
+		for(; i+32<=count; i+=32)
+		{
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data+i));
+			vmin = _mm256_min_epu8(vmin, v);
+			vmax = _mm256_max_epu8(vmax, v);
+		}
+		unsigned char lanes[64];
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), vmin);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes+32), vmax);
+		for(unsigned int l=0; l<32; ++l)
+		{
+			lo = std::min(lo, lanes[l]);
+			hi = std::max(hi, lanes[l+32]);
+		}
+	}
+#elif defined(VOLUME_KERNELS_SSE2)
+	if (count>=16)
+	{
+		__m128i vmin = _mm_set1_epi8(static_cast<char>(lo));
+		__m128i vmax = _mm_set1_epi8(static_cast<char>(hi));
+		for(; i+16<=count; i+=16)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data+i));
+			vmin = _mm_min_epu8(vmin, v);
+			vmax = _mm_max_epu8(vmax, v);
+		}
+		unsigned char lanes[32];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vmin);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes+16), vmax);
+		for(unsigned int l=0; l<16; ++l)
+		{
+			lo = std::min(lo, lanes[l]);
+			hi = std::max(hi, lanes[l+16]);
+		}
+	}
+#endif
+	for(; i<count; ++i)
+	{
+		lo = std::min(lo, data[i]);
+		hi = std::max(hi, data[i]);
+	}
+	minValue = lo;
+	maxValue = hi;
+}
+
+void rangeUShort(const unsigned short* data, size_t count, unsigned short& minValue, unsigned short& maxValue)
+{
+	size_t i = 0;
+	unsigned short lo = minValue, hi = maxValue;
+#if defined(VOLUME_KERNELS_AVX2)
+	if (count>=16)
+	{
+		__m256i vmin = _mm256_set1_epi16(static_cast<short>(lo));
+		__m256i vmax = _mm256_set1_epi16(static_cast<short>(hi));
+		for(; i+16<=count; i+=16)
+		{
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data+i));
+			vmin = _mm256_min_epu16(vmin, v);
+			vmax = _mm256_max_epu16(vmax, v);
+		}
+		unsigned short lanes[32];
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), vmin);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes+16), vmax);
+		for(unsigned int l=0; l<16; ++l)
+		{
+			lo = std::min(lo, lanes[l]);
+			hi = std::max(hi, lanes[l+16]);
+		}
+	}
+#elif defined(VOLUME_KERNELS_SSE2)
+	if (count>=8)
+	{
+		// SSE2 only compares signed shorts, flipping the sign bit keeps the unsigned order
+		const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+		__m128i vmin = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(lo)), bias);
+		__m128i vmax = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(hi)), bias);
+		for(; i+8<=count; i+=8)
+		{
+			__m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data+i)), bias);
+			vmin = _mm_min_epi16(vmin, v);
+			vmax = _mm_max_epi16(vmax, v);
+		}
+		unsigned short lanes[16];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), _mm_xor_si128(vmin, bias));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes+8), _mm_xor_si128(vmax, bias));
+		for(unsigned int l=0; l<8; ++l)
+		{
+			lo = std::min(lo, lanes[l]);
+			hi = std::max(hi, lanes[l+8]);
+		}
+	}
+#endif
+	for(; i<count; ++i)
+	{
+		lo = std::min(lo, data[i]);
+		hi = std::max(hi, data[i]);
+	}
+	minValue = lo;
+	maxValue = hi;
+}
+
+void rangeFloat(const float* data, size_t count, float& minValue, float& maxValue)
+{
+	size_t i = 0;
+	float lo = minValue, hi = maxValue;
+#if defined(VOLUME_KERNELS_AVX2)
+	if (count>=8)
+	{
+		__m256 vmin = _mm256_set1_ps(lo);
+		__m256 vmax = _mm256_set1_ps(hi);
+		for(; i+8<=count; i+=8)
+		{
+			__m256 v = _mm256_loadu_ps(data+i);
+			vmin = _mm256_min_ps(vmin, v);
+			vmax = _mm256_max_ps(vmax, v);
+		}
+		float lanes[16];
+		_mm256_storeu_ps(lanes, vmin);
+		_mm256_storeu_ps(lanes+8, vmax);
+		for(unsigned int l=0; l<8; ++l)
+		{
+			lo = std::min(lo, lanes[l]);
+			hi = std::max(hi, lanes[l+8]);
+		}
+	}
+#elif defined(VOLUME_KERNELS_SSE2)
+	if (count>=4)
+	{
+		__m128 vmin = _mm_set1_ps(lo);
+		__m128 vmax = _mm_set1_ps(hi);
+		for(; i+4<=count; i+=4)
+		{
+			__m128 v = _mm_loadu_ps(data+i);
+			vmin = _mm_min_ps(vmin, v);
+			vmax = _mm_max_ps(vmax, v);
+		}
+		float lanes[8];
+		_mm_storeu_ps(lanes, vmin);
+		_mm_storeu_ps(lanes+4, vmax);
+		for(unsigned int l=0; l<4; ++l)
+		{
+			lo = std::min(lo, lanes[l]);
+			hi = std::max(hi, lanes[l+4]);
+		}
+	}
+#endif
+	for(; i<count; ++i)
+	{
+		lo = std::min(lo, data[i]);
+		hi = std::max(hi, data[i]);
+	}
+	minValue = lo;
+	maxValue = hi;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// offset and scale, a and b are the scale and offset in the units of the data
+
+inline int truncateToInt(float v) { return static_cast<int>(v); }
+
+void offsetAndScaleUByte(unsigned char* data, size_t count, float a, float b)
+{
+	size_t i = 0;
+#if defined(VOLUME_KERNELS_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 va = _mm_set1_ps(a);
+	const __m128 vb = _mm_set1_ps(b);
+	for(; i+16<=count; i+=16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data+i));
+		__m128i lo16 = _mm_unpacklo_epi8(v, zero);
+		__m128i hi16 = _mm_unpackhi_epi8(v, zero);
+
+		__m128i r0 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo16, zero)), va), vb));
+		__m128i r1 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo16, zero)), va), vb));
+		__m128i r2 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi16, zero)), va), vb));
+		__m128i r3 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi16, zero)), va), vb));
+
+		// saturating packs clamp to [0,255] on the way back down
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(r0, r1), _mm_packs_epi32(r2, r3));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(data+i), packed);
+	}
+#endif
+	for(; i<count; ++i)
+	{
+		int v = truncateToInt(static_cast<float>(data[i])*a + b);
+		data[i] = static_cast<unsigned char>(v<0 ? 0 : (v>255 ? 255 : v));
+	}
+}
+
+void offsetAndScaleUShort(unsigned short* data, size_t count, float a, float b)
+{
+	size_t i = 0;
+#if defined(VOLUME_KERNELS_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias32 = _mm_set1_epi32(32768);
+	const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+	const __m128 va = _mm_set1_ps(a);
+	const __m128 vb = _mm_set1_ps(b);
+	for(; i+8<=count; i+=8)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data+i));
+
+		__m128i r0 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), va), vb));
+		__m128i r1 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), va), vb));
+
+		// no unsigned 32->16 pack before SSE4.1: pack signed around the midpoint and shift back
+		__m128i packed = _mm_packs_epi32(_mm_sub_epi32(r0, bias32), _mm_sub_epi32(r1, bias32));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(data+i), _mm_xor_si128(packed, bias16));
+	}
+#endif
+	for(; i<count; ++i)
+	{
+		int v = truncateToInt(static_cast<float>(data[i])*a + b);
+		data[i] = static_cast<unsigned short>(v<0 ? 0 : (v>65535 ? 65535 : v));
+	}
+}
+
+void offsetAndScaleFloat(float* data, size_t count, float a, float b)
+{
+	size_t i = 0;
+#if defined(VOLUME_KERNELS_AVX2)
+	const __m256 va = _mm256_set1_ps(a);
+	const __m256 vb = _mm256_set1_ps(b);
+	for(; i+8<=count; i+=8)
+	{
+		_mm256_storeu_ps(data+i, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(data+i), va), vb));
+	}
+#elif defined(VOLUME_KERNELS_SSE2)
+	const __m128 va = _mm_set1_ps(a);
+	const __m128 vb = _mm_set1_ps(b);
+	for(; i+4<=count; i+=4)
+	{
+		_mm_storeu_ps(data+i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(data+i), va), vb));
+	}
+#endif
+	for(; i<count; ++i)
+	{
+		data[i] = data[i]*a + b;
+	}
+}
+
+}
+
+bool accumulateRange(const void* data, size_t count, GLenum dataType, float& minValue, float& maxValue)
+{
+	if (count==0) return false;
+
+	switch(dataType)
+	{
+		case(GL_UNSIGNED_BYTE):
+		{
+			unsigned char lo = 255, hi = 0;
+			rangeUByte(static_cast<const unsigned char*>(data), count, lo, hi);
+			minValue = std::min(minValue, lo/255.0f);
+			maxValue = std::max(maxValue, hi/255.0f);
+			return true;
+		}
+		case(GL_UNSIGNED_SHORT):
+		{
+			unsigned short lo = 65535, hi = 0;
+			rangeUShort(static_cast<const unsigned short*>(data), count, lo, hi);
+			minValue = std::min(minValue, lo/65535.0f);
+			maxValue = std::max(maxValue, hi/65535.0f);
+			return true;
+		}
+		case(GL_FLOAT):
+		{
+			float lo = minValue, hi = maxValue;
+			rangeFloat(static_cast<const float*>(data), count, lo, hi);
+			minValue = lo;
+			maxValue = hi;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool computeRange(const osg::Image* image, float& minValue, float& maxValue)
+{
+	if (!image || !image->data()) return false;
+
+	minValue = FLT_MAX;
+	maxValue = -FLT_MAX;
+	return accumulateRange(image->data(), componentCount(image), image->getDataType(), minValue, maxValue);
+}
+
+bool offsetAndScale(void* data, size_t count, GLenum dataType, float offset, float scale)
+{
+	switch(dataType)
+	{
+		case(GL_UNSIGNED_BYTE):
+			offsetAndScaleUByte(static_cast<unsigned char*>(data), count, scale, offset*255.0f);
+			return true;
+		case(GL_UNSIGNED_SHORT):
+			offsetAndScaleUShort(static_cast<unsigned short*>(data), count, scale, offset*65535.0f);
+			return true;
+		case(GL_FLOAT):
+			offsetAndScaleFloat(static_cast<float*>(data), count, scale, offset);
+			return true;
+	}
+	return false;
+}
+
+bool offsetAndScaleVolume(osg::Image* image, float offset, float scale)
+{
+	if (!image || !image->data()) return false;
+
+	if (!offsetAndScale(image->data(), componentCount(image), image->getDataType(), offset, scale)) return false;
+
+	image->dirty();
+	return true;
+}
+
+void unsignShorts(void* data, size_t count)
+{
+	// adding 32768 modulo 2^16 is flipping the sign bit
+	unsigned short* values = static_cast<unsigned short*>(data);
+	size_t i = 0;
+#if defined(VOLUME_KERNELS_SSE2)
+	const __m128i sign = _mm_set1_epi16(static_cast<short>(0x8000));
+	for(; i+8<=count; i+=8)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values+i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(values+i), _mm_xor_si128(v, sign));
+	}
+#endif
+	for(; i<count; ++i) values[i] ^= 0x8000u;
+}
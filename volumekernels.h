@@ -0,0 +1,32 @@
+#ifndef	__AJ_VOLUMEKERNELS__
+#define __AJ_VOLUMEKERNELS__
+
+#include <osg/Image>
+
+// Vectorised replacements for the per-pixel functor passes of osg/ImageUtils,
+// for GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT and GL_FLOAT data. They work on all
+// components alike and in the same normalised units as osg::computeMinMax
+// and osg::offsetAndScaleImage, where unsigned integers map to [0,1].
+// Other data types return false and leave the work to osg.
+
+// Range of count components starting at data, merged into minValue/maxValue.
+bool accumulateRange(const void* data, size_t count, GLenum dataType, float& minValue, float& maxValue);
+
+// Range over all the components of image.
+bool computeRange(const osg::Image* image, float& minValue, float& maxValue);
+
+// v = v*scale + offset on count components, in place.
+bool offsetAndScale(void* data, size_t count, GLenum dataType, float offset, float scale);
+
+// The same over the whole of image.
+bool offsetAndScaleVolume(osg::Image* image, float offset, float scale);
+
+// Signed shorts to unsigned ones, v + 32768, on count components in place.
+// GL_SHORT is the usual type of CT data but none of the passes cover it; the
+// unsigned values normalise to u/65535, the signed ones to s/32767, so
+// s = u*signedShortScale + signedShortOffset.
+void unsignShorts(void* data, size_t count);
+const float signedShortScale = 65535.0f/32767.0f;
+const float signedShortOffset = -32768.0f/32767.0f;
+
+#endif
@@ -0,0 +1,99 @@
+#include "volumeloader.h"
+#include "volumecache.h"
+#include "volumegradients.h"
+#include "volumeprofile.h"
+
+#include <algorithm>
+#include <iostream>
+
+void buildLevels(osg::Image* image, int maximumTextureSize, unsigned int maxLevels, std::vector< osg::ref_ptr<osg::Image> >& levels)
+{
+	// only levels that fit one texture are kept
+	osg::ref_ptr<osg::Image> level = image;
+	while(levels.size()<maxLevels && std::max(level->s(), std::max(level->t(), level->r()))>32)
+	{
+		level = halveVolume(level.get());
+		if (!level) break;
+		if (level->s()>maximumTextureSize || level->t()>maximumTextureSize || level->r()>maximumTextureSize) continue;
+		levels.push_back(level);
+	}
+}
+
+VolumeLoader::VolumeLoader(const std::string& imageFile, const VolumeOptions& options, int maximumTextureSize, unsigned int maxLevels)
+	: _imageFile(imageFile),
+	_options(options),
+	_maximumTextureSize(maximumTextureSize),
+	_maxLevels(maxLevels),
+	_computeGradients(false),
+	_stage(Reading)
+{
+}
+
+VolumeLoader::~VolumeLoader()
+{
+	// the reader can not be interrupted, a module going away waits for it
+	join();
+}
+
+float VolumeLoader::getProgress() const
+{
+	// reading and decoding dominate a cold start
+	switch(getStage())
+	{
+		case(Reading):			return 0.0f;
+		case(BuildingLevels):	return 0.6f;
+		case(Caching):			return 0.7f;
+		case(Classifying):		return 0.85f;
+		case(ComputingGradients):	return 0.9f;
+		default:				return 1.0f;
+	}
+}
+
+VolumeData* VolumeLoader::getData() const
+{
+	if (isDone() && _mapped.valid()) return _mapped.get();
+	return getStage()>BuildingLevels ? _data.get() : 0;
+}
+
+void VolumeLoader::run()
+{
+	ProfileScope scope("loadVolume");
+
+	// a warm start maps the preprocessed volume of an earlier run, and of processes
+	// sharing the cache only one loads it while the others wait for its entry.
+	VolumeCache cache(_imageFile, _options);
+	osg::ref_ptr<VolumeData> data = cache.readOrClaim();
+	bool cached = data.valid();
+	if (!data) data = loadVolumeData(_imageFile, _options);
+	if (!data || !data->image)
+	{
+		std::cout << "VolumeLoader: could not load " << _imageFile << std::endl;
+		setStage(Failed);
+		return;
+	}
+	_data = data;
+	setStage(BuildingLevels);
+
+	// coarser copies to draw while the view moves
+	buildLevels(data->image.get(), _maximumTextureSize, _maxLevels, _levels);
+	setStage(Caching);
+
+	// map the entry just written, so a big volume does not stay on the heap while bricks page from it
+	if (!cached && cache.write(data.get())) _mapped = cache.read();
+	setStage(Classifying);
+
+	// the transfer function decides which parts of the volume can be seen at all.
+	_occupancy = new OccupancyGrid(data->image.get());
+	_histogram = new VolumeHistogram(data->image.get());
+	setStage(ComputingGradients);
+
+	// a volume too big for one texture is drawn in bricks, which shade from the values
+	if (_computeGradients)
+	{
+		osg::Image* image = data->image.get();
+		bool fits = image->s()<=_maximumTextureSize && image->t()<=_maximumTextureSize && image->r()<=_maximumTextureSize;
+		_gradients.push_back(fits ? computeGradients(image) : 0);
+		for (unsigned int i = 0; i < _levels.size(); ++i) _gradients.push_back(computeGradients(_levels[i].get()));
+	}
+	setStage(Ready);
+}
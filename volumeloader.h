@@ -0,0 +1,97 @@
+#ifndef	__AJ_VOLUMELOADER__
+#define __AJ_VOLUMELOADER__
+
+#include "volumedata.h"
+#include "volumeoccupancy.h"
+#include "volumehistogram.h"
+
+#include <osg/Image>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+#include <string>
+#include <vector>
+
+// The coarser copies of image for the level of detail pyramid, halving until
+// the longest side is 32: the first maxLevels that fit maximumTextureSize
+// along every axis.
+void buildLevels(osg::Image* image, int maximumTextureSize, unsigned int maxLevels, std::vector< osg::ref_ptr<osg::Image> >& levels);
+
+// Reads and preprocesses a volume on a thread of its own, so the module can
+// return from initialize() at once and keep rendering while it loads.
+//
+// The work goes in stages, and what a stage produced can be picked up by the
+// render thread as soon as getStage() has moved past it: the volume and its
+// coarser levels after BuildingLevels, the occupancy grid and the histogram
+// after Classifying,
+// the gradients, when asked for, after ComputingGradients.
+// The coarsest level comes first so a preview can be shown while the volume
+// is written to the cache and classified.
+class VolumeLoader : public osg::Referenced, public OpenThreads::Thread
+{
+public:
+	enum Stage
+	{
+		Reading,
+		BuildingLevels,
+		Caching,
+		Classifying,
+		ComputingGradients,
+		Ready,
+		Failed
+	};
+
+	// Only levels fitting maximumTextureSize along every axis are kept, at most maxLevels of them.
+	VolumeLoader(const std::string& imageFile, const VolumeOptions& options, int maximumTextureSize, unsigned int maxLevels = 3);
+
+	Stage getStage() const { return static_cast<Stage>(static_cast<unsigned int>(_stage)); }
+	bool isDone() const { return getStage()>=Ready; }
+
+	// Rough fraction of the work done, advancing stage by stage.
+	float getProgress() const;
+
+	// after BuildingLevels; once done, the copy mapped from the cache if one was written
+	VolumeData* getData() const;
+	const std::vector< osg::ref_ptr<osg::Image> >& getLevels() const { return _levels; }
+	// Once done, lets go of the volume as loaded when the cache mapped a copy
+	// back, for those keeping the loader to share what it loaded.
+	void releaseLoadedCopy() { if (isDone() && _mapped.valid()) _data = _mapped; }
+	osg::Image* getPreview() const { return getStage()>BuildingLevels && !_levels.empty() ? _levels.back().get() : 0; }
+
+	// after Classifying
+	OccupancyGrid* getOccupancy() const { return getStage()>Classifying && getStage()!=Failed ? _occupancy.get() : 0; }
+	// of the whole volume, for transfer function editing
+	VolumeHistogram* getHistogram() const { return getStage()>Classifying && getStage()!=Failed ? _histogram.get() : 0; }
+
+	// Works out the gradients of the volume and its levels for lit shading,
+	// see computeGradients(); set before start().
+	void setComputeGradients(bool gradients) { _computeGradients = gradients; }
+
+	// after ComputingGradients: the volume's, 0 when it does not fit one
+	// texture, then those of the levels; empty unless asked for
+	const std::vector< osg::ref_ptr<osg::Image> >& getGradients() const { return _gradients; }
+
+	virtual void run();
+
+protected:
+	virtual ~VolumeLoader();
+
+	void setStage(Stage stage) { _stage.exchange(stage); }
+
+	std::string _imageFile;
+	VolumeOptions _options;
+	int _maximumTextureSize;
+	unsigned int _maxLevels;
+	bool _computeGradients;
+
+	OpenThreads::Atomic _stage;
+	osg::ref_ptr<VolumeData> _data;
+	osg::ref_ptr<VolumeData> _mapped;
+	std::vector< osg::ref_ptr<osg::Image> > _levels;
+	osg::ref_ptr<OccupancyGrid> _occupancy;
+	osg::ref_ptr<VolumeHistogram> _histogram;
+	std::vector< osg::ref_ptr<osg::Image> > _gradients;
+};
+
+#endif
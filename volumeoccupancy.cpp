@@ -0,0 +1,187 @@
+#include "volumeoccupancy.h"
+#include "volumedata.h"
+
+#include <osg/Notify>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// Range of every cell, one row of the image at a time so a mapped volume is read in order.
+template<typename T>
+void reduceCells(const osg::Image* image, int cellSize, const int* numCells, std::vector<float>& minValue, std::vector<float>& maxValue)
+{
+	unsigned int numComponents = osg::Image::computeNumComponents(image->getPixelFormat());
+	for (int r = 0; r < image->r(); ++r)
+	{
+		// the voxels either side of a cell boundary belong to both cells
+		int k0 = std::max(0, (r%cellSize==0) ? r/cellSize-1 : r/cellSize);
+		int k1 = std::min((r+1)/cellSize, numCells[2]-1);
+		for (int t = 0; t < image->t(); ++t)
+		{
+			int j0 = std::max(0, (t%cellSize==0) ? t/cellSize-1 : t/cellSize);
+			int j1 = std::min((t+1)/cellSize, numCells[1]-1);
+			const T* row = reinterpret_cast<const T*>(image->data(0, t, r));
+			for (int i = 0; i < numCells[0]; ++i)
+			{
+				int s0 = std::max(0, i*cellSize-1);
+				int s1 = std::min(image->s(), (i+1)*cellSize+1);
+				T lo = row[s0*numComponents], hi = lo;
+				for (const T* v = row + s0*numComponents; v < row + s1*numComponents; ++v)
+				{
+					lo = std::min(lo, *v);
+					hi = std::max(hi, *v);
+				}
+
+				for (int k = k0; k <= k1; ++k)
+				{
+					for (int j = j0; j <= j1; ++j)
+					{
+						unsigned int c = (k*numCells[1] + j)*numCells[0] + i;
+						minValue[c] = std::min(minValue[c], normalised(lo));
+						maxValue[c] = std::max(maxValue[c], normalised(hi));
+					}
+				}
+			}
+		}
+	}
+}
+
+}
+
+OccupancyGrid::OccupancyGrid(const osg::Image* image, int cellSize)
+	: _cellSize(cellSize)
+{
+	_size[0] = image->s();
+	_size[1] = image->t();
+	_size[2] = image->r();
+	for (unsigned int i = 0; i < 3; ++i) _numCells[i] = std::max(1, (_size[i]+cellSize-1)/cellSize);
+
+	unsigned int numCells = _numCells[0]*_numCells[1]*_numCells[2];
+	std::vector<float> minValue(numCells, FLT_MAX);
+	std::vector<float> maxValue(numCells, -FLT_MAX);
+	switch(image->getDataType())
+	{
+		case(GL_UNSIGNED_BYTE): reduceCells<unsigned char>(image, cellSize, _numCells, minValue, maxValue); break;
+		case(GL_UNSIGNED_SHORT): reduceCells<unsigned short>(image, cellSize, _numCells, minValue, maxValue); break;
+		case(GL_FLOAT): reduceCells<float>(image, cellSize, _numCells, minValue, maxValue); break;
+		default:
+			// unknown ranges, nothing can be skipped
+			std::fill(minValue.begin(), minValue.end(), 0.0f);
+			std::fill(maxValue.begin(), maxValue.end(), 1.0f);
+			break;
+	}
+
+	_min.resize(numCells);
+	_max.resize(numCells);
+	for (unsigned int c = 0; c < numCells; ++c)
+	{
+		_min[c] = (unsigned char)osg::clampBetween(floorf(minValue[c]*255.0f), 0.0f, 255.0f);
+		_max[c] = (unsigned char)osg::clampBetween(ceilf(maxValue[c]*255.0f), 0.0f, 255.0f);
+	}
+	_occupied.assign(numCells, true);
+
+	OSG_NOTICE<<"Occupancy grid of "<<_numCells[0]<<"x"<<_numCells[1]<<"x"<<_numCells[2]<<" cells of "<<cellSize<<" voxels"<<std::endl;
+}
+
+OccupancyGrid::OccupancyGrid(const OccupancyGrid& grid)
+	: osg::Referenced(),
+	_cellSize(grid._cellSize),
+	_min(grid._min),
+	_max(grid._max),
+	_occupied(grid._occupied)
+{
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		_size[i] = grid._size[i];
+		_numCells[i] = grid._numCells[i];
+	}
+}
+
+void OccupancyGrid::classify(const osg::TransferFunction1D* tf, float tfScale, float tfOffset, float alphaCutoff)
+{
+	const osg::Image* table = tf ? tf->getImage() : 0;
+	if (!table || table->s()==0 || table->getDataType()!=GL_FLOAT || table->getPixelFormat()!=GL_RGBA)
+	{
+		occupyAll();
+		return;
+	}
+
+	// visibleBefore[i] counts the visible levels below i, so a range is one subtraction
+	const osg::Vec4* colours = reinterpret_cast<const osg::Vec4*>(table->data());
+	int numEntries = table->s();
+	std::vector<unsigned int> visibleBefore(257, 0);
+	for (int level = 0; level < 256; ++level)
+	{
+		// the texture coordinates this level spans, widened to the entries filtering blends
+		float x0 = (level/255.0f)*tfScale + tfOffset;
+		float x1 = ((level+1)/255.0f)*tfScale + tfOffset;
+		if (x0>x1) std::swap(x0, x1);
+		int e0 = osg::clampBetween((int)floorf(x0*numEntries - 0.5f), 0, numEntries-1);
+		int e1 = osg::clampBetween((int)ceilf(x1*numEntries - 0.5f), 0, numEntries-1);
+
+		bool visible = false;
+		for (int e = e0; e <= e1 && !visible; ++e) visible = colours[e].a() > alphaCutoff;
+		visibleBefore[level+1] = visibleBefore[level] + (visible ? 1 : 0);
+	}
+
+	for (unsigned int c = 0; c < _occupied.size(); ++c)
+	{
+		_occupied[c] = visibleBefore[_max[c]+1] > visibleBefore[_min[c]];
+	}
+}
+
+void OccupancyGrid::occupyAll()
+{
+	_occupied.assign(_occupied.size(), true);
+}
+
+bool OccupancyGrid::occupiedBox(int s0, int t0, int r0, int s1, int t1, int r1, osg::BoundingBox& box) const
+{
+	box.init();
+	int i1 = std::min(_numCells[0], (s1+_cellSize-1)/_cellSize);
+	int j1 = std::min(_numCells[1], (t1+_cellSize-1)/_cellSize);
+	int k1 = std::min(_numCells[2], (r1+_cellSize-1)/_cellSize);
+	for (int k = r0/_cellSize; k < k1; ++k)
+	{
+		for (int j = t0/_cellSize; j < j1; ++j)
+		{
+			for (int i = s0/_cellSize; i < i1; ++i)
+			{
+				if (!_occupied[index(i,j,k)]) continue;
+				box.expandBy(osg::Vec3(i*_cellSize, j*_cellSize, k*_cellSize));
+				box.expandBy(osg::Vec3((i+1)*_cellSize, (j+1)*_cellSize, (k+1)*_cellSize));
+			}
+		}
+	}
+	if (!box.valid()) return false;
+
+	box.xMin() = std::max<float>(box.xMin(), s0);
+	box.yMin() = std::max<float>(box.yMin(), t0);
+	box.zMin() = std::max<float>(box.zMin(), r0);
+	box.xMax() = std::min<float>(box.xMax(), s1);
+	box.yMax() = std::min<float>(box.yMax(), t1);
+	box.zMax() = std::min<float>(box.zMax(), r1);
+	return true;
+}
+
+float OccupancyGrid::getOccupancy() const
+{
+	if (_occupied.empty()) return 0.0f;
+	return float(std::count(_occupied.begin(), _occupied.end(), true))/float(_occupied.size());
+}
+
+osg::Matrix boxMatrix(const osg::BoundingBox& box)
+{
+	return osg::Matrix::scale(box.xMax()-box.xMin(), box.yMax()-box.yMin(), box.zMax()-box.zMin()) *
+		osg::Matrix::translate(box.xMin(), box.yMin(), box.zMin());
+}
+
+osg::BoundingBox transformBox(const osg::BoundingBox& box, const osg::Matrix& matrix)
+{
+	osg::BoundingBox transformed;
+	for (unsigned int c = 0; c < 8; ++c) transformed.expandBy(box.corner(c) * matrix);
+	return transformed;
+}
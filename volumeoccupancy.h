@@ -0,0 +1,63 @@
+#ifndef	__AJ_VOLUMEOCCUPANCY__
+#define __AJ_VOLUMEOCCUPANCY__
+
+#include <osg/Image>
+#include <osg/BoundingBox>
+#include <osg/Matrix>
+#include <osg/TransferFunction>
+
+#include <vector>
+
+// The range of values in each cell of a coarse grid over the volume, built
+// once at load time. classify() then marks the cells the transfer function
+// leaves fully transparent, so the renderer can shrink its proxy geometry to
+// the cells that can contribute, or drop bricks entirely.
+//
+// Each cell's range takes in a voxel either side of it, so it covers
+// everything trilinear filtering can produce inside the cell.
+class OccupancyGrid : public osg::Referenced
+{
+public:
+	OccupancyGrid(const osg::Image* image, int cellSize = 16);
+	// The ranges of grid, to be classified apart from it.
+	OccupancyGrid(const OccupancyGrid& grid);
+
+	// A value v of the image reaches the transfer function at v*tfScale + tfOffset,
+	// as RayTracedTechnique computes them from the layer's texel offset and scale.
+	// Cells whose every value maps to an alpha at or below alphaCutoff are empty.
+	void classify(const osg::TransferFunction1D* tf, float tfScale, float tfOffset, float alphaCutoff);
+
+	// Marks every cell occupied, for shading modes where transparency does not hide voxels.
+	void occupyAll();
+
+	// Bounds of the occupied cells overlapping the voxels [s0,s1)x[t0,t1)x[r0,r1),
+	// in voxels and clamped to that region. Returns false when none is occupied.
+	bool occupiedBox(int s0, int t0, int r0, int s1, int t1, int r1, osg::BoundingBox& box) const;
+
+	// Fraction of the cells that are occupied.
+	float getOccupancy() const;
+
+	int getCellSize() const { return _cellSize; }
+
+protected:
+	virtual ~OccupancyGrid() {}
+
+	unsigned int index(int i, int j, int k) const { return (k*_numCells[1] + j)*_numCells[0] + i; }
+
+	int _cellSize;
+	int _size[3];
+	int _numCells[3];
+
+	// value range per cell, quantised outwards to 256 levels of [0,1]
+	std::vector<unsigned char> _min;
+	std::vector<unsigned char> _max;
+	std::vector<bool> _occupied;
+};
+
+// Maps the unit cube onto box, for the Locator of a proxy shrunk to it.
+osg::Matrix boxMatrix(const osg::BoundingBox& box);
+
+// The axis aligned bounds of box after matrix.
+osg::BoundingBox transformBox(const osg::BoundingBox& box, const osg::Matrix& matrix);
+
+#endif
@@ -0,0 +1,210 @@
+#include "volumeprofile.h"
+
+#include <osgDB/fstream>
+
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+
+const char* counterNames[VolumeProfiler::NumCounters] = { "textureUploadBytes", "dirtyRequests", "techniqueInits", "timestepStalls" };
+
+int currentThread()
+{
+	OpenThreads::Thread* thread = OpenThreads::Thread::CurrentThread();
+	return thread ? thread->getThreadId() : 0;
+}
+
+// OpenThreads::Atomic holds 32 bits, too few for the bytes uploaded.
+long long atomicAdd(volatile long long* value, long long amount)
+{
+#ifdef _MSC_VER
+	return _InterlockedExchangeAdd64(value, amount) + amount;
+#else
+	return __sync_add_and_fetch(value, amount);
+#endif
+}
+
+long long atomicExchange(volatile long long* value, long long replacement)
+{
+#ifdef _MSC_VER
+	return _InterlockedExchange64(value, replacement);
+#else
+	return __sync_lock_test_and_set(value, replacement);
+#endif
+}
+
+struct Stats
+{
+	Stats() : count(0), total(0.0), longest(0.0) {}
+
+	unsigned int count;
+	double total;
+	double longest;
+};
+
+}
+
+VolumeProfiler* VolumeProfiler::instance()
+{
+	static VolumeProfiler profiler;
+	return &profiler;
+}
+
+VolumeProfiler::VolumeProfiler()
+	: _slots(new Slot[Capacity]),
+	_origin(osg::Timer::instance()->tick())
+{
+	for (unsigned int i = 0; i < NumCounters; ++i) _counters[i] = 0;
+}
+
+VolumeProfiler::~VolumeProfiler()
+{
+	delete [] _slots;
+}
+
+void VolumeProfiler::push(const Event& event)
+{
+	unsigned int claim = ++_next;
+	Slot& slot = _slots[(claim-1) % Capacity];
+	slot.sequence.exchange(0);
+	slot.event = event;
+	slot.sequence.exchange(claim);
+}
+
+void VolumeProfiler::record(const char* name, osg::Timer_t start, osg::Timer_t end)
+{
+	Event event;
+	event.name = name;
+	event.start = start;
+	event.end = end;
+	event.thread = currentThread();
+	push(event);
+}
+
+void VolumeProfiler::count(Counter counter, long long amount)
+{
+	Event event;
+	event.value = double(atomicAdd(&_counters[counter], amount));
+	event.name = counterNames[counter];
+	event.start = event.end = osg::Timer::instance()->tick();
+	event.thread = currentThread();
+	event.counter = counter;
+	push(event);
+}
+
+double VolumeProfiler::getCounter(Counter counter) const
+{
+	return double(atomicAdd(const_cast<volatile long long*>(&_counters[counter]), 0));
+}
+
+int VolumeProfiler::findCounter(const std::string& name)
+{
+	for (unsigned int i = 0; i < NumCounters; ++i)
+	{
+		if (name==counterNames[i]) return i;
+	}
+	return -1;
+}
+
+unsigned int VolumeProfiler::snapshot(Event* events) const
+{
+	// a slot being rewritten while it is copied is skipped
+	unsigned int numEvents = 0;
+	for (unsigned int i = 0; i < Capacity; ++i)
+	{
+		unsigned int before = _slots[i].sequence;
+		if (before==0) continue;
+		Event event = _slots[i].event;
+		if (_slots[i].sequence!=before) continue;
+		events[numEvents++] = event;
+	}
+	return numEvents;
+}
+
+double VolumeProfiler::getTime(const std::string& name, unsigned int* numEvents) const
+{
+	std::vector<Event> events(Capacity);
+	unsigned int size = snapshot(&events[0]);
+
+	const osg::Timer* timer = osg::Timer::instance();
+	double total = 0.0;
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		if (events[i].counter>=0 || name!=events[i].name) continue;
+		total += timer->delta_m(events[i].start, events[i].end);
+		++count;
+	}
+	if (numEvents) *numEvents = count;
+	return total;
+}
+
+std::string VolumeProfiler::report() const
+{
+	std::vector<Event> events(Capacity);
+	unsigned int size = snapshot(&events[0]);
+
+	const osg::Timer* timer = osg::Timer::instance();
+	std::map<std::string, Stats> stats;
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		if (events[i].counter>=0) continue;
+		double time = timer->delta_m(events[i].start, events[i].end);
+		Stats& s = stats[events[i].name];
+		++s.count;
+		s.total += time;
+		s.longest = std::max(s.longest, time);
+	}
+
+	std::ostringstream out;
+	for (std::map<std::string, Stats>::const_iterator itr = stats.begin(); itr != stats.end(); ++itr)
+	{
+		const Stats& s = itr->second;
+		out<<itr->first<<": "<<s.count<<" x, total "<<s.total<<"ms, mean "<<s.total/s.count<<"ms, max "<<s.longest<<"ms"<<std::endl;
+	}
+	for (unsigned int i = 0; i < NumCounters; ++i)
+	{
+		out<<counterNames[i]<<": "<<getCounter(static_cast<Counter>(i))<<std::endl;
+	}
+	return out.str();
+}
+
+bool VolumeProfiler::writeChromeTrace(const std::string& filename) const
+{
+	osgDB::ofstream out(filename.c_str());
+	if (!out) return false;
+
+	std::vector<Event> events(Capacity);
+	unsigned int size = snapshot(&events[0]);
+
+	// timestamps in microseconds since the profiler started
+	const osg::Timer* timer = osg::Timer::instance();
+	out<<"{\"traceEvents\":["<<std::endl;
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		const Event& e = events[i];
+		out<<(i>0 ? ",\n" : "")<<"{\"name\":\""<<e.name<<"\",\"pid\":1,\"tid\":"<<e.thread
+			<<",\"ts\":"<<timer->delta_u(_origin, e.start);
+		if (e.counter>=0) out<<",\"ph\":\"C\",\"args\":{\"value\":"<<e.value<<"}}";
+		else out<<",\"ph\":\"X\",\"cat\":\"volume\",\"dur\":"<<timer->delta_u(e.start, e.end)<<"}";
+	}
+	out<<std::endl<<"]}"<<std::endl;
+	return out.good();
+}
+
+void VolumeProfiler::reset()
+{
+	for (unsigned int i = 0; i < Capacity; ++i) _slots[i].sequence.exchange(0);
+	for (unsigned int i = 0; i < NumCounters; ++i) atomicExchange(&_counters[i], 0);
+}
@@ -0,0 +1,97 @@
+#ifndef	__AJ_VOLUMEPROFILE__
+#define __AJ_VOLUMEPROFILE__
+
+#include <osg/Timer>
+
+#include <OpenThreads/Atomic>
+
+#include <string>
+
+// Timings and counters from loading and from every frame, kept so a running
+// session can be profiled from Python without a debugger.
+//
+// Timed scopes go into a ring buffer whose slots writers claim with one atomic
+// increment, so recording never waits on a lock; once it is full the oldest
+// events are overwritten. Queries cover the events still in the buffer.
+// Counters are running totals since the last reset(), one 64-bit atomic each,
+// so counting from the worker threads does not wait either.
+class VolumeProfiler
+{
+public:
+	enum Counter
+	{
+		TextureUploadBytes,
+		DirtyRequests,
+		TechniqueInits,
+		TimestepStalls,
+		NumCounters
+	};
+
+	static VolumeProfiler* instance();
+
+	// name must outlive the profiler, a string literal
+	void record(const char* name, osg::Timer_t start, osg::Timer_t end);
+
+	void count(Counter counter, long long amount = 1);
+	double getCounter(Counter counter) const;
+	// The counter called name in reports, -1 if there is none.
+	static int findCounter(const std::string& name);
+
+	// Total milliseconds of the events called name, and how many there are.
+	double getTime(const std::string& name, unsigned int* numEvents = 0) const;
+
+	// One line per event name and per counter.
+	std::string report() const;
+
+	// The events as a Chrome trace (chrome://tracing, Perfetto), the counters as counter tracks.
+	bool writeChromeTrace(const std::string& filename) const;
+
+	void reset();
+
+	struct Event
+	{
+		Event() : name(0), start(0), end(0), value(0.0), thread(0), counter(-1) {}
+
+		const char* name;
+		osg::Timer_t start;
+		osg::Timer_t end;
+		double value;
+		int thread;
+		int counter;
+	};
+
+private:
+	VolumeProfiler();
+	~VolumeProfiler();
+
+	void push(const Event& event);
+	unsigned int snapshot(Event* events) const;
+
+	struct Slot
+	{
+		// the claim it holds plus one once written, 0 while being written
+		OpenThreads::Atomic sequence;
+		Event event;
+	};
+
+	static const unsigned int Capacity = 16384;
+	Slot* _slots;
+	OpenThreads::Atomic _next;
+	osg::Timer_t _origin;
+
+	volatile long long _counters[NumCounters];
+};
+
+// Records the time from construction to destruction under name.
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name) : _name(name), _start(osg::Timer::instance()->tick()) {}
+	~ProfileScope() { VolumeProfiler::instance()->record(_name, _start, osg::Timer::instance()->tick()); }
+
+private:
+	const char* _name;
+	osg::Timer_t _start;
+};
+
+#endif
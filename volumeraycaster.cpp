@@ -0,0 +1,682 @@
+#include "volumeraycaster.h"
+#include "volumedata.h"
+
+#include <osg/Notify>
+#include <osgVolume/Property>
+#include <osgVolume/Locator>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define VOLUME_RAYCASTER_SSE2
+	#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// four rays side by side; comparisons give masks for select() and bits()
+
+#if defined(VOLUME_RAYCASTER_SSE2)
+
+struct Lanes
+{
+	Lanes() {}
+	Lanes(__m128 x) : v(x) {}
+	explicit Lanes(float x) : v(_mm_set1_ps(x)) {}
+
+	static Lanes load(const float* p) { return Lanes(_mm_loadu_ps(p)); }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+
+	__m128 v;
+};
+
+inline Lanes operator+(const Lanes& a, const Lanes& b) { return _mm_add_ps(a.v, b.v); }
+inline Lanes operator-(const Lanes& a, const Lanes& b) { return _mm_sub_ps(a.v, b.v); }
+inline Lanes operator*(const Lanes& a, const Lanes& b) { return _mm_mul_ps(a.v, b.v); }
+inline Lanes operator/(const Lanes& a, const Lanes& b) { return _mm_div_ps(a.v, b.v); }
+inline Lanes operator<(const Lanes& a, const Lanes& b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Lanes operator>(const Lanes& a, const Lanes& b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Lanes operator>=(const Lanes& a, const Lanes& b) { return _mm_cmpge_ps(a.v, b.v); }
+inline Lanes operator&(const Lanes& a, const Lanes& b) { return _mm_and_ps(a.v, b.v); }
+inline Lanes minimum(const Lanes& a, const Lanes& b) { return _mm_min_ps(a.v, b.v); }
+inline Lanes maximum(const Lanes& a, const Lanes& b) { return _mm_max_ps(a.v, b.v); }
+inline Lanes sqrt(const Lanes& a) { return _mm_sqrt_ps(a.v); }
+inline Lanes abs(const Lanes& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline Lanes select(const Lanes& mask, const Lanes& a, const Lanes& b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+inline int bits(const Lanes& mask) { return _mm_movemask_ps(mask.v); }
+inline Lanes lanesFromBits(int b)
+{
+	return _mm_castsi128_ps(_mm_set_epi32((b&8) ? -1 : 0, (b&4) ? -1 : 0, (b&2) ? -1 : 0, (b&1) ? -1 : 0));
+}
+// a must not be negative
+inline Lanes truncate(const Lanes& a, int* i)
+{
+	__m128i t = _mm_cvttps_epi32(a.v);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(i), t);
+	return _mm_cvtepi32_ps(t);
+}
+
+#else
+
+struct Lanes
+{
+	Lanes() {}
+	explicit Lanes(float x) { v[0] = v[1] = v[2] = v[3] = x; }
+
+	static Lanes load(const float* p) { Lanes l; for (int i = 0; i < 4; ++i) l.v[i] = p[i]; return l; }
+	void store(float* p) const { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+
+	float v[4];
+};
+
+#define VOLUME_RAYCASTER_LANEWISE(name, expression) \
+	inline Lanes name(const Lanes& a, const Lanes& b) { Lanes r; for (int i = 0; i < 4; ++i) r.v[i] = (expression); return r; }
+VOLUME_RAYCASTER_LANEWISE(operator+, a.v[i]+b.v[i])
+VOLUME_RAYCASTER_LANEWISE(operator-, a.v[i]-b.v[i])
+VOLUME_RAYCASTER_LANEWISE(operator*, a.v[i]*b.v[i])
+VOLUME_RAYCASTER_LANEWISE(operator/, a.v[i]/b.v[i])
+VOLUME_RAYCASTER_LANEWISE(operator<, a.v[i]<b.v[i] ? 1.0f : 0.0f)
+VOLUME_RAYCASTER_LANEWISE(operator>, a.v[i]>b.v[i] ? 1.0f : 0.0f)
+VOLUME_RAYCASTER_LANEWISE(operator>=, a.v[i]>=b.v[i] ? 1.0f : 0.0f)
+VOLUME_RAYCASTER_LANEWISE(operator&, (a.v[i]!=0.0f && b.v[i]!=0.0f) ? 1.0f : 0.0f)
+VOLUME_RAYCASTER_LANEWISE(minimum, a.v[i]<b.v[i] ? a.v[i] : b.v[i])
+VOLUME_RAYCASTER_LANEWISE(maximum, a.v[i]>b.v[i] ? a.v[i] : b.v[i])
+#undef VOLUME_RAYCASTER_LANEWISE
+
+inline Lanes sqrt(const Lanes& a) { Lanes r; for (int i = 0; i < 4; ++i) r.v[i] = sqrtf(a.v[i]); return r; }
+inline Lanes abs(const Lanes& a) { Lanes r; for (int i = 0; i < 4; ++i) r.v[i] = fabsf(a.v[i]); return r; }
+inline Lanes select(const Lanes& mask, const Lanes& a, const Lanes& b)
+{
+	Lanes r;
+	for (int i = 0; i < 4; ++i) r.v[i] = mask.v[i]!=0.0f ? a.v[i] : b.v[i];
+	return r;
+}
+inline int bits(const Lanes& mask)
+{
+	int b = 0;
+	for (int i = 0; i < 4; ++i) if (mask.v[i]!=0.0f) b |= 1<<i;
+	return b;
+}
+inline Lanes lanesFromBits(int b) { Lanes r; for (int i = 0; i < 4; ++i) r.v[i] = (b & (1<<i)) ? 1.0f : 0.0f; return r; }
+inline Lanes truncate(const Lanes& a, int* i)
+{
+	Lanes r;
+	for (int l = 0; l < 4; ++l) { i[l] = (int)a.v[l]; r.v[l] = (float)i[l]; }
+	return r;
+}
+
+#endif
+
+inline int popcount4(int b) { return (b&1) + ((b>>1)&1) + ((b>>2)&1) + ((b>>3)&1); }
+
+template<typename T>
+void copyVoxels(const osg::Image* image, unsigned int numComponents, float* voxels)
+{
+	for (int r = 0; r < image->r(); ++r)
+	{
+		for (int t = 0; t < image->t(); ++t)
+		{
+			const T* row = reinterpret_cast<const T*>(image->data(0, t, r));
+			for (unsigned int i = 0; i < image->s()*numComponents; ++i) *(voxels++) = normalised(row[i]);
+		}
+	}
+}
+
+// Trilinear lookups of one image for four rays at once; coordinates are texture coordinates.
+struct Sampler
+{
+	Sampler(const float* voxels, const int* size, unsigned int numComponents)
+		: _voxels(voxels), _numComponents(numComponents)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			_size[i] = size[i];
+			_scale[i] = Lanes(float(size[i]));
+			_last[i] = Lanes(float(size[i]-1));
+		}
+	}
+
+	// locates the eight voxels around each point, for the channels() that follow
+	void locate(const Lanes& x, const Lanes& y, const Lanes& z)
+	{
+		const Lanes half(0.5f), zero(0.0f);
+		const Lanes* coords[3] = { &x, &y, &z };
+		int lo[3][4];
+		for (int a = 0; a < 3; ++a)
+		{
+			// GL_CLAMP_TO_EDGE, texel centres at half integers
+			Lanes c = minimum(maximum(*coords[a]*_scale[a] - half, zero), _last[a]);
+			_fraction[a] = c - truncate(c, lo[a]);
+		}
+		for (int l = 0; l < 4; ++l)
+		{
+			int i1 = std::min(lo[0][l]+1, _size[0]-1);
+			int j1 = std::min(lo[1][l]+1, _size[1]-1);
+			int k1 = std::min(lo[2][l]+1, _size[2]-1);
+			size_t rowStride = size_t(_size[0]);
+			size_t sliceStride = rowStride*_size[1];
+			size_t rows[4] = { lo[2][l]*sliceStride + lo[1][l]*rowStride, lo[2][l]*sliceStride + j1*rowStride,
+								k1*sliceStride + lo[1][l]*rowStride, k1*sliceStride + j1*rowStride };
+			for (int c = 0; c < 4; ++c)
+			{
+				_offsets[l][c*2] = (rows[c] + lo[0][l])*_numComponents;
+				_offsets[l][c*2+1] = (rows[c] + i1)*_numComponents;
+			}
+		}
+	}
+
+	Lanes channel(int channel) const
+	{
+		if (channel==-1) return Lanes(0.0f);
+		if (channel==-2) return Lanes(1.0f);
+
+		float corners[8][4];
+		for (int l = 0; l < 4; ++l)
+		{
+			for (int c = 0; c < 8; ++c) corners[c][l] = _voxels[_offsets[l][c] + channel];
+		}
+
+		Lanes fx = _fraction[0], fy = _fraction[1], fz = _fraction[2];
+		Lanes v[4];
+		for (int c = 0; c < 4; ++c)
+		{
+			Lanes a = Lanes::load(corners[c*2]);
+			Lanes b = Lanes::load(corners[c*2+1]);
+			v[c] = a + (b - a)*fx;
+		}
+		Lanes front = v[0] + (v[1] - v[0])*fy;
+		Lanes back = v[2] + (v[3] - v[2])*fy;
+		return front + (back - front)*fz;
+	}
+
+	Lanes sample(const Lanes& x, const Lanes& y, const Lanes& z, int c)
+	{
+		locate(x, y, z);
+		return channel(c);
+	}
+
+	const float* _voxels;
+	unsigned int _numComponents;
+	int _size[3];
+	Lanes _scale[3];
+	Lanes _last[3];
+	Lanes _fraction[3];
+	size_t _offsets[4][8];
+};
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Four neighbouring pixels and their rays, in texture coordinates.
+struct VolumeRayCaster::Packet
+{
+	int numSteps[4];
+	float start[3][4];
+	float step[3][4];
+	// unit direction the samples advance in
+	float direction[3][4];
+	float colour[4][4];
+};
+
+struct VolumeRayCaster::Tile
+{
+	int x0, y0, x1, y1;
+};
+
+VolumeRayCaster::VolumeRayCaster(osgVolume::ImageLayer* layer, const osg::Matrix& geometryMatrix)
+	: _layer(layer),
+	_geometryMatrix(geometryMatrix),
+	_numComponents(0),
+	_valueChannel(0),
+	_mode(Standard),
+	_alphaCutoff(0.0f),
+	_sampleDensity(0.005f),
+	_transparency(1.0f),
+	_isoValue(1.0f),
+	_earlyTermination(0.98f),
+	_maximumValue(2.0f),
+	_tfScale(1.0f),
+	_tfOffset(0.0f),
+	_numThreads(OpenThreads::GetNumberOfProcessors()),
+	_numRays(0),
+	_numSamples(0)
+{
+	_size[0] = _size[1] = _size[2] = 0;
+
+	// proxy unit cube -> model -> image unit cube, as the technique's texgen
+	osg::Matrix imageMatrix = _layer->getLocator() ? _layer->getLocator()->getTransform() : geometryMatrix;
+	_proxyToTexture = geometryMatrix * osg::Matrix::inverse(imageMatrix);
+
+	loadVoxels();
+	updateProperties();
+}
+
+void VolumeRayCaster::setClipping(const VolumeClipping* clipping)
+{
+	_clipping = clipping;
+	if (_clipping.valid()) _proxyToVolume = _geometryMatrix * osg::Matrix::inverse(_clipping->getVolumeMatrix());
+}
+
+void VolumeRayCaster::setGradients(const osg::Image* gradients)
+{
+	_gradients.clear();
+	if (!gradients || gradients->getPixelFormat()!=GL_RGBA || gradients->getDataType()!=GL_UNSIGNED_BYTE) return;
+	if (gradients->s()!=_size[0] || gradients->t()!=_size[1] || gradients->r()!=_size[2]) return;
+
+	_gradients.resize(size_t(_size[0])*_size[1]*_size[2]*4);
+	copyVoxels<unsigned char>(gradients, 4, &_gradients[0]);
+}
+
+void VolumeRayCaster::loadVoxels()
+{
+	const osg::Image* image = _layer->getImage();
+	if (!image) return;
+
+	_size[0] = image->s();
+	_size[1] = image->t();
+	_size[2] = image->r();
+	_numComponents = osg::Image::computeNumComponents(image->getPixelFormat());
+	_voxels.resize(size_t(_size[0])*_size[1]*_size[2]*_numComponents);
+	switch(image->getDataType())
+	{
+		case(GL_UNSIGNED_BYTE): copyVoxels<unsigned char>(image, _numComponents, &_voxels[0]); break;
+		case(GL_UNSIGNED_SHORT): copyVoxels<unsigned short>(image, _numComponents, &_voxels[0]); break;
+		case(GL_FLOAT): copyVoxels<float>(image, _numComponents, &_voxels[0]); break;
+		default:
+			OSG_NOTICE<<"VolumeRayCaster: unsupported data type 0x"<<std::hex<<image->getDataType()<<std::dec<<std::endl;
+			_voxels.assign(_voxels.size(), 0.0f);
+			break;
+	}
+
+	// what texture3D() hands the shaders for each format; one channel may be uploaded as intensity
+	GLenum format = image->getPixelFormat();
+	GLint internalFormat = image->getInternalTextureFormat();
+	if (internalFormat==GL_INTENSITY || internalFormat==GL_INTENSITY8 || internalFormat==GL_INTENSITY12 || internalFormat==GL_INTENSITY16) format = GL_INTENSITY;
+	switch(format)
+	{
+		case(GL_ALPHA):				_channels[0] = -1; _channels[1] = -1; _channels[2] = -1; _channels[3] = 0; break;
+		case(GL_INTENSITY):			_channels[0] = 0; _channels[1] = 0; _channels[2] = 0; _channels[3] = 0; break;
+		case(GL_LUMINANCE_ALPHA):	_channels[0] = 0; _channels[1] = 0; _channels[2] = 0; _channels[3] = 1; break;
+		case(GL_RGB):				_channels[0] = 0; _channels[1] = 1; _channels[2] = 2; _channels[3] = -2; break;
+		case(GL_RGBA):				_channels[0] = 0; _channels[1] = 1; _channels[2] = 2; _channels[3] = 3; break;
+		default:					_channels[0] = 0; _channels[1] = 0; _channels[2] = 0; _channels[3] = -2; break;
+	}
+	// the value the transfer function looks up: alpha where there is one, luminance or red otherwise
+	_valueChannel = _channels[3]>=0 ? _channels[3] : 0;
+}
+
+void VolumeRayCaster::updateProperties()
+{
+	osgVolume::CollectPropertiesVisitor cpv;
+	if (_layer->getProperty()) _layer->getProperty()->accept(cpv);
+
+	// the same precedence RayTracedTechnique gives them
+	if (cpv._mipProperty.valid()) _mode = MaximumIntensityProjection;
+	else if (cpv._isoProperty.valid()) _mode = Isosurface;
+	else if (cpv._lightingProperty.valid()) _mode = Light;
+	else _mode = Standard;
+
+	_alphaCutoff = cpv._afProperty.valid() ? cpv._afProperty->getValue() : 0.0f;
+	_sampleDensity = cpv._sampleDensityProperty.valid() ? cpv._sampleDensityProperty->getValue() : 0.005f;
+	_transparency = cpv._transparencyProperty.valid() ? cpv._transparencyProperty->getValue() : 1.0f;
+	_isoValue = cpv._isoProperty.valid() ? cpv._isoProperty->getValue() : 1.0f;
+	_sampleDensity = std::max(_sampleDensity, 1e-5f);
+
+	_tfTable.clear();
+	osg::TransferFunction1D* tf = cpv._tfProperty.valid() ? dynamic_cast<osg::TransferFunction1D*>(cpv._tfProperty->getTransferFunction()) : 0;
+	const osg::Image* table = tf ? tf->getImage() : 0;
+	if (table && table->s()>0 && table->getDataType()==GL_FLOAT && table->getPixelFormat()==GL_RGBA)
+	{
+		const osg::Vec4* colours = reinterpret_cast<const osg::Vec4*>(table->data());
+		_tfTable.assign(colours, colours + table->s());
+
+		float tfRange = tf->getMaximum() - tf->getMinimum();
+		if (tfRange==0.0f) tfRange = 1.0f;
+		_tfScale = _layer->getTexelScale()[3] / tfRange;
+		_tfOffset = (_layer->getTexelOffset()[3] - tf->getMinimum()) / tfRange;
+	}
+}
+
+namespace
+{
+
+// The colours of the transfer function at four values, with linear filtering and clamping to the edge.
+void lookUp(const std::vector<osg::Vec4>& table, const Lanes& value, Lanes* rgba)
+{
+	float v[4];
+	value.store(v);
+	float out[4][4];
+	int numEntries = table.size();
+	for (int l = 0; l < 4; ++l)
+	{
+		float x = osg::clampBetween(v[l]*numEntries - 0.5f, 0.0f, float(numEntries-1));
+		int i0 = int(x);
+		int i1 = std::min(i0+1, numEntries-1);
+		float f = x - i0;
+		osg::Vec4 c = table[i0]*(1.0f-f) + table[i1]*f;
+		for (int i = 0; i < 4; ++i) out[i][l] = c[i];
+	}
+	for (int i = 0; i < 4; ++i) rgba[i] = Lanes::load(out[i]);
+}
+
+// The shading of a headlight on the surface through each point, as the lit
+// shaders apply it; the normal is the value's gradient, central differences
+// g apart. Sampler's located voxels are left changed.
+Lanes lightScale(Sampler& sampler, int channel, const Lanes& x, const Lanes& y, const Lanes& z,
+				const Lanes& gx, const Lanes& gy, const Lanes& gz,
+				const Lanes& dirX, const Lanes& dirY, const Lanes& dirZ)
+{
+	Lanes nx = sampler.sample(x+gx, y, z, channel) - sampler.sample(x-gx, y, z, channel);
+	Lanes ny = sampler.sample(x, y+gy, z, channel) - sampler.sample(x, y-gy, z, channel);
+	Lanes nz = sampler.sample(x, y, z+gz, channel) - sampler.sample(x, y, z-gz, channel);
+	Lanes length = sqrt(nx*nx + ny*ny + nz*nz);
+	Lanes sloped = length > Lanes(1e-6f);
+	Lanes cosine = abs(nx*dirX + ny*dirY + nz*dirZ) / select(sloped, length, Lanes(1.0f));
+	return select(sloped, Lanes(0.1f) + Lanes(0.9f)*cosine, Lanes(1.0f));
+}
+
+// The same from gradients worked out at load, as the shaders with
+// VOLUME_GRADIENTS take them: one lookup instead of six.
+Lanes lightScale(Sampler& gradients, const Lanes& x, const Lanes& y, const Lanes& z,
+				const Lanes& dirX, const Lanes& dirY, const Lanes& dirZ)
+{
+	const Lanes one(1.0f), two(2.0f);
+	gradients.locate(x, y, z);
+	Lanes nx = gradients.channel(0)*two - one;
+	Lanes ny = gradients.channel(1)*two - one;
+	Lanes nz = gradients.channel(2)*two - one;
+	Lanes length = sqrt(nx*nx + ny*ny + nz*nz);
+	Lanes sloped = (gradients.channel(3) >= Lanes(0.5f/255.0f)) & (length > Lanes(1e-3f));
+	Lanes cosine = abs(nx*dirX + ny*dirY + nz*dirZ) / select(sloped, length, one);
+	return select(sloped, Lanes(0.1f) + Lanes(0.9f)*cosine, one);
+}
+
+class RenderWorker : public OpenThreads::Thread
+{
+public:
+	RenderWorker(const VolumeRayCaster* caster, const std::vector<VolumeRayCaster::Tile>* tiles,
+				OpenThreads::Atomic* next, osg::Image* image)
+		: _caster(caster), _tiles(tiles), _next(next), _image(image), numRays(0), numSamples(0)
+	{
+	}
+
+	virtual void run()
+	{
+		for(;;)
+		{
+			unsigned int t = ++(*_next) - 1;
+			if (t>=_tiles->size()) return;
+			_caster->renderTile((*_tiles)[t], _image, numRays, numSamples);
+		}
+	}
+
+	const VolumeRayCaster* _caster;
+	const std::vector<VolumeRayCaster::Tile>* _tiles;
+	OpenThreads::Atomic* _next;
+	osg::Image* _image;
+	unsigned long long numRays;
+	unsigned long long numSamples;
+};
+
+}
+
+void VolumeRayCaster::render(const osg::Matrix& view, const osg::Matrix& projection, osg::Image* image)
+{
+	int width = image->s(), height = image->t();
+	if (image->getPixelFormat()!=GL_RGBA || image->getDataType()!=GL_UNSIGNED_BYTE || image->r()!=1)
+	{
+		image->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+	}
+
+	_inverseViewProjection = osg::Matrix::inverse(view * projection);
+	_modelToProxy = osg::Matrix::inverse(_geometryMatrix);
+
+	const int tileSize = 32;
+	std::vector<Tile> tiles;
+	for (int y = 0; y < height; y += tileSize)
+	{
+		for (int x = 0; x < width; x += tileSize)
+		{
+			Tile tile = { x, y, std::min(x+tileSize, width), std::min(y+tileSize, height) };
+			tiles.push_back(tile);
+		}
+	}
+
+	OpenThreads::Atomic next;
+	std::vector<RenderWorker*> workers;
+	for (unsigned int i = 0; i < numWorkers(_numThreads, tiles.size()); ++i) workers.push_back(new RenderWorker(this, &tiles, &next, image));
+	runWorkers(workers);
+
+	_numRays = 0;
+	_numSamples = 0;
+	for (unsigned int i = 0; i < workers.size(); ++i)
+	{
+		_numRays += workers[i]->numRays;
+		_numSamples += workers[i]->numSamples;
+		delete workers[i];
+	}
+}
+
+void VolumeRayCaster::renderTile(const Tile& tile, osg::Image* image, unsigned long long& numRays, unsigned long long& numSamples) const
+{
+	float width = image->s(), height = image->t();
+	for (int y = tile.y0; y < tile.y1; y += 2)
+	{
+		for (int x = tile.x0; x < tile.x1; x += 2)
+		{
+			// a 2x2 quad per packet keeps the four rays close together in the volume
+			Packet packet;
+			int px[4] = { x, x+1, x, x+1 };
+			int py[4] = { y, y, y+1, y+1 };
+			for (int l = 0; l < 4; ++l)
+			{
+				packet.numSteps[l] = 0;
+				for (int a = 0; a < 3; ++a) packet.start[a][l] = packet.step[a][l] = packet.direction[a][l] = 0.0f;
+				if (px[l]>=tile.x1 || py[l]>=tile.y1) continue;
+
+				float ndcX = (px[l]+0.5f)/width*2.0f - 1.0f;
+				float ndcY = (py[l]+0.5f)/height*2.0f - 1.0f;
+				osg::Vec3 nearPoint = osg::Vec3(ndcX, ndcY, -1.0f) * _inverseViewProjection * _modelToProxy;
+				osg::Vec3 farPoint = osg::Vec3(ndcX, ndcY, 1.0f) * _inverseViewProjection * _modelToProxy;
+
+				// slabs of the proxy's unit cube
+				osg::Vec3 d = farPoint - nearPoint;
+				float t0 = 0.0f, t1 = 1.0f;
+				for (int a = 0; a < 3 && t0<=t1; ++a)
+				{
+					if (d[a]==0.0f)
+					{
+						if (nearPoint[a]<0.0f || nearPoint[a]>1.0f) t0 = 2.0f;
+						continue;
+					}
+					float ta = (0.0f - nearPoint[a])/d[a];
+					float tb = (1.0f - nearPoint[a])/d[a];
+					t0 = std::max(t0, std::min(ta, tb));
+					t1 = std::min(t1, std::max(ta, tb));
+				}
+				if (t0>=t1) continue;
+				if (_clipping.valid() && !_clipping->clipSegment(nearPoint*_proxyToVolume, farPoint*_proxyToVolume, t0, t1)) continue;
+
+				osg::Vec3 entry = (nearPoint + d*t0) * _proxyToTexture;
+				osg::Vec3 exit = (nearPoint + d*t1) * _proxyToTexture;
+				osg::Vec3 span = exit - entry;
+				float length = span.length();
+				if (length<=0.0f) continue;
+
+				// the shaders' step: sampleDensity in texture coordinates, end points included
+				int numSteps = std::min(65536, std::max(2, int(ceilf(length/_sampleDensity))));
+				osg::Vec3 from = entry;
+				osg::Vec3 step = span / float(numSteps-1);
+				osg::Vec3 direction = step / step.length();
+				packet.numSteps[l] = numSteps;
+				for (int a = 0; a < 3; ++a)
+				{
+					packet.start[a][l] = from[a];
+					packet.step[a][l] = step[a];
+					packet.direction[a][l] = direction[a];
+				}
+				++numRays;
+			}
+
+			castPacket(packet, numSamples);
+
+			for (int l = 0; l < 4; ++l)
+			{
+				if (px[l]>=tile.x1 || py[l]>=tile.y1) continue;
+				unsigned char* pixel = image->data(px[l], py[l]);
+				for (int c = 0; c < 4; ++c)
+				{
+					pixel[c] = (unsigned char)(osg::clampBetween(packet.colour[c][l], 0.0f, 1.0f)*255.0f + 0.5f);
+				}
+			}
+		}
+	}
+}
+
+void VolumeRayCaster::castPacket(Packet& packet, unsigned long long& numSamples) const
+{
+	const Lanes zero(0.0f), one(1.0f);
+	Lanes colour[4] = { zero, zero, zero, zero };
+
+	int maxSteps = 0;
+	for (int l = 0; l < 4; ++l) maxSteps = std::max(maxSteps, packet.numSteps[l]);
+	if (maxSteps==0 || _voxels.empty())
+	{
+		for (int c = 0; c < 4; ++c) colour[c].store(packet.colour[c]);
+		return;
+	}
+
+	Sampler sampler(&_voxels[0], _size, _numComponents);
+	Sampler gradients(_gradients.empty() ? 0 : &_gradients[0], _size, 4);
+	bool hasGradients = !_gradients.empty();
+	bool hasTF = !_tfTable.empty();
+	Lanes x = Lanes::load(packet.start[0]), y = Lanes::load(packet.start[1]), z = Lanes::load(packet.start[2]);
+	Lanes dx = Lanes::load(packet.step[0]), dy = Lanes::load(packet.step[1]), dz = Lanes::load(packet.step[2]);
+	Lanes dirX = Lanes::load(packet.direction[0]), dirY = Lanes::load(packet.direction[1]), dirZ = Lanes::load(packet.direction[2]);
+	Lanes tfScale(_tfScale), tfOffset(_tfOffset), transparency(_transparency), alphaCutoff(_alphaCutoff), isoValue(_isoValue);
+
+	Lanes gx(1.0f/_size[0]), gy(1.0f/_size[1]), gz(1.0f/_size[2]);
+
+	int remaining = 0;
+	for (int l = 0; l < 4; ++l) if (packet.numSteps[l]>0) remaining |= 1<<l;
+
+	Lanes maxValue(-FLT_MAX);
+	Lanes transmittance = one;
+	Lanes earlyTermination(_earlyTermination), maximumValue(_maximumValue);
+	Lanes previous = zero;
+	Lanes hitX = zero, hitY = zero, hitZ = zero;
+	int hit = 0;
+	for (int k = 0; k < maxSteps && remaining; ++k)
+	{
+		for (int l = 0; l < 4; ++l) if (k>=packet.numSteps[l]) remaining &= ~(1<<l);
+		Lanes active = lanesFromBits(remaining);
+		numSamples += popcount4(remaining);
+
+		sampler.locate(x, y, z);
+		Lanes value = sampler.channel(_valueChannel);
+		switch(_mode)
+		{
+			case(Standard):
+			case(Light):
+			{
+				Lanes sample[4];
+				if (hasTF) lookUp(_tfTable, value*tfScale + tfOffset, sample);
+				else for (int c = 0; c < 4; ++c) sample[c] = sampler.channel(_channels[c]);
+
+				Lanes r = sample[3]*transparency;
+				Lanes contributes = active & (r > alphaCutoff);
+				if (!bits(contributes)) break;
+
+				if (_mode==Light)
+				{
+					Lanes scale = hasGradients ? lightScale(gradients, x, y, z, dirX, dirY, dirZ) :
+												lightScale(sampler, _valueChannel, x, y, z, gx, gy, gz, dirX, dirY, dirZ);
+					for (int c = 0; c < 3; ++c) sample[c] = sample[c]*scale;
+				}
+				// front to back: each sample shows through what is in front of it
+				Lanes weight = r*transmittance;
+				for (int c = 0; c < 3; ++c) colour[c] = select(contributes, colour[c] + sample[c]*weight, colour[c]);
+				colour[3] = select(contributes, colour[3] + r, colour[3]);
+				transmittance = select(contributes, transmittance*maximum(one - r, zero), transmittance);
+
+				// what is behind can add no more than what still shows through
+				remaining &= ~bits(contributes & ((one - transmittance) >= earlyTermination));
+				break;
+			}
+			case(MaximumIntensityProjection):
+			{
+				maxValue = select(active, maximum(maxValue, value), maxValue);
+				// nothing further along can be brighter
+				remaining &= ~bits(active & (maxValue >= maximumValue));
+				break;
+			}
+			case(Isosurface):
+			{
+				// the first crossing from the front, refined between the two samples
+				Lanes crossed = active & (value >= isoValue);
+				int crossing = bits(crossed);
+				if (!crossing) break;
+
+				Lanes f = minimum(maximum((isoValue - previous)/maximum(value - previous, Lanes(1e-6f)), zero), one);
+				if (k==0) f = one;
+				hitX = select(crossed, x - dx + dx*f, hitX);
+				hitY = select(crossed, y - dy + dy*f, hitY);
+				hitZ = select(crossed, z - dz + dz*f, hitZ);
+				hit |= crossing;
+				remaining &= ~crossing;
+				break;
+			}
+		}
+		previous = value;
+		x = x + dx;
+		y = y + dy;
+		z = z + dz;
+	}
+
+	switch(_mode)
+	{
+		case(Standard):
+		case(Light):
+		{
+			colour[3] = minimum(colour[3], one);
+			Lanes kept = colour[3] >= alphaCutoff;
+			for (int c = 0; c < 4; ++c) colour[c] = select(kept, colour[c], zero);
+			break;
+		}
+		case(MaximumIntensityProjection):
+		{
+			Lanes any = lanesFromBits((packet.numSteps[0]>0 ? 1 : 0) | (packet.numSteps[1]>0 ? 2 : 0) | (packet.numSteps[2]>0 ? 4 : 0) | (packet.numSteps[3]>0 ? 8 : 0));
+			maxValue = select(any, maxValue, zero);
+			if (hasTF) lookUp(_tfTable, maxValue*tfScale + tfOffset, colour);
+			else for (int c = 0; c < 4; ++c) colour[c] = _channels[c]==-1 ? zero : (_channels[c]==-2 ? one : maxValue);
+			colour[3] = colour[3]*transparency;
+			Lanes kept = any & (colour[3] >= alphaCutoff);
+			for (int c = 0; c < 4; ++c) colour[c] = select(kept, colour[c], zero);
+			break;
+		}
+		case(Isosurface):
+		{
+			if (!hit) break;
+			Lanes hitMask = lanesFromBits(hit);
+			Lanes base[4];
+			if (hasTF) lookUp(_tfTable, isoValue*tfScale + tfOffset, base);
+			else for (int c = 0; c < 4; ++c) base[c] = one;
+
+			Lanes scale = hasGradients ? lightScale(gradients, hitX, hitY, hitZ, dirX, dirY, dirZ) :
+										lightScale(sampler, _valueChannel, hitX, hitY, hitZ, gx, gy, gz, dirX, dirY, dirZ);
+			for (int c = 0; c < 3; ++c) colour[c] = select(hitMask, base[c]*scale, zero);
+			colour[3] = select(hitMask, one, zero);
+			break;
+		}
+	}
+
+	for (int c = 0; c < 4; ++c) colour[c].store(packet.colour[c]);
+}
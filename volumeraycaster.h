@@ -0,0 +1,115 @@
+#ifndef	__AJ_VOLUMERAYCASTER__
+#define __AJ_VOLUMERAYCASTER__
+
+#include "volumeclip.h"
+
+#include <osg/Image>
+#include <osg/Matrix>
+#include <osg/TransferFunction>
+#include <osgVolume/Layer>
+
+#include <vector>
+
+// A CPU reference for what RayTracedTechnique draws, for measuring and
+// checking rendering without a GL context. It reads the same ImageLayer,
+// transfer function and property values a VolumeTile would, and follows the
+// sampling and compositing of the shaders in volumeshaders.h for the four
+// shading modes, early termination included.
+//
+// The image is rendered in tiles shared out among threads; within a tile,
+// rays go four at a time through SSE2 where the compiler targets it.
+class VolumeRayCaster : public osg::Referenced
+{
+public:
+	enum Mode
+	{
+		Standard,
+		Light,
+		Isosurface,
+		MaximumIntensityProjection
+	};
+
+	// geometryMatrix maps the unit cube of the proxy geometry into the model,
+	// as the tile's Locator does; the layer's Locator places the image.
+	VolumeRayCaster(osgVolume::ImageLayer* layer, const osg::Matrix& geometryMatrix);
+
+	// Reads the shading mode and property values off the layer again, after they changed.
+	void updateProperties();
+
+	Mode getMode() const { return _mode; }
+
+	// Rays are clipped as the tiles' shaders clip them, 0 for none.
+	void setClipping(const VolumeClipping* clipping);
+
+	// Where rays stop early, as ShadingVariants sets them for the shaders:
+	// compositing once what a ray passed is this opaque, 0 never; maximum
+	// intensity projection on reaching the value, negative never.
+	void setEarlyTermination(float opacity) { _earlyTermination = opacity>0.0f ? opacity : 2.0f; }
+	void setMaximumValue(float value) { _maximumValue = value>=0.0f ? value : 2.0f; }
+
+	// Lit modes take their normals from gradients, see computeGradients(), as
+	// the shaders do when the tile has them; 0 to work them out from the image.
+	void setGradients(const osg::Image* gradients);
+
+	void setNumThreads(unsigned int numThreads) { _numThreads = numThreads>0 ? numThreads : 1; }
+	unsigned int getNumThreads() const { return _numThreads; }
+
+	// Renders into image, which becomes GL_RGBA GL_UNSIGNED_BYTE of its
+	// current size, through a camera whose view and projection map the model
+	// to clip space.
+	void render(const osg::Matrix& view, const osg::Matrix& projection, osg::Image* image);
+
+	// Rays that met the volume and samples they took, in the last render().
+	unsigned long long getNumRays() const { return _numRays; }
+	unsigned long long getNumSamples() const { return _numSamples; }
+
+	struct Packet;
+	struct Tile;
+
+	void renderTile(const Tile& tile, osg::Image* image, unsigned long long& numRays, unsigned long long& numSamples) const;
+
+protected:
+	virtual ~VolumeRayCaster() {}
+
+	void loadVoxels();
+	void castPacket(Packet& packet, unsigned long long& numSamples) const;
+
+	osg::ref_ptr<osgVolume::ImageLayer> _layer;
+	osg::Matrix _geometryMatrix;
+	osg::Matrix _proxyToTexture;
+	osg::ref_ptr<const VolumeClipping> _clipping;
+	osg::Matrix _proxyToVolume;
+
+	// the image as normalised floats, all components of a voxel together
+	int _size[3];
+	unsigned int _numComponents;
+	std::vector<float> _voxels;
+	// component read for each of r, g, b, a as a GL texture lookup returns
+	// them, -1 for a constant 0 and -2 for a constant 1
+	int _channels[4];
+	int _valueChannel;
+	// the gradients as normalised floats, RGBA, when set
+	std::vector<float> _gradients;
+
+	Mode _mode;
+	float _alphaCutoff;
+	float _sampleDensity;
+	float _transparency;
+	float _isoValue;
+	float _earlyTermination;
+	float _maximumValue;
+
+	std::vector<osg::Vec4> _tfTable;
+	float _tfScale;
+	float _tfOffset;
+
+	unsigned int _numThreads;
+	unsigned long long _numRays;
+	unsigned long long _numSamples;
+
+	// the camera of the current render()
+	osg::Matrix _inverseViewProjection;
+	osg::Matrix _modelToProxy;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "volumeregistry.h"
+#include "volumecache.h"
+
+#include <OpenThreads/ScopedLock>
+
+#include <sstream>
+
+VolumeRegistry* VolumeRegistry::instance()
+{
+	static VolumeRegistry registry;
+	return &registry;
+}
+
+VolumeLoader* VolumeRegistry::getLoader(const std::string& imageFile, const VolumeOptions& options, int maximumTextureSize, bool gradients)
+{
+	// the levels and gradients the loader adds depend on more than the cache's key
+	std::ostringstream key;
+	key<<std::hex<<volumeSourceKey(imageFile, options)<<std::dec<<"-"<<imageFile<<"-"<<maximumTextureSize<<"-"<<gradients;
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+	osg::ref_ptr<VolumeLoader> loader;
+	if (_loaders[key.str()].lock(loader)) return loader.release();
+
+	loader = new VolumeLoader(imageFile, options, maximumTextureSize);
+	loader->setComputeGradients(gradients);
+	loader->start();
+	_loaders[key.str()] = loader.get();
+
+	// the entries of volumes gone since
+	for (std::map< std::string, osg::observer_ptr<VolumeLoader> >::iterator itr = _loaders.begin(); itr != _loaders.end();)
+	{
+		if (!itr->second.valid()) _loaders.erase(itr++);
+		else ++itr;
+	}
+	return loader.release();
+}
+
+osg::Texture* VolumeRegistry::shareTexture(osg::Texture* texture)
+{
+	const osg::Image* image = texture ? texture->getImage(0) : 0;
+	if (!image) return texture;
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+	osg::ref_ptr<osg::Texture> shared;
+	if (_textures[image].lock(shared)) return shared.get();
+
+	_textures[image] = texture;
+
+	for (std::map< const osg::Image*, osg::observer_ptr<osg::Texture> >::iterator itr = _textures.begin(); itr != _textures.end();)
+	{
+		if (!itr->second.valid()) _textures.erase(itr++);
+		else ++itr;
+	}
+	return texture;
+}
@@ -0,0 +1,44 @@
+#ifndef	__AJ_VOLUMEREGISTRY__
+#define __AJ_VOLUMEREGISTRY__
+
+#include "volumedata.h"
+#include "volumeloader.h"
+
+#include <osg/Texture>
+#include <osg/observer_ptr>
+
+#include <OpenThreads/Mutex>
+
+#include <map>
+#include <string>
+
+// The volumes loaded in this process, so the myOsgVolume instances showing
+// one source with the same processing share a single copy of it: one load,
+// one set of images, and one texture of each on the GPU. Every instance keeps
+// its own tiles, transfer function, properties and transform, and classifies
+// its own copy of the occupancy grid.
+//
+// Entries are held weakly: a volume goes with the last instance holding its
+// loader, and the next one asking for it loads it again.
+class VolumeRegistry
+{
+public:
+	static VolumeRegistry* instance();
+
+	// The loader of imageFile with options, maximumTextureSize and gradients,
+	// see VolumeLoader, started by the first instance to ask for it.
+	VolumeLoader* getLoader(const std::string& imageFile, const VolumeOptions& options, int maximumTextureSize, bool gradients);
+
+	// The texture already made of texture's image, texture itself when it is
+	// the first; the textures of one image are alike wherever they are made.
+	osg::Texture* shareTexture(osg::Texture* texture);
+
+private:
+	VolumeRegistry() {}
+
+	OpenThreads::Mutex _mutex;
+	std::map< std::string, osg::observer_ptr<VolumeLoader> > _loaders;
+	std::map< const osg::Image*, osg::observer_ptr<osg::Texture> > _textures;
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include "volumeshaders.h"
+
+#include <osg/Notify>
+#include <osg/Program>
+#include <osg/Shader>
+#include <osg/Uniform>
+
+#include <string>
+
+namespace
+{
+
+// the body shared by all the variants, the #defines in front pick one
+const char* rayCastSource =
+	"uniform sampler3D baseTexture;\n"
+	"uniform float SampleDensityValue;\n"
+	"uniform float TransparencyValue;\n"
+	"uniform float AlphaFuncValue;\n"
+	"uniform float IsoSurfaceValue;\n"
+	"uniform float volumeEarlyTermination;\n"
+	"uniform float volumeMaximumValue;\n"
+	"uniform vec3 volumeTexelSize;\n"
+	"#ifdef VOLUME_GRADIENTS\n"
+	"uniform sampler3D volumeGradientTexture;\n"
+	"#endif\n"
+	"#ifdef VOLUME_TF\n"
+	"uniform sampler1D tfTexture;\n"
+	"uniform float tfScale;\n"
+	"uniform float tfOffset;\n"
+	"#endif\n"
+	"\n"
+	"varying vec4 cameraPos;\n"
+	"varying vec4 vertexPos;\n"
+	"varying mat4 texgen;\n"
+	"varying vec4 baseColor;\n"
+	"\n"
+	"vec4 volumeColor(float value, vec4 voxel)\n"
+	"{\n"
+	"#ifdef VOLUME_TF\n"
+	"    return texture1D(tfTexture, value*tfScale+tfOffset);\n"
+	"#else\n"
+	"    return voxel;\n"
+	"#endif\n"
+	"}\n"
+	"\n"
+	"// a headlight on the surface through texcoord, its normal the value's gradient\n"
+	"float volumeLight(vec3 texcoord, vec3 eyeDirection)\n"
+	"{\n"
+	"#ifdef VOLUME_GRADIENTS\n"
+	"    // the unit normal as n*0.5+0.5, and none where the slope in alpha is 0\n"
+	"    vec4 gradient = texture3D(volumeGradientTexture, texcoord);\n"
+	"    vec3 normal = gradient.rgb*2.0 - 1.0;\n"
+	"    float slope = length(normal);\n"
+	"    if (gradient.a<0.5/255.0 || slope<1e-3) return 1.0;\n"
+	"#else\n"
+	"    vec3 dx = vec3(volumeTexelSize.x, 0.0, 0.0);\n"
+	"    vec3 dy = vec3(0.0, volumeTexelSize.y, 0.0);\n"
+	"    vec3 dz = vec3(0.0, 0.0, volumeTexelSize.z);\n"
+	"    vec3 normal = vec3(texture3D(baseTexture, texcoord+dx).VOLUME_VALUE - texture3D(baseTexture, texcoord-dx).VOLUME_VALUE,\n"
+	"                       texture3D(baseTexture, texcoord+dy).VOLUME_VALUE - texture3D(baseTexture, texcoord-dy).VOLUME_VALUE,\n"
+	"                       texture3D(baseTexture, texcoord+dz).VOLUME_VALUE - texture3D(baseTexture, texcoord-dz).VOLUME_VALUE);\n"
+	"    float slope = length(normal);\n"
+	"    if (slope<1e-6) return 1.0;\n"
+	"#endif\n"
+	"    return 0.1 + 0.9*abs(dot(normal, eyeDirection))/slope;\n"
+	"}\n"
+	"\n"
+	"void main(void)\n"
+	"{\n"
+	"    vec4 t0 = vertexPos;\n"
+	"    vec4 te = cameraPos;\n"
+	"\n"
+	"    // the camera end moved onto the proxy's unit cube when it is outside\n"
+	"    vec3 d = t0.xyz - te.xyz;\n"
+	"    float s = 0.0;\n"
+	"    if (te.x<0.0) s = max(s, -te.x/d.x);\n"
+	"    if (te.x>1.0) s = max(s, (1.0-te.x)/d.x);\n"
+	"    if (te.y<0.0) s = max(s, -te.y/d.y);\n"
+	"    if (te.y>1.0) s = max(s, (1.0-te.y)/d.y);\n"
+	"    if (te.z<0.0) s = max(s, -te.z/d.z);\n"
+	"    if (te.z>1.0) s = max(s, (1.0-te.z)/d.z);\n"
+	"    te = te + (t0-te)*s;\n"
+	"\n"
+	"    t0 = t0 * texgen;\n"
+	"    te = te * texgen;\n"
+	"\n"
+	"    // from the camera end back\n"
+	"    float num_iterations = ceil(length((t0-te).xyz)/SampleDensityValue);\n"
+	"    if (num_iterations<2.0) num_iterations = 2.0;\n"
+	"    if (num_iterations>2048.0) num_iterations = 2048.0;\n"
+	"    vec3 deltaTexCoord = (t0-te).xyz/(num_iterations-1.0);\n"
+	"    vec3 texcoord = te.xyz;\n"
+	"    vec3 eyeDirection = deltaTexCoord/max(length(deltaTexCoord), 1e-6);\n"
+	"\n"
+	"#if defined(VOLUME_STANDARD) || defined(VOLUME_LIGHT)\n"
+	"    vec4 fragColor = vec4(0.0, 0.0, 0.0, 0.0);\n"
+	"    float transmittance = 1.0;\n"
+	"    while(num_iterations>0.0)\n"
+	"    {\n"
+	"        vec4 voxel = texture3D(baseTexture, texcoord);\n"
+	"        vec4 color = volumeColor(voxel.VOLUME_VALUE, voxel);\n"
+	"        float r = color.a*TransparencyValue;\n"
+	"        if (r>AlphaFuncValue)\n"
+	"        {\n"
+	"#ifdef VOLUME_LIGHT\n"
+	"            color.rgb *= volumeLight(texcoord, eyeDirection);\n"
+	"#endif\n"
+	"            fragColor.rgb += color.rgb*(r*transmittance);\n"
+	"            fragColor.a += r;\n"
+	"            transmittance *= max(1.0-r, 0.0);\n"
+	"            if (1.0-transmittance>=volumeEarlyTermination) break;\n"
+	"        }\n"
+	"        texcoord += deltaTexCoord;\n"
+	"        --num_iterations;\n"
+	"    }\n"
+	"    fragColor.a = min(fragColor.a, 1.0);\n"
+	"    if (fragColor.a<AlphaFuncValue) discard;\n"
+	"#endif\n"
+	"\n"
+	"#ifdef VOLUME_MIP\n"
+	"    vec4 maxVoxel = vec4(0.0, 0.0, 0.0, 0.0);\n"
+	"    float maxValue = -1.0;\n"
+	"    while(num_iterations>0.0)\n"
+	"    {\n"
+	"        vec4 voxel = texture3D(baseTexture, texcoord);\n"
+	"        if (voxel.VOLUME_VALUE>maxValue)\n"
+	"        {\n"
+	"            maxValue = voxel.VOLUME_VALUE;\n"
+	"            maxVoxel = voxel;\n"
+	"            if (maxValue>=volumeMaximumValue) break;\n"
+	"        }\n"
+	"        texcoord += deltaTexCoord;\n"
+	"        --num_iterations;\n"
+	"    }\n"
+	"    vec4 fragColor = volumeColor(maxValue, maxVoxel);\n"
+	"    fragColor.a *= TransparencyValue;\n"
+	"    if (fragColor.a<AlphaFuncValue) discard;\n"
+	"#endif\n"
+	"\n"
+	"#ifdef VOLUME_ISOSURFACE\n"
+	"    float previous = 0.0;\n"
+	"    float f = 1.0;\n"
+	"    bool hit = false;\n"
+	"    while(num_iterations>0.0)\n"
+	"    {\n"
+	"        float value = texture3D(baseTexture, texcoord).VOLUME_VALUE;\n"
+	"        if (value>=IsoSurfaceValue)\n"
+	"        {\n"
+	"            // refined between this sample and the last, unless the ray started inside\n"
+	"            if (texcoord!=te.xyz) f = clamp((IsoSurfaceValue-previous)/max(value-previous, 1e-6), 0.0, 1.0);\n"
+	"            texcoord = texcoord - deltaTexCoord + deltaTexCoord*f;\n"
+	"            hit = true;\n"
+	"            break;\n"
+	"        }\n"
+	"        previous = value;\n"
+	"        texcoord += deltaTexCoord;\n"
+	"        --num_iterations;\n"
+	"    }\n"
+	"    if (!hit) discard;\n"
+	"#ifdef VOLUME_TF\n"
+	"    vec4 fragColor = texture1D(tfTexture, IsoSurfaceValue*tfScale+tfOffset);\n"
+	"#else\n"
+	"    vec4 fragColor = vec4(1.0, 1.0, 1.0, 1.0);\n"
+	"#endif\n"
+	"    fragColor.rgb *= volumeLight(texcoord, eyeDirection);\n"
+	"    fragColor.a = 1.0;\n"
+	"#endif\n"
+	"\n"
+	"    gl_FragColor = fragColor;\n"
+	"}\n";
+
+// what texture3D() gives the value in: alpha where the texture has one
+bool valueInAlpha(const osg::Image* image)
+{
+	GLint internalFormat = image->getInternalTextureFormat();
+	if (internalFormat==GL_INTENSITY || internalFormat==GL_INTENSITY8 || internalFormat==GL_INTENSITY12 || internalFormat==GL_INTENSITY16) return true;
+	GLenum format = image->getPixelFormat();
+	return format==GL_ALPHA || format==GL_LUMINANCE_ALPHA || format==GL_RGBA || format==GL_BGRA;
+}
+
+// osgVolume's fragment shaders that read the varyings of the vertex shader the replacement is written against
+bool knownShader(const osg::Shader* shader)
+{
+	const std::string& source = shader->getShaderSource();
+	return source.find("varying mat4 texgen;")!=std::string::npos &&
+		source.find("varying vec4 cameraPos;")!=std::string::npos &&
+		source.find("varying vec4 vertexPos;")!=std::string::npos;
+}
+
+}
+
+bool applyRayCastShaders(osg::StateSet* stateset, osgVolume::Property* property, const osg::Image* image, osg::Texture3D* gradients)
+{
+	osg::Program* program = dynamic_cast<osg::Program*>(stateset->getAttribute(osg::StateAttribute::PROGRAM));
+	if (!program || !property || !image) return false;
+
+	// the variant the technique was built for, found as it finds it
+	osgVolume::CollectPropertiesVisitor cpv;
+	property->accept(cpv);
+
+	std::string defines;
+	if (cpv._mipProperty.valid()) defines = "#define VOLUME_MIP\n";
+	else if (cpv._isoProperty.valid()) defines = "#define VOLUME_ISOSURFACE\n";
+	else if (cpv._lightingProperty.valid()) defines = "#define VOLUME_LIGHT\n";
+	else defines = "#define VOLUME_STANDARD\n";
+	if (cpv._tfProperty.valid()) defines += "#define VOLUME_TF\n";
+	bool lit = !cpv._mipProperty.valid() && (cpv._isoProperty.valid() || cpv._lightingProperty.valid());
+	if (lit && gradients) defines += "#define VOLUME_GRADIENTS\n";
+	defines += valueInAlpha(image) ? "#define VOLUME_VALUE a\n" : "#define VOLUME_VALUE r\n";
+
+	osg::ref_ptr<osg::Program> replacement = new osg::Program;
+	for (unsigned int i = 0; i < program->getNumShaders(); ++i)
+	{
+		const osg::Shader* shader = program->getShader(i);
+		if (shader->getType()!=osg::Shader::FRAGMENT)
+		{
+			replacement->addShader(const_cast<osg::Shader*>(shader));
+			continue;
+		}
+		if (!knownShader(shader))
+		{
+			static bool warned = false;
+			if (!warned) OSG_NOTICE<<"applyRayCastShaders: unknown osgVolume shaders, rays are marched without early termination"<<std::endl;
+			warned = true;
+			return false;
+		}
+	}
+	replacement->addShader(new osg::Shader(osg::Shader::FRAGMENT, defines + rayCastSource));
+	stateset->setAttribute(replacement.get());
+
+	// central differences one voxel apart, for the lit variants
+	stateset->addUniform(new osg::Uniform("volumeTexelSize", osg::Vec3(1.0f/image->s(), 1.0f/image->t(), 1.0f/image->r())));
+
+	// or the gradients worked out at load, on the unit after the volume's and the transfer function's
+	if (lit && gradients)
+	{
+		stateset->setTextureAttributeAndModes(2, gradients, osg::StateAttribute::ON);
+		stateset->addUniform(new osg::Uniform("volumeGradientTexture", 2));
+	}
+	return true;
+}
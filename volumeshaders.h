@@ -0,0 +1,33 @@
+#ifndef	__AJ_VOLUMESHADERS__
+#define __AJ_VOLUMESHADERS__
+
+#include <osg/Image>
+#include <osg/StateSet>
+#include <osg/Texture3D>
+#include <osgVolume/Property>
+
+// Fragment shaders standing in for osgVolume's own behind its vertex shader
+// and property uniforms. They sample and shade as osgVolume's do, but march
+// each ray front to back, so it can stop early:
+//
+// - compositing stops once what the ray has passed is volumeEarlyTermination
+//   opaque, as what lies behind can add no more than what still shows through;
+// - maximum intensity projection stops on reaching volumeMaximumValue, the
+//   largest value in the volume, as nothing further along can be brighter;
+// - an isosurface stops at its first crossing.
+//
+// Both are uniforms; above 1 they never stop a ray. VolumeRayCaster follows
+// the same sampling on the CPU.
+//
+// The lit variants take the normal from the volume's gradients, see
+// computeGradients(), when they are given: one lookup per sample lit instead
+// of six, so lighting costs little more than the standard variant.
+
+// Replaces the fragment shader of the program RayTracedTechnique left on
+// stateset with one for property, the variant it was built for, reading
+// image, and the lit ones with gradients on texture unit 2 when there are
+// any. False, leaving the program as it was, when the fragment shader is not
+// one of osgVolume's this knows how to stand in for.
+bool applyRayCastShaders(osg::StateSet* stateset, osgVolume::Property* property, const osg::Image* image, osg::Texture3D* gradients = 0);
+
+#endif
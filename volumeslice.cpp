@@ -0,0 +1,143 @@
+#include "volumeslice.h"
+#include "volumedata.h"
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+
+// pixels a side of the tiles the threads take one at a time
+const int tileSize = 32;
+
+struct ResliceTask
+{
+	const osg::Image* image;
+	osg::Vec3 origin;
+	osg::Vec3 uAxis;
+	osg::Vec3 vAxis;
+	float low;
+	float high;
+	unsigned char* pixels;
+	int width;
+	int height;
+	int pitch;
+	int numTilesAcross;
+	int numTiles;
+	OpenThreads::Atomic next;
+};
+
+template<typename T>
+void resliceTile(const ResliceTask& task, int tile)
+{
+	const osg::Image* image = task.image;
+	int size[3] = { image->s(), image->t(), image->r() };
+	size_t componentStride = osg::Image::computeNumComponents(image->getPixelFormat());
+	size_t rowStride = image->getRowSizeInBytes()/sizeof(T);
+	size_t sliceStride = image->getImageSizeInBytes()/sizeof(T);
+	const T* voxels = reinterpret_cast<const T*>(image->data()) + volumeValueComponent(image);
+
+	float scale = task.high>task.low ? 255.0f/(task.high-task.low) : 0.0f;
+	osg::Vec3 du = task.uAxis/float(task.width);
+	osg::Vec3 dv = task.vAxis/float(task.height);
+
+	int i0 = (tile % task.numTilesAcross)*tileSize, j0 = (tile / task.numTilesAcross)*tileSize;
+	int i1 = std::min(i0+tileSize, task.width), j1 = std::min(j0+tileSize, task.height);
+	for (int j = j0; j < j1; ++j)
+	{
+		unsigned char* pixel = task.pixels + size_t(j)*task.pitch + i0;
+		osg::Vec3 point = task.origin + du*(i0+0.5f) + dv*(j+0.5f);
+		for (int i = i0; i < i1; ++i, ++pixel, point += du)
+		{
+			if (point.x()<0.0f || point.x()>1.0f || point.y()<0.0f || point.y()>1.0f || point.z()<0.0f || point.z()>1.0f)
+			{
+				*pixel = 0;
+				continue;
+			}
+
+			// GL_CLAMP_TO_EDGE, texel centres at half integers
+			size_t lo[3], hi[3];
+			float f[3];
+			for (int a = 0; a < 3; ++a)
+			{
+				float x = osg::clampBetween(point[a]*size[a] - 0.5f, 0.0f, float(size[a]-1));
+				int l = int(x);
+				f[a] = x - l;
+				lo[a] = l;
+				hi[a] = std::min(l+1, size[a]-1);
+			}
+			lo[0] *= componentStride; hi[0] *= componentStride;
+			lo[1] *= rowStride; hi[1] *= rowStride;
+			lo[2] *= sliceStride; hi[2] *= sliceStride;
+
+			const T* front = voxels + lo[2];
+			const T* back = voxels + hi[2];
+			float v00 = normalised(front[lo[1]+lo[0]]) + (normalised(front[lo[1]+hi[0]]) - normalised(front[lo[1]+lo[0]]))*f[0];
+			float v10 = normalised(front[hi[1]+lo[0]]) + (normalised(front[hi[1]+hi[0]]) - normalised(front[hi[1]+lo[0]]))*f[0];
+			float v01 = normalised(back[lo[1]+lo[0]]) + (normalised(back[lo[1]+hi[0]]) - normalised(back[lo[1]+lo[0]]))*f[0];
+			float v11 = normalised(back[hi[1]+lo[0]]) + (normalised(back[hi[1]+hi[0]]) - normalised(back[hi[1]+lo[0]]))*f[0];
+			float v0 = v00 + (v10 - v00)*f[1];
+			float v1 = v01 + (v11 - v01)*f[1];
+			float value = v0 + (v1 - v0)*f[2];
+
+			*pixel = static_cast<unsigned char>(osg::clampBetween((value - task.low)*scale + 0.5f, 0.0f, 255.0f));
+		}
+	}
+}
+
+class ResliceWorker : public OpenThreads::Thread
+{
+public:
+	ResliceWorker(ResliceTask& task) : _task(task) {}
+
+	virtual void run()
+	{
+		for(;;)
+		{
+			int tile = ++_task.next - 1;
+			if (tile>=_task.numTiles) return;
+			switch(_task.image->getDataType())
+			{
+				case(GL_UNSIGNED_BYTE): resliceTile<unsigned char>(_task, tile); break;
+				case(GL_UNSIGNED_SHORT): resliceTile<unsigned short>(_task, tile); break;
+				case(GL_FLOAT): resliceTile<float>(_task, tile); break;
+			}
+		}
+	}
+
+private:
+	ResliceTask& _task;
+};
+
+}
+
+bool resliceVolume(const osg::Image* image, const osg::Vec3& origin, const osg::Vec3& uAxis, const osg::Vec3& vAxis,
+				float low, float high, unsigned char* pixels, int width, int height, int pitch, unsigned int numThreads)
+{
+	if (!image || !image->data() || !pixels || width<=0 || height<=0) return false;
+	GLenum dataType = image->getDataType();
+	if (dataType!=GL_UNSIGNED_BYTE && dataType!=GL_UNSIGNED_SHORT && dataType!=GL_FLOAT) return false;
+
+	ResliceTask task;
+	task.image = image;
+	task.origin = origin;
+	task.uAxis = uAxis;
+	task.vAxis = vAxis;
+	task.low = low;
+	task.high = high;
+	task.pixels = pixels;
+	task.width = width;
+	task.height = height;
+	task.pitch = pitch;
+	task.numTilesAcross = (width+tileSize-1)/tileSize;
+	task.numTiles = task.numTilesAcross*((height+tileSize-1)/tileSize);
+
+	std::vector<ResliceWorker*> workers;
+	for (unsigned int i = 0; i < numWorkers(numThreads, task.numTiles); ++i) workers.push_back(new ResliceWorker(task));
+	runWorkers(workers);
+	for (unsigned int i = 0; i < workers.size(); ++i) delete workers[i];
+	return true;
+}
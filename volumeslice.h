@@ -0,0 +1,21 @@
+#ifndef	__AJ_VOLUMESLICE__
+#define __AJ_VOLUMESLICE__
+
+#include <osg/Image>
+#include <osg/Vec3>
+
+// Resamples the plane through image at origin + u*uAxis + v*vAxis, for u
+// and v in [0,1] and all in the image's texture coordinates, into width x
+// height grey pixels, rows pitch bytes apart. Pixel (i, j) takes the value
+// at u = (i+0.5)/width, v = (j+0.5)/height, filtered trilinearly as the
+// texture would be, with low black and high white in the same normalised
+// units as the texture; the plane outside the volume is black.
+//
+// Tiles of the result are shared out among numThreads threads, 0 for one per
+// processor, so each thread reads a compact part of the volume at a time.
+// False for data types other than GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT and
+// GL_FLOAT.
+bool resliceVolume(const osg::Image* image, const osg::Vec3& origin, const osg::Vec3& uAxis, const osg::Vec3& vAxis,
+				float low, float high, unsigned char* pixels, int width, int height, int pitch, unsigned int numThreads = 0);
+
+#endif
@@ -0,0 +1,313 @@
+#include "volumestream.h"
+#include "volumecache.h"
+#include "volumekernels.h"
+#include "volumeloader.h"
+#include "volumeprofile.h"
+
+#include <osg/Notify>
+#include <osg/Timer>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+
+// True when pattern holds exactly one integer conversion, %d or %i with at
+// most flags and a width, besides any %%: all it can safely be formatted with.
+bool isTimestepPattern(const std::string& pattern)
+{
+	unsigned int numConversions = 0;
+	for (std::string::size_type i = pattern.find('%'); i != std::string::npos; i = pattern.find('%', i+1))
+	{
+		if (i+1<pattern.size() && pattern[i+1]=='%')
+		{
+			++i;
+			continue;
+		}
+		std::string::size_type end = pattern.find_first_not_of("-+ #0123456789", i+1);
+		if (end==std::string::npos || (pattern[end]!='d' && pattern[end]!='i')) return false;
+		++numConversions;
+		i = end;
+	}
+	return numConversions==1;
+}
+
+}
+
+std::vector<std::string> volumeTimesteps(const std::string& pattern)
+{
+	std::vector<std::string> timesteps;
+	if (pattern.find('%') != std::string::npos)
+	{
+		if (!isTimestepPattern(pattern))
+		{
+			OSG_WARN<<"volumeTimesteps: "<<pattern<<" needs exactly one integer conversion such as %03d"<<std::endl;
+			return timesteps;
+		}
+
+		// numbering may start at 0 or at 1
+		std::vector<char> name(pattern.size()+256);
+		for (int first = 0; first < 2 && timesteps.empty(); ++first)
+		{
+			for (int i = first; ; ++i)
+			{
+#ifdef _MSC_VER
+				int length = _snprintf(&name[0], name.size(), pattern.c_str(), i);
+#else
+				int length = snprintf(&name[0], name.size(), pattern.c_str(), i);
+#endif
+				// a width wider than the buffer
+				if (length<0 || length>=(int)name.size()) break;
+				osgDB::DirectoryContents files = volumeSourceFiles(&name[0]);
+				if (files.empty() || !osgDB::fileExists(files[0])) break;
+				timesteps.push_back(&name[0]);
+			}
+		}
+	}
+	else if (osgDB::fileType(pattern)==osgDB::DIRECTORY)
+	{
+		osgDB::DirectoryContents contents = osgDB::getDirectoryContents(pattern);
+		std::sort(contents.begin(), contents.end());
+		for (unsigned int i = 0; i < contents.size(); ++i)
+		{
+			if (contents[i]=="." || contents[i]=="..") continue;
+			std::string path = osgDB::concatPaths(pattern, contents[i]);
+			if (osgDB::fileType(path)==osgDB::DIRECTORY) timesteps.push_back(osgDB::concatPaths(path, "*"));
+		}
+	}
+	return timesteps;
+}
+
+bool replaceVoxels(osg::Image* image, const osg::Image* source)
+{
+	if (!image || !source || image->s()!=source->s() || image->t()!=source->t() || image->r()!=source->r() ||
+		image->getPixelFormat()!=source->getPixelFormat() || image->getDataType()!=source->getDataType() ||
+		image->getTotalSizeInBytes()!=source->getTotalSizeInBytes())
+	{
+		return false;
+	}
+
+	memcpy(image->data(), source->data(), image->getTotalSizeInBytes());
+	image->dirty();
+	VolumeProfiler::instance()->count(VolumeProfiler::TextureUploadBytes, image->getTotalSizeInBytes());
+	return true;
+}
+
+class VolumeStream::Worker : public OpenThreads::Thread
+{
+public:
+	Worker(VolumeStream* stream) : _stream(stream) {}
+
+	virtual void run() { _stream->work(); }
+
+private:
+	VolumeStream* _stream;
+};
+
+VolumeStream::VolumeStream(const std::vector<std::string>& files, const VolumeOptions& options, const VolumeData* reference,
+						int maximumTextureSize, unsigned int numLevels, unsigned int ringSize, unsigned int numThreads)
+	: _files(files),
+	_options(options),
+	_texelOffset(reference->texelOffset[0]),
+	_texelScale(reference->texelScale[0]),
+	_s(reference->image->s()),
+	_t(reference->image->t()),
+	_r(reference->image->r()),
+	_pixelFormat(reference->image->getPixelFormat()),
+	_dataType(reference->image->getDataType()),
+	_maximumTextureSize(maximumTextureSize),
+	_numLevels(numLevels),
+	_ringSize(std::max(1u, ringSize)),
+	_writeCache(false),
+	_timestep(0),
+	_rate(0.0f),
+	_decodeTime(0.0),
+	_quit(false)
+{
+	const char* writeCache = getenv("MYVOLUME_STREAM_CACHE");
+	_writeCache = writeCache && std::string(writeCache)=="on";
+
+	// every worker decodes a timestep of its own, the slice loader of each brings its own threads
+	numThreads = std::max(1u, std::min(numThreads, _ringSize));
+	for (unsigned int i = 0; i < numThreads; ++i)
+	{
+		Worker* worker = new Worker(this);
+		worker->start();
+		_workers.push_back(worker);
+	}
+}
+
+VolumeStream::~VolumeStream()
+{
+	stop();
+}
+
+void VolumeStream::stop()
+{
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		_quit = true;
+		_changed.broadcast();
+	}
+	for (unsigned int i = 0; i < _workers.size(); ++i)
+	{
+		_workers[i]->join();
+		delete _workers[i];
+	}
+	_workers.clear();
+}
+
+void VolumeStream::setPlayback(unsigned int timestep, float rate)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+	if (timestep==_timestep && rate==_rate) return;
+	_timestep = timestep % _files.size();
+	_rate = rate;
+	_changed.broadcast();
+}
+
+bool VolumeStream::get(unsigned int timestep, osg::ref_ptr<Timestep>& result)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+	for (unsigned int i = 0; i < _ring.size(); ++i)
+	{
+		if (_ring[i]->index!=timestep) continue;
+		result = _ring[i];
+		return true;
+	}
+	return false;
+}
+
+unsigned int VolumeStream::getNumResident()
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+	return _ring.size();
+}
+
+void VolumeStream::window(std::vector<unsigned int>& wanted) const
+{
+	// the timesteps that go by while the workers decode one each are not worth fetching
+	unsigned int stride = 1;
+	if (_rate!=0.0f && _decodeTime>0.0)
+	{
+		double passing = fabs(_rate)*_decodeTime/(1000.0*_workers.size());
+		stride = std::max(1u, static_cast<unsigned int>(ceil(passing)));
+	}
+
+	unsigned int numTimesteps = _files.size();
+	unsigned int length = std::min(_ringSize, numTimesteps);
+	for (unsigned int k = 0; k < length; ++k)
+	{
+		// playback loops, the window wraps around the ends
+		unsigned int offset = (k*stride) % numTimesteps;
+		unsigned int index = _rate<0.0f ? (_timestep + numTimesteps - offset) % numTimesteps : (_timestep + offset) % numTimesteps;
+		if (std::find(wanted.begin(), wanted.end(), index)==wanted.end()) wanted.push_back(index);
+	}
+}
+
+bool VolumeStream::isResident(unsigned int index) const
+{
+	for (unsigned int i = 0; i < _ring.size(); ++i)
+	{
+		if (_ring[i]->index==index) return true;
+	}
+	return false;
+}
+
+void VolumeStream::work()
+{
+	_mutex.lock();
+	while(!_quit)
+	{
+		std::vector<unsigned int> wanted;
+		window(wanted);
+
+		int next = -1;
+		for (unsigned int i = 0; i < wanted.size() && next<0; ++i)
+		{
+			if (isResident(wanted[i]) || std::find(_inFlight.begin(), _inFlight.end(), wanted[i])!=_inFlight.end()) continue;
+			next = wanted[i];
+		}
+
+		// room is made by dropping a timestep playback has left behind
+		bool room = next>=0 && _ring.size()+_inFlight.size()<_ringSize;
+		for (unsigned int i = 0; i < _ring.size() && next>=0 && !room; ++i)
+		{
+			if (std::find(wanted.begin(), wanted.end(), _ring[i]->index)!=wanted.end()) continue;
+			_ring.erase(_ring.begin()+i);
+			room = true;
+		}
+
+		if (!room)
+		{
+			_changed.wait(&_mutex);
+			continue;
+		}
+
+		_inFlight.push_back(next);
+		_mutex.unlock();
+
+		osg::Timer_t start = osg::Timer::instance()->tick();
+		osg::ref_ptr<Timestep> timestep = decode(next);
+		double time = osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick());
+
+		_mutex.lock();
+		_inFlight.erase(std::find(_inFlight.begin(), _inFlight.end(), static_cast<unsigned int>(next)));
+		_ring.push_back(timestep);
+		_decodeTime = _decodeTime>0.0 ? _decodeTime*0.75 + time*0.25 : time;
+	}
+	_mutex.unlock();
+}
+
+VolumeStream::Timestep* VolumeStream::decode(unsigned int index)
+{
+	ProfileScope scope("decodeTimestep");
+	osg::ref_ptr<Timestep> timestep = new Timestep(index);
+
+	// a lookup only, unless asked to: waiting on the other processes' claims
+	// would stall playback, and writing every timestep fills the disk
+	VolumeCache cache(_files[index], _options);
+	osg::ref_ptr<VolumeData> data = cache.read();
+	if (!data)
+	{
+		data = loadVolumeData(_files[index], _options);
+		if (data && _writeCache && cache.write(data.get()))
+		{
+			osg::ref_ptr<VolumeData> mapped = cache.read();
+			if (mapped) data = mapped;
+		}
+	}
+
+	osg::Image* image = data.valid() ? data->image.get() : 0;
+	if (!image)
+	{
+		OSG_NOTICE<<"VolumeStream: could not read timestep "<<index<<" from "<<_files[index]<<std::endl;
+		return timestep.release();
+	}
+	if (image->s()!=_s || image->t()!=_t || image->r()!=_r || image->getPixelFormat()!=_pixelFormat || image->getDataType()!=_dataType)
+	{
+		OSG_NOTICE<<"VolumeStream: timestep "<<index<<" is "<<image->s()<<"x"<<image->t()<<"x"<<image->r()<<", unlike the first, skipped"<<std::endl;
+		return timestep.release();
+	}
+
+	// v*scale + offset reads the source value, bring it onto the first timestep's mapping
+	float scale = data->texelScale[0]/_texelScale;
+	float offset = (data->texelOffset[0] - _texelOffset)/_texelScale;
+	if ((scale!=1.0f || offset!=0.0f) && !offsetAndScaleVolume(image, offset, scale))
+	{
+		osg::offsetAndScaleImage(image, osg::Vec4(offset, offset, offset, offset), osg::Vec4(scale, scale, scale, scale));
+	}
+
+	buildLevels(image, _maximumTextureSize, _numLevels, timestep->levels);
+	timestep->occupancy = new OccupancyGrid(image);
+	timestep->image = image;
+	return timestep.release();
+}
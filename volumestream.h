@@ -0,0 +1,109 @@
+#ifndef	__AJ_VOLUMESTREAM__
+#define __AJ_VOLUMESTREAM__
+
+#include "volumedata.h"
+#include "volumeoccupancy.h"
+
+#include <osg/Image>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+
+#include <string>
+#include <vector>
+
+// The volume of every timestep of a time-varying dataset. pattern is either
+// a printf pattern with one integer conversion, "run/t%03d/*", counted up from
+// 0 or 1 until a timestep has no files (any other conversion is refused), or a directory whose subdirectories,
+// in name order, each hold the slices of one timestep.
+std::vector<std::string> volumeTimesteps(const std::string& pattern);
+
+// Copies the voxels of source into image and marks it for upload; false when
+// their sizes or formats differ.
+bool replaceVoxels(osg::Image* image, const osg::Image* source);
+
+// Streams the timesteps of a time-varying volume through a ring of decoded
+// volumes, so memory follows the ring size rather than the sequence length.
+//
+// Worker threads fill the ring with the timesteps playback reaches next, in
+// the order it reaches them. When playback outruns decoding, the prefetch
+// strides over the timesteps that would pass before they could be ready.
+// Every timestep is brought onto the texel mapping of the first, so one
+// transfer function and one set of techniques serve the whole sequence.
+//
+// Timesteps already in the VolumeCache are mapped from it. Writing the ones
+// decoded there costs a copy of the whole sequence on disk, so it is only
+// done with MYVOLUME_STREAM_CACHE=on.
+class VolumeStream : public osg::Referenced
+{
+public:
+	struct Timestep : public osg::Referenced
+	{
+		Timestep(unsigned int i) : index(i) {}
+
+		unsigned int index;
+		// 0 when the timestep could not be read or does not match the first
+		osg::ref_ptr<osg::Image> image;
+		std::vector< osg::ref_ptr<osg::Image> > levels;
+		osg::ref_ptr<OccupancyGrid> occupancy;
+	};
+
+	// reference is the first timestep as loaded, whose size, format and texel
+	// mapping the others are brought to; numLevels coarser copies are built
+	// with each, as buildLevels does.
+	VolumeStream(const std::vector<std::string>& files, const VolumeOptions& options, const VolumeData* reference,
+				int maximumTextureSize, unsigned int numLevels, unsigned int ringSize, unsigned int numThreads = 2);
+
+	unsigned int getNumTimesteps() const { return _files.size(); }
+	unsigned int getRingSize() const { return _ringSize; }
+
+	// Where playback is and how fast it goes, in timesteps per second; a
+	// negative rate plays backwards.
+	void setPlayback(unsigned int timestep, float rate);
+
+	// The timestep if it is in the ring.
+	bool get(unsigned int timestep, osg::ref_ptr<Timestep>& result);
+
+	unsigned int getNumResident();
+
+	void stop();
+
+protected:
+	virtual ~VolumeStream();
+
+	class Worker;
+	friend class Worker;
+
+	void work();
+	Timestep* decode(unsigned int index);
+	// the timesteps to hold, nearest first
+	void window(std::vector<unsigned int>& wanted) const;
+	bool isResident(unsigned int index) const;
+
+	std::vector<std::string> _files;
+	VolumeOptions _options;
+	float _texelOffset;
+	float _texelScale;
+	int _s, _t, _r;
+	GLenum _pixelFormat;
+	GLenum _dataType;
+	int _maximumTextureSize;
+	unsigned int _numLevels;
+	unsigned int _ringSize;
+	bool _writeCache;
+
+	OpenThreads::Mutex _mutex;
+	OpenThreads::Condition _changed;
+	std::vector< osg::ref_ptr<Timestep> > _ring;
+	std::vector<unsigned int> _inFlight;
+	unsigned int _timestep;
+	float _rate;
+	// exponential mean of the milliseconds a timestep takes to decode
+	double _decodeTime;
+	bool _quit;
+
+	std::vector<Worker*> _workers;
+};
+
+#endif
@@ -0,0 +1,286 @@
+#include "volumetechnique.h"
+#include "volumeprofile.h"
+#include "volumeregistry.h"
+#include "volumeshaders.h"
+
+#include <osg/ColorMask>
+#include <osg/Depth>
+#include <osg/Geode>
+#include <osg/MatrixTransform>
+#include <osg/TexGen>
+#include <osgVolume/Locator>
+#include <osg/Texture>
+#include <osgUtil/CullVisitor>
+
+#include <OpenThreads/ScopedLock>
+
+namespace
+{
+
+// RayTracedTechnique keeps its state on the geode below its transform.
+osg::StateSet* techniqueStateSet(osg::MatrixTransform* transform)
+{
+	if (transform->getStateSet()) return transform->getStateSet();
+	if (transform->getNumChildren()==0) return 0;
+	return transform->getChild(0)->getStateSet();
+}
+
+// The properties of a layer with the shading modes every tile shares replaced
+// by one of them, so a variant is built without switching the other tiles.
+osgVolume::Property* variantProperty(osgVolume::Property* property, osgVolume::SwitchProperty* modes, unsigned int variant)
+{
+	if (property==modes) return modes->getProperty(variant);
+	osgVolume::CompositeProperty* composite = dynamic_cast<osgVolume::CompositeProperty*>(property);
+	if (!composite || dynamic_cast<osgVolume::SwitchProperty*>(property)) return property;
+
+	osg::ref_ptr<osgVolume::CompositeProperty> copy = new osgVolume::CompositeProperty;
+	for (unsigned int i = 0; i < composite->getNumProperties(); ++i)
+	{
+		copy->addProperty(variantProperty(composite->getProperty(i), modes, variant));
+	}
+	return copy.release();
+}
+
+bool sameShaders(osg::Program* a, osg::Program* b)
+{
+	if (a->getNumShaders()!=b->getNumShaders()) return false;
+	for (unsigned int i = 0; i < a->getNumShaders(); ++i)
+	{
+		if (a->getShader(i)->getType()!=b->getShader(i)->getType() ||
+			a->getShader(i)->getShaderSource()!=b->getShader(i)->getShaderSource()) return false;
+	}
+	return true;
+}
+
+}
+
+ShadingVariants::ShadingVariants(osgVolume::SwitchProperty* modes)
+	: _modes(modes),
+	_earlyTermination(0.98f)
+{
+	_earlyTerminationUniform = new osg::Uniform("volumeEarlyTermination", _earlyTermination);
+	_earlyTerminationUniform->setDataVariance(osg::Object::DYNAMIC);
+	_maximumValueUniform = new osg::Uniform("volumeMaximumValue", 2.0f);
+	_maximumValueUniform->setDataVariance(osg::Object::DYNAMIC);
+
+	_warmingStateSet = new osg::StateSet;
+	_warmingStateSet->setAttribute(new osg::ColorMask(false, false, false, false), osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE);
+	_warmingStateSet->setAttribute(new osg::Depth(osg::Depth::LESS, 0.0, 1.0, false), osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE);
+}
+
+void ShadingVariants::setEarlyTermination(float opacity)
+{
+	_earlyTermination = opacity;
+	// past what the shaders can reach, when off
+	_earlyTerminationUniform->set(opacity>0.0f ? opacity : 2.0f);
+}
+
+void ShadingVariants::setMaximumValue(float value)
+{
+	_maximumValueUniform->set(value>=0.0f ? value : 2.0f);
+}
+
+void ShadingVariants::addUniforms(osg::StateSet* stateset)
+{
+	stateset->addUniform(_earlyTerminationUniform.get());
+	stateset->addUniform(_maximumValueUniform.get());
+}
+
+void ShadingVariants::setGradients(const osg::Image* image, osg::Image* gradients)
+{
+	if (!gradients)
+	{
+		_gradientTextures.erase(image);
+		return;
+	}
+
+	osg::ref_ptr<osg::Texture3D> texture = new osg::Texture3D(gradients);
+	texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+	texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+	texture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+	texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+	texture->setWrap(osg::Texture::WRAP_R, osg::Texture::CLAMP_TO_EDGE);
+	texture->setResizeNonPowerOfTwoHint(false);
+	_gradientTextures[image] = static_cast<osg::Texture3D*>(VolumeRegistry::instance()->shareTexture(texture.get()));
+}
+
+osg::Texture3D* ShadingVariants::getGradientTexture(const osg::Image* image)
+{
+	std::map< const osg::Image*, osg::ref_ptr<osg::Texture3D> >::iterator itr = _gradientTextures.find(image);
+	return itr!=_gradientTextures.end() ? itr->second.get() : 0;
+}
+
+osg::Program* ShadingVariants::shareProgram(unsigned int variant, osg::Program* program)
+{
+	if (variant>=_programs.size()) _programs.resize(variant+1);
+	if (!_programs[variant].valid()) _programs[variant] = program;
+
+	// a tile whose shaders came out different keeps its own
+	return sameShaders(_programs[variant].get(), program) ? _programs[variant].get() : program;
+}
+
+bool ShadingVariants::needsWarming(unsigned int contextID, const osg::Program* program)
+{
+	if (!program) return false;
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+	if (contextID>=_warmed.size()) _warmed.resize(contextID+1);
+	osg::observer_ptr<const osg::Program>& warmed = _warmed[contextID][program];
+	if (warmed.valid()) return false;
+
+	warmed = program;
+	return true;
+}
+
+VariantTechnique::VariantTechnique(ShadingVariants* variants)
+	: _variants(variants)
+{
+}
+
+void VariantTechnique::init()
+{
+	ProfileScope scope("initTechnique");
+	osgVolume::SwitchProperty* modes = _variants->getModes();
+	int active = modes->getActiveProperty();
+
+	// the tile's proxy cube within the volume's, for the clipping
+	VolumeClipping* clipping = _variants->getClipping();
+	osg::Matrix proxyToVolume;
+	if (clipping && _volumeTile && _volumeTile->getLocator())
+	{
+		proxyToVolume = _volumeTile->getLocator()->getTransform() * osg::Matrix::inverse(clipping->getVolumeMatrix());
+	}
+
+	// read by the lit variants instead of six lookups of the volume per sample
+	osgVolume::ImageLayer* layer = _volumeTile ? dynamic_cast<osgVolume::ImageLayer*>(_volumeTile->getLayer()) : 0;
+	osg::Texture3D* gradients = layer ? _variants->getGradientTexture(layer->getImage()) : 0;
+	bool gradientsUsed = false;
+
+	// RayTracedTechnique builds for the layer's properties, so each variant is built
+	// in turn from this tile's own copy of them; the modes the other tiles cull by
+	// are left alone
+	osgVolume::Layer* tileLayer = _volumeTile ? _volumeTile->getLayer() : 0;
+	osg::ref_ptr<osgVolume::Property> property = tileLayer ? tileLayer->getProperty() : 0;
+	_variantTransforms.clear();
+	_variantPrograms.clear();
+	std::vector< osg::ref_ptr<osg::Texture> > textures;
+	std::vector<bool> uploads;
+	for (unsigned int i = 0; i < modes->getNumProperties(); ++i)
+	{
+		osg::ref_ptr<osgVolume::Property> variant = property.valid() ? variantProperty(property.get(), modes, i) : 0;
+		if (tileLayer) tileLayer->setProperty(variant.get());
+		osgVolume::RayTracedTechnique::init();
+		if (!_transform.valid()) break;
+
+		osg::StateSet* stateset = techniqueStateSet(_transform.get());
+		if (stateset)
+		{
+			// one copy of the volume and transfer function on the GPU, whichever variant
+			// draws, and whichever instance of the module draws the same image
+			for (unsigned int unit = 0; unit < 4; ++unit)
+			{
+				osg::Texture* texture = dynamic_cast<osg::Texture*>(stateset->getTextureAttribute(unit, osg::StateAttribute::TEXTURE));
+				if (!texture) continue;
+				if (unit>=textures.size())
+				{
+					textures.resize(unit+1);
+					uploads.resize(unit+1, false);
+				}
+				if (!textures[unit].valid())
+				{
+					textures[unit] = VolumeRegistry::instance()->shareTexture(texture);
+					uploads[unit] = textures[unit]==texture;
+				}
+				if (textures[unit]!=texture && textures[unit]->getImage(0)==texture->getImage(0)) stateset->setTextureAttribute(unit, textures[unit].get());
+			}
+
+			if (layer && applyRayCastShaders(stateset, layer->getProperty(), layer->getImage(), gradients))
+			{
+				_variants->addUniforms(stateset);
+				gradientsUsed |= gradients && stateset->getTextureAttribute(2, osg::StateAttribute::TEXTURE)==gradients;
+			}
+			if (clipping) clipping->apply(stateset, proxyToVolume);
+
+			osg::Program* program = dynamic_cast<osg::Program*>(stateset->getAttribute(osg::StateAttribute::PROGRAM));
+			if (program)
+			{
+				program = _variants->shareProgram(i, program);
+				stateset->setAttribute(program);
+			}
+			_variantPrograms.push_back(program);
+		}
+		else
+		{
+			_variantPrograms.push_back(0);
+		}
+		_variantTransforms.push_back(_transform);
+	}
+
+	if (tileLayer) tileLayer->setProperty(property.get());
+
+	// the new textures upload on their first draw, one copy each for all the variants
+	VolumeProfiler* profiler = VolumeProfiler::instance();
+	profiler->count(VolumeProfiler::TechniqueInits);
+	for (unsigned int unit = 0; unit < textures.size(); ++unit)
+	{
+		const osg::Image* image = textures[unit].valid() && uploads[unit] ? textures[unit]->getImage(0) : 0;
+		if (image) profiler->count(VolumeProfiler::TextureUploadBytes, image->getTotalSizeInBytes());
+	}
+	if (gradientsUsed) profiler->count(VolumeProfiler::TextureUploadBytes, gradients->getImage()->getTotalSizeInBytes());
+
+	if (active>=0 && active<(int)_variantTransforms.size()) _transform = _variantTransforms[active];
+}
+
+bool VariantTechnique::setProxyMatrix(const osg::Matrix& matrix)
+{
+	if (_variantTransforms.empty()) return false;
+
+	// as init() would build them for a tile at matrix
+	osgVolume::Layer* layer = _volumeTile ? _volumeTile->getLayer() : 0;
+	osg::Matrix imageMatrix = layer && layer->getLocator() ? layer->getLocator()->getTransform() : matrix;
+	VolumeClipping* clipping = _variants->getClipping();
+	osg::Matrix proxyToVolume;
+	if (clipping) proxyToVolume = matrix * osg::Matrix::inverse(clipping->getVolumeMatrix());
+
+	for (unsigned int i = 0; i < _variantTransforms.size(); ++i)
+	{
+		_variantTransforms[i]->setMatrix(matrix);
+
+		osg::StateSet* stateset = techniqueStateSet(_variantTransforms[i].get());
+		if (!stateset) continue;
+		osg::TexGen* texgen = dynamic_cast<osg::TexGen*>(stateset->getTextureAttribute(0, osg::StateAttribute::TEXGEN));
+		if (texgen) texgen->setPlanesFromMatrix(matrix * osg::Matrix::inverse(imageMatrix));
+		osg::Uniform* clip = stateset->getUniform("volumeClipTransform");
+		if (clip) clip->set(osg::Matrixf(proxyToVolume));
+	}
+	return true;
+}
+
+void VariantTechnique::cull(osgUtil::CullVisitor* cv)
+{
+	unsigned int active = _variants->getModes()->getActiveProperty();
+	if (active>=_variantTransforms.size()) return;
+	_variantTransforms[active]->accept(*cv);
+
+	unsigned int contextID = cv->getState() ? cv->getState()->getContextID() : 0;
+	for (unsigned int i = 0; i < _variantTransforms.size(); ++i)
+	{
+		// the active program is drawn already, and warm from here on
+		if (!_variants->needsWarming(contextID, _variantPrograms[i].get()) || i==active) continue;
+
+		cv->pushStateSet(_variants->getWarmingStateSet());
+		_variantTransforms[i]->accept(*cv);
+		cv->popStateSet();
+	}
+}
+
+void placeVolumeTile(osgVolume::VolumeTile* tile, const osg::Matrix& matrix)
+{
+	if (tile->getLocator() && tile->getLocator()->getTransform()==matrix) return;
+	tile->setLocator(new osgVolume::Locator(matrix));
+
+	// a tile waiting for its init() picks the Locator up there
+	if (tile->getDirty()) return;
+	VariantTechnique* technique = dynamic_cast<VariantTechnique*>(tile->getVolumeTechnique());
+	if (!technique || !technique->setProxyMatrix(matrix)) tile->setDirty(true);
+}
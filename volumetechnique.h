@@ -0,0 +1,111 @@
+#ifndef	__AJ_VOLUMETECHNIQUE__
+#define __AJ_VOLUMETECHNIQUE__
+
+#include "volumeclip.h"
+
+#include <osg/Program>
+#include <osg/observer_ptr>
+#include <osg/StateSet>
+#include <osg/Texture3D>
+#include <osgVolume/Property>
+#include <osgVolume/RayTracedTechnique>
+#include <osgVolume/VolumeTile>
+
+#include <OpenThreads/Mutex>
+
+#include <map>
+#include <vector>
+
+// The shading modes of a volume: one SwitchProperty entry per variant, and
+// the programs built for them, shared by every tile drawing the volume so a
+// variant compiles once per context however many bricks and levels use it.
+class ShadingVariants : public osg::Referenced
+{
+public:
+	ShadingVariants(osgVolume::SwitchProperty* modes);
+
+	osgVolume::SwitchProperty* getModes() { return _modes.get(); }
+
+	// The clipping every variant is built with, from the next init() of each tile.
+	void setClipping(VolumeClipping* clipping) { _clipping = clipping; }
+	VolumeClipping* getClipping() { return _clipping.get(); }
+
+	// Compositing rays stop once what they passed is this opaque, 0 never.
+	void setEarlyTermination(float opacity);
+	float getEarlyTermination() const { return _earlyTermination; }
+	// The value, 0..1, maximum intensity projection can stop on, see
+	// maximumValueThreshold(); negative when it is not known.
+	void setMaximumValue(float value);
+
+	// The uniforms above, for the stateset of every variant.
+	void addUniforms(osg::StateSet* stateset);
+
+	// The gradients of image, see computeGradients(), for the lit variants of
+	// the tiles drawing it to read from the next init(); 0 to go back to
+	// working them out in the shaders.
+	void setGradients(const osg::Image* image, osg::Image* gradients);
+	// One texture for every tile and variant drawing image, 0 when it has none.
+	osg::Texture3D* getGradientTexture(const osg::Image* image);
+
+	// The first program built for variant; the later tiles drop their own for it.
+	osg::Program* shareProgram(unsigned int variant, osg::Program* program);
+
+	// True the first time program is asked for on a context, when it should be
+	// drawn to compile; a tile that keeps a program of its own warms that too.
+	bool needsWarming(unsigned int contextID, const osg::Program* program);
+
+	// Masks colour and depth writes, for drawing a variant only to compile it.
+	osg::StateSet* getWarmingStateSet() { return _warmingStateSet.get(); }
+
+protected:
+	virtual ~ShadingVariants() {}
+
+	osg::ref_ptr<osgVolume::SwitchProperty> _modes;
+	osg::ref_ptr<VolumeClipping> _clipping;
+	float _earlyTermination;
+	osg::ref_ptr<osg::Uniform> _earlyTerminationUniform;
+	osg::ref_ptr<osg::Uniform> _maximumValueUniform;
+	std::vector< osg::ref_ptr<osg::Program> > _programs;
+	std::map< const osg::Image*, osg::ref_ptr<osg::Texture3D> > _gradientTextures;
+	osg::ref_ptr<osg::StateSet> _warmingStateSet;
+
+	// the programs warmed on each context, watched so a new one at the same address is not taken for them
+	typedef std::map< const osg::Program*, osg::observer_ptr<const osg::Program> > WarmedPrograms;
+	OpenThreads::Mutex _mutex;
+	std::vector<WarmedPrograms> _warmed;
+};
+
+// A RayTracedTechnique that builds the scene graph of every variant at init()
+// and draws the active one, so switching the shading mode is a switch of
+// subgraph rather than a re-init and a compile on the spot. The variants share
+// the volume's textures; each is drawn once, masked out, on the first frames
+// so its program is linked before it is first needed. With a VolumeClipping
+// on the variants, every variant's rays are clipped by it. The fragment
+// shaders are replaced by those of volumeshaders.h, which stop rays early,
+// and light from the gradients the variants have for the tile's image.
+class VariantTechnique : public osgVolume::RayTracedTechnique
+{
+public:
+	VariantTechnique(ShadingVariants* variants);
+
+	virtual void init();
+	virtual void cull(osgUtil::CullVisitor* cv);
+
+	// Moves the proxy of every variant to matrix, the transform of the tile's
+	// new Locator, along with its texture coordinates and clipping; the
+	// variants and their textures stay. False before the first init().
+	bool setProxyMatrix(const osg::Matrix& matrix);
+
+protected:
+	virtual ~VariantTechnique() {}
+
+	osg::ref_ptr<ShadingVariants> _variants;
+	std::vector< osg::ref_ptr<osg::MatrixTransform> > _variantTransforms;
+	std::vector< osg::ref_ptr<osg::Program> > _variantPrograms;
+};
+
+// Gives tile a Locator with matrix, moving the proxies of a VariantTechnique
+// already built rather than dirtying the tile for a re-init.
+void placeVolumeTile(osgVolume::VolumeTile* tile, const osg::Matrix& matrix);
+
+#endif
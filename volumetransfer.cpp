@@ -0,0 +1,114 @@
+#include "volumetransfer.h"
+#include "volumeprofile.h"
+
+#include <OpenThreads/ScopedLock>
+
+void rasterizeTransferFunction(const osg::TransferFunction1D::ColorMap& colorMap, osg::Image* image)
+{
+	osg::Vec4* cells = reinterpret_cast<osg::Vec4*>(image->data());
+	int numCells = image->s();
+	if (colorMap.empty())
+	{
+		for (int i = 0; i < numCells; ++i) cells[i].set(1.0f, 1.0f, 1.0f, 1.0f);
+		return;
+	}
+
+	float minimum = colorMap.begin()->first;
+	float maximum = colorMap.rbegin()->first;
+	float step = numCells>1 ? (maximum-minimum)/float(numCells-1) : 0.0f;
+
+	// one sweep, the cells and the points are both in increasing order
+	osg::TransferFunction1D::ColorMap::const_iterator upper = colorMap.begin();
+	for (int i = 0; i < numCells; ++i)
+	{
+		float v = minimum + step*float(i);
+		while(upper!=colorMap.end() && upper->first<v) ++upper;
+
+		if (upper==colorMap.end())
+		{
+			cells[i] = colorMap.rbegin()->second;
+		}
+		else if (upper==colorMap.begin() || upper->first==v)
+		{
+			cells[i] = upper->second;
+		}
+		else
+		{
+			osg::TransferFunction1D::ColorMap::const_iterator lower = upper;
+			--lower;
+			float r = (v - lower->first)/(upper->first - lower->first);
+			cells[i] = lower->second*(1.0f-r) + upper->second*r;
+		}
+	}
+}
+
+TransferFunctionBuilder::TransferFunctionBuilder()
+	: _requestCells(0),
+	_pending(false),
+	_hasReady(false),
+	_quit(false)
+{
+}
+
+TransferFunctionBuilder::~TransferFunctionBuilder()
+{
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		_quit = true;
+		_submitted.signal();
+	}
+	join();
+}
+
+void TransferFunctionBuilder::submit(unsigned int version, const osg::TransferFunction1D::ColorMap& colorMap, unsigned int numCells)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+	_request.version = version;
+	_request.colorMap = colorMap;
+	_requestCells = numCells;
+	_pending = true;
+	_submitted.signal();
+}
+
+bool TransferFunctionBuilder::take(Table& table)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+	if (!_hasReady) return false;
+
+	table = _ready;
+	_ready.image = 0;
+	_hasReady = false;
+	return true;
+}
+
+void TransferFunctionBuilder::run()
+{
+	for(;;)
+	{
+		Table table;
+		unsigned int numCells = 0;
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+			while(!_pending && !_quit) _submitted.wait(&_mutex);
+			if (_quit) return;
+			table.version = _request.version;
+			table.colorMap.swap(_request.colorMap);
+			numCells = _requestCells;
+			_pending = false;
+		}
+
+		{
+			ProfileScope scope("rasterizeTransferFunction");
+			table.image = new osg::Image;
+			table.image->allocateImage(numCells, 1, 1, GL_RGBA, GL_FLOAT);
+			rasterizeTransferFunction(table.colorMap, table.image.get());
+		}
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+		if (!_hasReady || table.version>_ready.version)
+		{
+			_ready = table;
+			_hasReady = true;
+		}
+	}
+}
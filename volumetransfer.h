@@ -0,0 +1,54 @@
+#ifndef	__AJ_VOLUMETRANSFER__
+#define __AJ_VOLUMETRANSFER__
+
+#include <osg/Image>
+#include <osg/TransferFunction>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+
+// Fills the cells of image, a 1D GL_RGBA GL_FLOAT table, the way
+// osg::TransferFunction1D::updateImage does: colours interpolate linearly
+// between the points and clamp past the first and last.
+void rasterizeTransferFunction(const osg::TransferFunction1D::ColorMap& colorMap, osg::Image* image);
+
+// Rasterises transfer functions on a thread of its own. Each submission
+// carries a version; a newer one replaces a submission not yet started and
+// take() only ever hands back the newest table finished, so however many
+// edits arrive the render thread swaps in one table per frame.
+class TransferFunctionBuilder : public osg::Referenced, public OpenThreads::Thread
+{
+public:
+	struct Table
+	{
+		Table() : version(0) {}
+
+		unsigned int version;
+		osg::TransferFunction1D::ColorMap colorMap;
+		osg::ref_ptr<osg::Image> image;
+	};
+
+	TransferFunctionBuilder();
+
+	void submit(unsigned int version, const osg::TransferFunction1D::ColorMap& colorMap, unsigned int numCells);
+
+	// Returns false when nothing newer than the last take() is ready.
+	bool take(Table& table);
+
+	virtual void run();
+
+protected:
+	virtual ~TransferFunctionBuilder();
+
+	OpenThreads::Mutex _mutex;
+	OpenThreads::Condition _submitted;
+	Table _request;
+	unsigned int _requestCells;
+	bool _pending;
+	Table _ready;
+	bool _hasReady;
+	bool _quit;
+};
+
+#endif